@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "arena.h"
+
+
+size_t arena_aligned_size(size_t size) {
+    return (size + ARENA_ALIGNMENT - 1) & ~((size_t) ARENA_ALIGNMENT - 1);
+}
+
+
+/* The mapping of regular pages reserves no swap space, the memory is
+ * committed only when its pages are pre-faulted. The explicit huge pages
+ * are reserved for the whole mapping, as they could not be faulted in
+ * later otherwise
+ */
+static
+void *map_arena(size_t size, int flags) {
+    void *mapping = MAP_FAILED;
+
+    if(flags & ARENA_HUGE_PAGES) {
+        mapping = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+        if(mapping != MAP_FAILED) {
+            return mapping;
+        }
+
+        fprintf(stderr, "Explicit huge pages not available, using transparent huge pages\n");
+    }
+
+    mapping = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    if(mapping == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+
+    /* Has to be advised before the pages are faulted in */
+    if((flags & ARENA_HUGE_PAGES) && madvise(mapping, size, MADV_HUGEPAGE) < 0) {
+        perror("madvise");
+    }
+
+    return mapping;
+}
+
+
+static
+size_t arena_page_size(const arena_t *arena) {
+    return (arena->flags & ARENA_HUGE_PAGES) ? ARENA_HUGE_PAGE_SIZE : (size_t) sysconf(_SC_PAGESIZE);
+}
+
+
+/* Touches every page up to given offset (rounded up to the page and
+ * limited by the size of the arena), so that the faults happen now and
+ * not during the game
+ */
+static
+void fault_pages(arena_t *arena, size_t end) {
+    size_t page_size = arena_page_size(arena);
+
+    end = (end + page_size - 1) / page_size * page_size;
+
+    if(end > arena->size) {
+        end = arena->size;
+    }
+
+    if(end <= arena->faulted) {
+        return;
+    }
+
+    size_t small_page_size = sysconf(_SC_PAGESIZE);
+
+    for(size_t offset = arena->faulted; offset < end; offset += small_page_size) {
+        ((volatile char *) arena->base)[offset] = 0;
+    }
+
+    if((arena->flags & ARENA_LOCKED) &&
+       mlock(arena->base + arena->faulted, end - arena->faulted) < 0) {
+
+        perror("mlock");
+        fprintf(stderr, "Arena not locked in memory\n");
+        arena->flags &= ~ARENA_LOCKED;
+    }
+
+    arena->faulted = end;
+}
+
+
+bool arena_init(arena_t *arena, size_t size, size_t prefaulted_size, int flags) {
+    arena->flags = flags;
+
+    size_t page_size = arena_page_size(arena);
+
+    size = (size + page_size - 1) / page_size * page_size;
+
+    arena->base = map_arena(size, flags);
+
+    if(arena->base == NULL) {
+        return false;
+    }
+
+    arena->size = size;
+    arena->used = 0;
+    arena->faulted = 0;
+
+    fault_pages(arena, prefaulted_size);
+
+    return true;
+}
+
+
+void *arena_alloc(arena_t *arena, size_t size) {
+    size_t aligned_size = arena_aligned_size(size);
+
+    if(aligned_size > arena->size - arena->used) {
+        return NULL;
+    }
+
+    void *allocation = arena->base + arena->used;
+    arena->used += aligned_size;
+
+    return allocation;
+}
+
+
+void arena_prefault(arena_t *arena, size_t end) {
+    if(end < arena->faulted + ARENA_GROWTH_SIZE) {
+        end = arena->faulted + ARENA_GROWTH_SIZE;
+    }
+
+    fault_pages(arena, end);
+}
+
+
+void arena_release(arena_t *arena) {
+    if(arena->base != NULL && munmap(arena->base, arena->size) < 0) {
+        perror("munmap");
+    }
+
+    arena->base = NULL;
+    arena->size = 0;
+    arena->used = 0;
+    arena->faulted = 0;
+}
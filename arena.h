@@ -0,0 +1,88 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+
+/* Alignment of every allocation from the arena (cache line)
+ */
+#define ARENA_ALIGNMENT                                  64
+
+
+/* Size of the huge page, the arena backed by huge pages is rounded up
+ * to a multiple of it
+ */
+#define ARENA_HUGE_PAGE_SIZE                   (2 * 1024 * 1024)
+
+
+/* Minimal number of bytes pre-faulted at once when the pre-faulted part
+ * of the arena is extended
+ */
+#define ARENA_GROWTH_SIZE                      (1024 * 1024)
+
+
+/* Flags of arena_init: back the arena with huge pages (explicit ones if
+ * the system has any reserved, transparent ones otherwise) and lock it
+ * in memory
+ */
+#define ARENA_HUGE_PAGES                                0x1
+#define ARENA_LOCKED                                    0x2
+
+
+typedef struct arena_t arena_t;
+
+
+/* Region of memory mapped once and handed out by bumping the offset,
+ * nothing is freed until the whole arena is released. Only the beginning
+ * of the mapping is pre-faulted, the rest is reserved address space
+ * which takes no memory until it is pre-faulted as well
+ */
+struct arena_t {
+    char *base;
+
+    /* Size of the mapping, the number of bytes already handed out and
+     * the number of bytes (from the base) already pre-faulted
+     */
+    size_t size;
+    size_t used;
+    size_t faulted;
+
+    int flags;
+};
+
+
+/* Returns the size taken in the arena by an allocation of given size
+ */
+size_t arena_aligned_size(size_t);
+
+
+/* Maps the arena of (at least) given size and pre-faults the pages of its
+ * first bytes (third argument), so that no page fault happens on their
+ * first use. Fourth argument is the combination of ARENA_ flags, huge pages
+ * and locking fall back to regular pages with a message if they are not
+ * available. Returns false on failure
+ */
+bool arena_init(arena_t *, size_t, size_t, int);
+
+
+/* Returns zero-filled memory of given size from the arena, or NULL if
+ * the arena is exhausted. The memory past the pre-faulted part is faulted
+ * on its first use unless arena_prefault is called for it
+ */
+void *arena_alloc(arena_t *, size_t);
+
+
+/* Pre-faults (and locks, if the arena is locked) the pages of the arena
+ * up to given offset from its base, at least ARENA_GROWTH_SIZE bytes more
+ * than are pre-faulted already
+ */
+void arena_prefault(arena_t *, size_t);
+
+
+/* Unmaps the arena (the memory of all its allocations)
+ */
+void arena_release(arena_t *);
+
+
+#endif /* ARENA_H */
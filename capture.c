@@ -0,0 +1,240 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "capture.h"
+
+
+static
+uint64_t padded_record_size(uint32_t length) {
+    return (sizeof(capture_record_t) + length + 7) & ~7ULL;
+}
+
+
+capture_t *capture_create(const char *path) {
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+    if(fd < 0) {
+        perror("open");
+        return NULL;
+    }
+
+    /* Blocks of the file are allocated before it is mapped: writing to a
+     * hole of a sparse file on a full disk would end with SIGBUS
+     */
+    int ret_allocate = posix_fallocate(fd, 0, CAPTURE_INITIAL_SIZE);
+
+    if(ret_allocate != 0) {
+        fprintf(stderr, "posix_fallocate: %s\n", strerror(ret_allocate));
+        close(fd);
+        return NULL;
+    }
+
+    void *mapping = mmap(NULL, CAPTURE_INITIAL_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if(mapping == MAP_FAILED) {
+        perror("mmap");
+        close(fd);
+        return NULL;
+    }
+
+    capture_t *capture = malloc(sizeof(capture_t));
+
+    if(capture == NULL) {
+        perror("malloc");
+        munmap(mapping, CAPTURE_INITIAL_SIZE);
+        close(fd);
+        return NULL;
+    }
+
+    capture->fd = fd;
+    capture->writer = true;
+    capture->mapping = mapping;
+    capture->mapping_size = CAPTURE_INITIAL_SIZE;
+    capture->header = mapping;
+
+    capture->header->magic = CAPTURE_FILE_MAGIC;
+    capture->header->version = CAPTURE_FILE_VERSION;
+    capture->header->record_header_size = sizeof(capture_record_t);
+    capture->header->records_count = 0;
+    capture->header->data_length = 0;
+
+    return capture;
+}
+
+
+/* Doubles the file until the record of given size fits after the data
+ * and maps it again. The new part of the file is allocated first (see
+ * capture_create), the file stays as it was if there is no space for it
+ */
+static
+bool grow_capture(capture_t *capture, uint64_t record_size) {
+    size_t needed = sizeof(capture_file_header_t) + capture->header->data_length + record_size;
+    size_t new_size = capture->mapping_size;
+
+    while(new_size < needed) {
+        new_size *= 2;
+    }
+
+    int ret_allocate = posix_fallocate(capture->fd, capture->mapping_size,
+                                       new_size - capture->mapping_size);
+
+    if(ret_allocate != 0) {
+        fprintf(stderr, "posix_fallocate: %s\n", strerror(ret_allocate));
+
+        /* Blocks allocated before the failure are given back */
+        if(ftruncate(capture->fd, capture->mapping_size) < 0) {
+            perror("ftruncate");
+        }
+
+        return false;
+    }
+
+    void *mapping = mremap(capture->mapping, capture->mapping_size, new_size, MREMAP_MAYMOVE);
+
+    if(mapping == MAP_FAILED) {
+        perror("mremap");
+        return false;
+    }
+
+    capture->mapping = mapping;
+    capture->mapping_size = new_size;
+    capture->header = mapping;
+
+    return true;
+}
+
+
+bool capture_append(capture_t *capture, uint64_t receive_nanos, const char *data, uint32_t length) {
+    uint64_t record_size = padded_record_size(length);
+    uint64_t data_length = capture->header->data_length;
+
+    if(sizeof(capture_file_header_t) + data_length + record_size > capture->mapping_size &&
+       !grow_capture(capture, record_size)) {
+
+        return false;
+    }
+
+    char *position = capture->mapping + sizeof(capture_file_header_t) + data_length;
+    capture_record_t *record = (capture_record_t *) position;
+
+    record->receive_nanos = receive_nanos;
+    record->length = length;
+    record->reserved = 0;
+
+    /* The padding is already zeroed, as the file is extended with zeros */
+    memcpy(position + sizeof(capture_record_t), data, length);
+
+    /* The record becomes part of the capture when the length covers it
+     * (a reader of the file being written never sees it half written)
+     */
+    capture->header->records_count++;
+    __atomic_store_n(&capture->header->data_length, data_length + record_size, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+
+capture_t *capture_open(const char *path) {
+    int fd = open(path, O_RDONLY);
+
+    if(fd < 0) {
+        perror("open");
+        return NULL;
+    }
+
+    struct stat file_stat;
+
+    if(fstat(fd, &file_stat) < 0 ||
+       (size_t) file_stat.st_size < sizeof(capture_file_header_t)) {
+
+        fprintf(stderr, "Capture file too short\n");
+        close(fd);
+        return NULL;
+    }
+
+    void *mapping = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    close(fd);
+
+    if(mapping == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+
+    capture_file_header_t *header = mapping;
+
+    if(header->magic != CAPTURE_FILE_MAGIC ||
+       header->version != CAPTURE_FILE_VERSION ||
+       header->record_header_size != sizeof(capture_record_t) ||
+       header->data_length > file_stat.st_size - sizeof(capture_file_header_t)) {
+
+        fprintf(stderr, "Not a capture file (or written by an incompatible version)\n");
+        munmap(mapping, file_stat.st_size);
+        return NULL;
+    }
+
+    capture_t *capture = malloc(sizeof(capture_t));
+
+    if(capture == NULL) {
+        perror("malloc");
+        munmap(mapping, file_stat.st_size);
+        return NULL;
+    }
+
+    capture->fd = -1;
+    capture->writer = false;
+    capture->mapping = mapping;
+    capture->mapping_size = file_stat.st_size;
+    capture->header = header;
+
+    return capture;
+}
+
+
+const capture_record_t *capture_next(const capture_t *capture, uint64_t *offset) {
+    uint64_t data_length = __atomic_load_n(&capture->header->data_length, __ATOMIC_ACQUIRE);
+
+    if(*offset + sizeof(capture_record_t) > data_length) {
+        return NULL;
+    }
+
+    const capture_record_t *record =
+        (const capture_record_t *) (capture->mapping + sizeof(capture_file_header_t) + *offset);
+
+    uint64_t record_size = padded_record_size(record->length);
+
+    /* Record which claims to reach past the data is not returned */
+    if(*offset + record_size > data_length) {
+        return NULL;
+    }
+
+    *offset += record_size;
+
+    return record;
+}
+
+
+void capture_close(capture_t *capture) {
+    if(capture->writer) {
+        size_t used = sizeof(capture_file_header_t) + capture->header->data_length;
+
+        munmap(capture->mapping, capture->mapping_size);
+
+        if(ftruncate(capture->fd, used) < 0) {
+            perror("ftruncate");
+        }
+
+        close(capture->fd);
+    }
+    else {
+        munmap(capture->mapping, capture->mapping_size);
+    }
+
+    free(capture);
+}
@@ -0,0 +1,99 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/* Layout of the capture file: the file header, then the records one after
+ * another, each of them the record header followed by the datagram padded
+ * to a multiple of 8 bytes. All the integers are stored in the byte order
+ * of the host which wrote the file
+ */
+#define CAPTURE_FILE_MAGIC                       0x50435753
+#define CAPTURE_FILE_VERSION                              1
+
+
+/* Initial size of the capture file, it is doubled whenever the next record
+ * does not fit (so the file is extended and remapped only a logarithmic
+ * number of times)
+ */
+#define CAPTURE_INITIAL_SIZE                      (1 << 22)
+
+
+typedef struct capture_file_header_t capture_file_header_t;
+typedef struct capture_record_t capture_record_t;
+typedef struct capture_t capture_t;
+
+
+struct capture_file_header_t {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_header_size;
+
+    /* Number of records and their summary length (in bytes, with the
+     * record headers and padding). The file may be longer than that if
+     * the capture has not been closed (the rest of it is zeroed)
+     */
+    uint64_t records_count;
+    uint64_t data_length;
+};
+
+
+struct capture_record_t {
+    /* Receive time of the datagram (in nanoseconds of the realtime clock)
+     */
+    uint64_t receive_nanos;
+    uint32_t length;
+    uint32_t reserved;
+};
+
+
+/* Capture file mapped to the memory, for writing (by the client) or for
+ * reading
+ */
+struct capture_t {
+    int fd;
+    bool writer;
+
+    char *mapping;
+    size_t mapping_size;
+
+    capture_file_header_t *header;
+};
+
+
+/* Creates the capture file with given name (truncating the existing one)
+ * and maps it for writing. Returns NULL on failure
+ */
+capture_t *capture_create(const char *);
+
+
+/* Appends the datagram (third argument) of given length (fourth argument)
+ * received at given time (second argument) to the capture. Writes only to
+ * the mapping, except when the file has to grow. Returns false if the file
+ * cannot grow, e.g. the disk is full (the datagram is not captured then)
+ */
+bool capture_append(capture_t *, uint64_t, const char *, uint32_t);
+
+
+/* Maps the capture file with given name for reading. Returns NULL on
+ * failure or if the file is not a valid capture
+ */
+capture_t *capture_open(const char *);
+
+
+/* Returns the record at given offset (second argument, 0 for the first
+ * record) and advances the offset past it, or NULL after the last record.
+ * The datagram follows the record header
+ */
+const capture_record_t *capture_next(const capture_t *, uint64_t *);
+
+
+/* Unmaps the capture. The file written is truncated to its records
+ */
+void capture_close(capture_t *);
+
+
+#endif /* CAPTURE_H */
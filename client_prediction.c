@@ -0,0 +1,364 @@
+#include <math.h>
+#include <string.h>
+#include "client_prediction.h"
+
+
+static
+bool board_taken(const client_prediction_t *prediction, uint32_t x, uint32_t y) {
+    uint32_t pixel = y * prediction->board_dimension_x + x;
+
+    return prediction->board[pixel / 8] & (1 << (pixel % 8));
+}
+
+
+static
+void take_board_pixel(client_prediction_t *prediction, uint32_t x, uint32_t y) {
+    uint32_t pixel = y * prediction->board_dimension_x + x;
+
+    prediction->board[pixel / 8] |= (1 << (pixel % 8));
+}
+
+
+void initialise_prediction(client_prediction_t *prediction, uint32_t turning_speed) {
+    memset(prediction, 0, sizeof(client_prediction_t));
+
+    prediction->turning_speed = turning_speed;
+    prediction->player_no = -1;
+}
+
+
+void prediction_new_game(client_prediction_t *prediction, const client_game_state_t *state) {
+    prediction->player_no = -1;
+    prediction->pixels_count = 0;
+    prediction->candidates_count = 0;
+
+    /* NEW_GAME clears the board of the GUI server anyway */
+    memset(prediction->predicted, 0, sizeof(prediction->predicted));
+    prediction->repaint_needed = false;
+
+    /* Boards larger than the game server allows are not predicted */
+    if(prediction->turning_speed == 0 ||
+       state->board_dimension_x > MAX_X_SIZE ||
+       state->board_dimension_y > MAX_Y_SIZE) {
+
+        return;
+    }
+
+    prediction->board_dimension_x = state->board_dimension_x;
+    prediction->board_dimension_y = state->board_dimension_y;
+
+    memset(prediction->board, 0,
+           (state->board_dimension_x * state->board_dimension_y + 7) / 8);
+
+    if(state->player_name_len == 0) {
+        return;
+    }
+
+    for(uint8_t i = 0; i < state->players_count; ++i) {
+        if(strncmp(state->game_players[i], state->player_name, state->player_name_len) == 0 &&
+           state->game_players[i][state->player_name_len] == '\0') {
+
+            prediction->player_no = i;
+        }
+    }
+}
+
+
+/* Forgets the predicted pixels (after the repaint they are no longer
+ * shown by the GUI server)
+ */
+static
+void forget_predictions(client_prediction_t *prediction) {
+    memset(prediction->predicted, 0, sizeof(prediction->predicted));
+}
+
+
+/* Compares the pixel of the own worm received from the game server with
+ * the prediction made for it
+ */
+static
+void check_prediction(client_prediction_t *prediction, uint32_t x, uint32_t y, uint64_t now) {
+    uint32_t pixel_no = prediction->pixels_count;
+    predicted_pixel_t *predicted = &prediction->predicted[pixel_no & (PREDICTION_RING_CAPACITY - 1)];
+
+    if(!predicted->valid || predicted->pixel_no != pixel_no) {
+        return;
+    }
+
+    uint32_t error_x = predicted->x > x ? predicted->x - x : x - predicted->x;
+    uint32_t error_y = predicted->y > y ? predicted->y - y : y - predicted->y;
+
+    histogram_record(&prediction->error_histogram, error_x > error_y ? error_x : error_y);
+
+    if(error_x == 0 && error_y == 0) {
+        prediction->pixels_correct++;
+        histogram_record(&prediction->lead_histogram, now - predicted->sent_nanos);
+    }
+    else {
+        prediction->repaint_needed = true;
+    }
+
+    predicted->valid = false;
+}
+
+
+/* Moves the worm by a round, exactly as the game server does
+ */
+static
+void move_worm(worm_state_t *worm, uint32_t turning_speed, uint8_t turn_direction) {
+    if(turn_direction == 1) {
+        worm->direction += turning_speed;
+    }
+    else if(turn_direction == 2) {
+        worm->direction -= turning_speed;
+    }
+
+    if(worm->direction < 0) {
+        worm->direction += 360;
+    }
+
+    worm->x_pos += cos((double) worm->direction * M_PI / 180);
+    worm->y_pos += sin((double) worm->direction * M_PI / 180);
+}
+
+
+/* Moves the worm with given turn direction until it leaves its pixel (for
+ * at most PREDICTION_ROUNDS_PER_PIXEL rounds) and stores the pixel it
+ * enters. Returns false if it stays in its pixel
+ */
+static
+bool move_to_next_pixel(worm_state_t *worm,
+                        uint32_t turning_speed,
+                        uint8_t turn_direction,
+                        int32_t *x,
+                        int32_t *y) {
+
+    int32_t old_x = (int32_t) floor(worm->x_pos);
+    int32_t old_y = (int32_t) floor(worm->y_pos);
+
+    for(uint32_t round = 0; round < PREDICTION_ROUNDS_PER_PIXEL; ++round) {
+        move_worm(worm, turning_speed, turn_direction);
+
+        *x = (int32_t) floor(worm->x_pos);
+        *y = (int32_t) floor(worm->y_pos);
+
+        if(*x != old_x || *y != old_y) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/* Takes all the directions in the middle of the pixel as the states of
+ * the worm (which is exact for its first pixel)
+ */
+static
+void seed_candidates(client_prediction_t *prediction, uint32_t x, uint32_t y) {
+    for(uint32_t direction = 0; direction < 360; ++direction) {
+        prediction->candidates[direction].x_pos = x + 0.5;
+        prediction->candidates[direction].y_pos = y + 0.5;
+        prediction->candidates[direction].direction = direction;
+    }
+
+    prediction->candidates_count = 360;
+}
+
+
+/* Keeps the states of the own worm which lead to the received pixel with
+ * any turn direction (the turn direction of the client first, as the most
+ * likely one)
+ */
+static
+void track_pixel(client_prediction_t *prediction, uint32_t x, uint32_t y, uint8_t turn_direction) {
+    uint8_t turn_directions[3] = {turn_direction, (turn_direction + 1) % 3, (turn_direction + 2) % 3};
+    uint32_t next_count = 0;
+
+    for(uint8_t i = 0; i < 3; ++i) {
+        for(uint32_t j = 0; j < prediction->candidates_count && next_count < PREDICTION_CANDIDATES; ++j) {
+            worm_state_t worm = prediction->candidates[j];
+            int32_t next_x;
+            int32_t next_y;
+
+            if(move_to_next_pixel(&worm, prediction->turning_speed, turn_directions[i], &next_x, &next_y) &&
+               next_x == (int32_t) x && next_y == (int32_t) y) {
+
+                prediction->next_candidates[next_count++] = worm;
+            }
+        }
+    }
+
+    if(next_count == 0) {
+        /* Lost pixels or more turns than assumed, the position within the
+         * pixel is guessed from now on
+         */
+        prediction->tracking_lost++;
+        seed_candidates(prediction, x, y);
+        return;
+    }
+
+    memcpy(prediction->candidates, prediction->next_candidates, next_count * sizeof(worm_state_t));
+    prediction->candidates_count = next_count;
+}
+
+
+/* Simulates the worm from its most likely state with the turn direction
+ * of the client and stores the next pixels it enters. The path ends
+ * before the pixel in which the worm would be eliminated or which less
+ * than half of the states of the worm agree with. Returns the length of
+ * the path
+ */
+static
+uint8_t predict_path(client_prediction_t *prediction,
+                     uint8_t turn_direction,
+                     int32_t *path_x,
+                     int32_t *path_y) {
+
+    worm_state_t worm = prediction->candidates[0];
+    uint8_t length = 0;
+
+    while(length < PREDICTION_HORIZON) {
+        int32_t next_x;
+        int32_t next_y;
+
+        if(!move_to_next_pixel(&worm, prediction->turning_speed, turn_direction, &next_x, &next_y) ||
+           next_x < 0 || (uint32_t) next_x >= prediction->board_dimension_x ||
+           next_y < 0 || (uint32_t) next_y >= prediction->board_dimension_y ||
+           board_taken(prediction, next_x, next_y)) {
+
+            break;
+        }
+
+        path_x[length] = next_x;
+        path_y[length] = next_y;
+        length++;
+    }
+
+    /* Number of states which follow the path up to each of its pixels */
+    uint32_t agreeing[PREDICTION_HORIZON] = {0};
+
+    for(uint32_t i = 0; i < prediction->candidates_count; ++i) {
+        worm = prediction->candidates[i];
+
+        for(uint8_t k = 0; k < length; ++k) {
+            int32_t next_x;
+            int32_t next_y;
+
+            if(!move_to_next_pixel(&worm, prediction->turning_speed, turn_direction, &next_x, &next_y) ||
+               next_x != path_x[k] || next_y != path_y[k]) {
+
+                break;
+            }
+
+            agreeing[k]++;
+        }
+    }
+
+    for(uint8_t k = 0; k < length; ++k) {
+        if(2 * agreeing[k] <= prediction->candidates_count) {
+            return k;
+        }
+    }
+
+    return length;
+}
+
+
+uint8_t prediction_pixel(client_prediction_t *prediction,
+                         uint8_t player_no,
+                         uint32_t x,
+                         uint32_t y,
+                         uint8_t turn_direction,
+                         uint64_t now,
+                         uint32_t *predicted_x,
+                         uint32_t *predicted_y) {
+
+    if(prediction->turning_speed == 0 || prediction->board_dimension_x == 0 ||
+       x >= prediction->board_dimension_x || y >= prediction->board_dimension_y) {
+
+        return 0;
+    }
+
+    take_board_pixel(prediction, x, y);
+
+    if(player_no != prediction->player_no) {
+        return 0;
+    }
+
+    check_prediction(prediction, x, y, now);
+
+    /* The next pixels are predicted again for the repainted game */
+    if(prediction->repaint_needed) {
+        forget_predictions(prediction);
+    }
+
+    if(prediction->pixels_count == 0) {
+        seed_candidates(prediction, x, y);
+    }
+    else {
+        track_pixel(prediction, x, y, turn_direction);
+    }
+
+    prediction->pixels_count++;
+
+    int32_t path_x[PREDICTION_HORIZON];
+    int32_t path_y[PREDICTION_HORIZON];
+    uint8_t path_length = predict_path(prediction, turn_direction, path_x, path_y);
+    uint8_t new_count = 0;
+
+    for(uint8_t k = 0; k < path_length; ++k) {
+        /* Each pixel is sent to the GUI server once, by its first prediction */
+        uint32_t pixel_no = prediction->pixels_count + k;
+        predicted_pixel_t *predicted = &prediction->predicted[pixel_no & (PREDICTION_RING_CAPACITY - 1)];
+
+        if(predicted->valid && predicted->pixel_no == pixel_no) {
+            continue;
+        }
+
+        predicted->pixel_no = pixel_no;
+        predicted->x = (uint32_t) path_x[k];
+        predicted->y = (uint32_t) path_y[k];
+        predicted->sent_nanos = now;
+        predicted->valid = true;
+
+        predicted_x[new_count] = (uint32_t) path_x[k];
+        predicted_y[new_count] = (uint32_t) path_y[k];
+        new_count++;
+
+        prediction->pixels_predicted++;
+    }
+
+    return new_count;
+}
+
+
+/* Stops the prediction of the own worm, the pixels predicted and not
+ * reached have to be removed from the GUI server
+ */
+static
+void stop_prediction(client_prediction_t *prediction) {
+    prediction->player_no = -1;
+
+    for(uint32_t i = 0; i < PREDICTION_RING_CAPACITY; ++i) {
+        if(prediction->predicted[i].valid) {
+            prediction->repaint_needed = true;
+        }
+    }
+
+    forget_predictions(prediction);
+}
+
+
+void prediction_player_eliminated(client_prediction_t *prediction, uint8_t player_no) {
+    if(player_no == prediction->player_no) {
+        stop_prediction(prediction);
+    }
+}
+
+
+void prediction_game_over(client_prediction_t *prediction) {
+    if(prediction->player_no >= 0) {
+        stop_prediction(prediction);
+    }
+}
@@ -0,0 +1,165 @@
+#ifndef CLIENT_PREDICTION_H
+#define CLIENT_PREDICTION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "client_protocol.h"
+#include "histogram.h"
+#include "utils.h"
+
+
+/* Number of pixels of the own worm predicted ahead of the last one
+ * received from the game server
+ */
+#define PREDICTION_HORIZON                                4
+
+
+/* Maximal number of rounds simulated to find the next pixel of a worm
+ * (the worm may stay within a pixel for a round)
+ */
+#define PREDICTION_ROUNDS_PER_PIXEL                       2
+
+
+/* Maximal number of the states of the own worm (position and direction)
+ * which agree with all its pixels received so far
+ */
+#define PREDICTION_CANDIDATES                          1024
+
+
+/* Number of predicted pixels remembered until the pixels of the same
+ * order arrive from the game server (has to be a power of two greater
+ * than PREDICTION_HORIZON)
+ */
+#define PREDICTION_RING_CAPACITY                         16
+
+
+typedef struct worm_state_t worm_state_t;
+typedef struct predicted_pixel_t predicted_pixel_t;
+typedef struct client_prediction_t client_prediction_t;
+
+
+/* State of a worm as kept by the game server
+ */
+struct worm_state_t {
+    double x_pos;
+    double y_pos;
+    int32_t direction;
+};
+
+
+/* Pixel predicted as the one with given number among the pixels of the
+ * own worm in the game
+ */
+struct predicted_pixel_t {
+    uint32_t pixel_no;
+    uint32_t x;
+    uint32_t y;
+
+    /* Time (in nanoseconds of the monotonic clock) of sending the pixel
+     * to the GUI server
+     */
+    uint64_t sent_nanos;
+    bool valid;
+};
+
+
+struct client_prediction_t {
+    /* Turning speed of the game server (prediction is disabled if 0)
+     */
+    uint32_t turning_speed;
+
+    /* Index of the own worm among the players of the game (-1 if the
+     * client does not play or the worm has been eliminated) and the
+     * number of its pixels received so far
+     */
+    int16_t player_no;
+    uint32_t pixels_count;
+
+    uint32_t board_dimension_x;
+    uint32_t board_dimension_y;
+
+    /* States of the own worm which agree with its pixels received so far
+     * (the first one follows the turn direction of the client most
+     * closely), and space for the next ones. The game server starts each
+     * worm in the middle of its first pixel, with integer direction, so
+     * the true state is among them as long as the worm turns at most once
+     * between its pixels
+     */
+    worm_state_t candidates[PREDICTION_CANDIDATES];
+    worm_state_t next_candidates[PREDICTION_CANDIDATES];
+    uint32_t candidates_count;
+
+    predicted_pixel_t predicted[PREDICTION_RING_CAPACITY];
+
+    /* Pixels of the board taken by any worm, one bit per pixel
+     */
+    uint8_t board[(MAX_X_SIZE * MAX_Y_SIZE + 7) / 8];
+
+    /* Distances (in pixels, the maximum over both axes) between the
+     * predicted pixels and the ones received from the game server, and
+     * times (in nanoseconds) by which the correctly predicted pixels
+     * preceded them
+     */
+    histogram_t error_histogram;
+    histogram_t lead_histogram;
+
+    uint64_t pixels_predicted;
+    uint64_t pixels_correct;
+
+    /* Set when a pixel already sent to the GUI server has turned out to be
+     * wrong (it differs from the pixel received from the game server or the
+     * worm has been eliminated before reaching it). The GUI server has no
+     * way to erase a pixel, so the client repaints the game and clears the
+     * flag. The pixels predicted so far are forgotten then
+     */
+    bool repaint_needed;
+    uint64_t repaints;
+
+    /* Number of times no state agreed with the received pixel, so the
+     * states were guessed again from the pixel
+     */
+    uint64_t tracking_lost;
+};
+
+
+/* Initialises the prediction for the game server with given turning speed
+ * (0 disables the prediction)
+ */
+void initialise_prediction(client_prediction_t *, uint32_t);
+
+
+/* Starts the prediction for the game just announced by NEW_GAME event
+ * (finds the own worm among the players of the client game state)
+ */
+void prediction_new_game(client_prediction_t *, const client_game_state_t *);
+
+
+/* Takes the pixel (third and fourth argument) of the player (second
+ * argument) received from the game server into account. For the pixels of
+ * the own worm compares the pixel with the prediction made for it (and
+ * sets repaint_needed if it was wrong), then predicts at most
+ * PREDICTION_HORIZON next pixels from the turn direction
+ * of the client (fifth argument). Pixels which have not been sent to the GUI
+ * server yet are stored to the arrays given as the seventh and eighth
+ * argument (of PREDICTION_HORIZON elements), their number is returned.
+ * Sixth argument is the current time (in nanoseconds of the monotonic
+ * clock)
+ */
+uint8_t prediction_pixel(client_prediction_t *, uint8_t, uint32_t, uint32_t, uint8_t,
+                         uint64_t, uint32_t *, uint32_t *);
+
+
+/* Stops the prediction after elimination of the player (second argument).
+ * Sets repaint_needed if any of the pixels predicted for the own worm have
+ * been sent and not reached
+ */
+void prediction_player_eliminated(client_prediction_t *, uint8_t);
+
+
+/* Stops the prediction at the end of the game (the winning worm does not
+ * reach the pixels predicted for it either)
+ */
+void prediction_game_over(client_prediction_t *);
+
+
+#endif /* CLIENT_PREDICTION_H */
@@ -38,6 +38,14 @@ bool parse_player_names(char *buffer,
                     state->game_players[names_count][i] = buffer[offset - current_name_len + i];
                 }
 
+                /* The form in which the name is sent to the GUI server */
+                memcpy(state->gui_player_names[names_count],
+                       buffer + offset - current_name_len,
+                       current_name_len);
+
+                state->gui_player_names[names_count][current_name_len] = '\n';
+                state->gui_player_name_lengths[names_count] = current_name_len + 1;
+
                 state->players_count++;
                 names_count++;
                 current_name_len = 0;
@@ -79,34 +87,57 @@ bool check_names_order(client_game_state_t *state) {
 }
 
 
+/* Two-digit decimal representations of numbers 0-99
+ */
+static const char digit_pairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+
+/* Writes decimal representation of the value to the buffer (two digits
+ * at a time, from the end). Returns the number of characters written
+ */
+static
+size_t inject_number(char *buffer, uint32_t value) {
+    size_t length = 1 + (value >= 10) + (value >= 100) + (value >= 1000) + (value >= 10000) +
+                    (value >= 100000) + (value >= 1000000) + (value >= 10000000) +
+                    (value >= 100000000) + (value >= 1000000000);
+
+    char *end = buffer + length;
+
+    while(value >= 100) {
+        end -= 2;
+        memcpy(end, digit_pairs + (value % 100) * 2, 2);
+        value /= 100;
+    }
+
+    if(value >= 10) {
+        memcpy(end - 2, digit_pairs + value * 2, 2);
+    }
+    else {
+        *(end - 1) = '0' + value;
+    }
+
+    return length;
+}
+
+
 /* Injects string representation of integers passed as x and
  * y arguments to the function in such way that between string
- * representations of these digits exactly one space occurs.
- * Function returns the number of characters appended to the buffer
+ * representations of these digits exactly one space occurs (and
+ * one follows the latter). Function returns the number of characters
+ * appended to the buffer
  */
 static
-size_t inject_two_separated_numbers(char *buffer,
-                                    size_t x,
-                                    size_t digits_x,
-                                    size_t y,
-                                    size_t digits_y) {
-    size_t generated_offset = 0;
-
-    snprintf(buffer,
-             digits_x + 1,
-             "%lu",
-             x);
-
-    generated_offset += digits_x;
+size_t inject_two_separated_numbers(char *buffer, uint32_t x, uint32_t y) {
+    size_t generated_offset = inject_number(buffer, x);
+
     buffer[generated_offset] = ' ';
     generated_offset++;
 
-    snprintf(buffer + generated_offset,
-             digits_y + 1,
-             "%lu",
-             y);
+    generated_offset += inject_number(buffer + generated_offset, y);
 
-    generated_offset += digits_y;
     buffer[generated_offset] = ' ';
     generated_offset++;
 
@@ -119,99 +150,73 @@ size_t inject_two_separated_numbers(char *buffer,
  * @p state points. Returns the length of created message to that it
  * can be sent to the GUI server later.
  */
+size_t prepare_pixel_message(const client_game_state_t *state,
+                             uint8_t player_no,
+                             uint32_t x,
+                             uint32_t y,
+                             char *buffer) {
+
+    memcpy(buffer, "PIXEL ", 6);
+
+    size_t buffer_offset = 6 + inject_two_separated_numbers(buffer + 6, x, y);
+
+    /* Name is copied together with the newline */
+    memcpy(buffer + buffer_offset,
+           state->gui_player_names[player_no],
+           MAX_PLAYER_NAME_LENGTH + 1);
+
+    return buffer_offset + state->gui_player_name_lengths[player_no];
+}
+
+
 size_t prepare_message(const client_game_state_t *state, char *buffer) {
     uint8_t type = state->data_for_gui.event_type;
     size_t buffer_offset = 0;
 
-    if(type == EVENT_NEW_GAME) {
-        uint32_t dim_x = state->data_for_gui.x;
-        uint32_t dim_y = state->data_for_gui.y;
-
-        size_t digits_dim_x = digits_count(dim_x);
-        size_t digits_dim_y = digits_count(dim_y);
-
+    if(type == EVENT_PIXEL) {
+        return prepare_pixel_message(state,
+                                     state->data_for_gui.player_no,
+                                     state->data_for_gui.x,
+                                     state->data_for_gui.y,
+                                     buffer);
+    }
+    else if(type == EVENT_NEW_GAME) {
         memcpy(buffer, "NEW_GAME ", 9);
         buffer_offset = 9;
 
         buffer_offset += inject_two_separated_numbers(buffer + buffer_offset,
-                                                      dim_x,
-                                                      digits_dim_x,
-                                                      dim_y,
-                                                      digits_dim_y);
-
-        size_t len;
+                                                      state->data_for_gui.x,
+                                                      state->data_for_gui.y);
 
         /* Player names within client_game_state_t structure to which
          * pointer passed to function points are sorted
-         * alphabetically so simple loop will do
+         * alphabetically so simple loop will do (newlines following
+         * the names become separating spaces)
          */
         for(uint8_t i = 0; i < state->players_count; ++i) {
-            len = strlen(state->game_players[i]);
-
-            snprintf(buffer + buffer_offset,
-                    len + 1,
-                    "%s",
-                    state->game_players[i]);
-            buffer_offset += len;
+            memcpy(buffer + buffer_offset,
+                   state->gui_player_names[i],
+                   state->gui_player_name_lengths[i]);
 
-            if(i < state->players_count - 1) {
-                buffer[buffer_offset] = ' ';
-                buffer_offset++;
-            }
+            buffer_offset += state->gui_player_name_lengths[i];
+            buffer[buffer_offset - 1] = ' ';
         }
 
-        buffer[buffer_offset] = '\n';
-        buffer_offset++;
-
-        return buffer_offset;
-    }
-    else if(type == EVENT_PIXEL) {
-        uint32_t coord_x = state->data_for_gui.x;
-        uint32_t coord_y = state->data_for_gui.y;
-
-        size_t digits_coord_x = digits_count(coord_x);
-        size_t digits_coord_y = digits_count(coord_y);
-
-        uint8_t player_no = state->data_for_gui.player_no;
-        size_t name_length = strlen(state->game_players[player_no]);
-
-        memcpy(buffer, "PIXEL ", 6);
-        buffer_offset = 6;
-
-        buffer_offset += inject_two_separated_numbers(buffer + buffer_offset,
-                                                      coord_x,
-                                                      digits_coord_x,
-                                                      coord_y,
-                                                      digits_coord_y);
-
-        snprintf(buffer + buffer_offset,
-                 name_length + 1,
-                 "%s",
-                 state->game_players[player_no]);
-
-        buffer_offset += name_length;
-        buffer[buffer_offset] = '\n';
-        buffer_offset++;
+        buffer[buffer_offset - 1] = '\n';
 
         return buffer_offset;
     }
     else if(type == EVENT_PLAYER_ELIMINATED) {
         uint8_t player_no = state->data_for_gui.player_no;
-        size_t name_len = strlen(state->game_players[player_no]);
 
         memcpy(buffer, "PLAYER_ELIMINATED ", 18);
         buffer_offset = 18;
 
-        snprintf(buffer + buffer_offset,
-                 name_len + 1,
-                 "%s",
-                 state->game_players[player_no]);
-
-        buffer_offset += name_len;
-        buffer[buffer_offset] = '\n';
-        buffer_offset++;
+        memcpy(buffer + buffer_offset,
+               state->gui_player_names[player_no],
+               MAX_PLAYER_NAME_LENGTH + 1);
 
-        return buffer_offset;
+        return buffer_offset + state->gui_player_name_lengths[player_no];
     }
     else {
         return 0;
@@ -233,6 +238,19 @@ void initialise_client_game_state(client_game_state_t *state) {
     memset(state->game_players, 0, sizeof(state->game_players));
 
     state->data_for_gui.ready_to_send = 0;
+
+    state->turn_change_nanos = 0;
+    histogram_reset(&state->input_latency_histogram);
+
+    state->sent_turn_direction = 0;
+    state->last_input_dgram_nanos = 0;
+    state->input_dgram_delayed = false;
+    state->input_datagrams = 0;
+    state->input_datagrams_delayed = 0;
+
+    memset(state->reorder_buffer, 0, sizeof(state->reorder_buffer));
+    state->reordered_count = 0;
+    memset(&state->reorder_stats, 0, sizeof(state->reorder_stats));
 }
 
 
@@ -240,12 +258,26 @@ ssize_t deserialize_client_dgram(client_dgram_t *datagram,
                                  char *buffer,
                                  ssize_t message_size) {
     /* Bad client datagram length */
-    if(message_size > MAX_CLIENT_DGRAM_LENGTH ||
+    if(message_size > MAX_CLIENT_DGRAM_LENGTH + CLIENT_DGRAM_ROOM_LEN ||
        message_size < CLIENT_DGRAM_INTEGERS_LEN) {
 
         return -1;
     }
 
+    datagram->room = 0;
+
+    /* Room field follows the name if there is a NUL byte after it */
+    if(message_size >= CLIENT_DGRAM_INTEGERS_LEN + CLIENT_DGRAM_ROOM_LEN &&
+       buffer[message_size - CLIENT_DGRAM_ROOM_LEN] == '\0') {
+
+        datagram->room = ntohs(*(uint16_t *) (buffer + message_size - 2));
+        message_size -= CLIENT_DGRAM_ROOM_LEN;
+    }
+
+    if(message_size > MAX_CLIENT_DGRAM_LENGTH) {
+        return -1;
+    }
+
     uint64_t received_session_id = be64toh(*(uint64_t *) buffer);
     uint8_t received_turn_direction = *(uint8_t *) (buffer + 8);
     uint32_t received_expected_event_no = ntohl(*(uint32_t *) (buffer + 9));
@@ -271,13 +303,13 @@ ssize_t deserialize_client_dgram(client_dgram_t *datagram,
         datagram->player_name[i - CLIENT_DGRAM_INTEGERS_LEN] = buffer[i];
     }
 
-    return 0;
+    return message_size;
 }
 
 
-void serialize_client_dgram(const client_dgram_t *datagram,
-                            size_t player_name_len,
-                            char *buffer) {
+size_t serialize_client_dgram(const client_dgram_t *datagram,
+                              size_t player_name_len,
+                              char *buffer) {
 
     uint64_t n_session_id = htobe64(datagram->session_id);
     uint8_t n_turn_direction = datagram->turn_direction;
@@ -287,6 +319,145 @@ void serialize_client_dgram(const client_dgram_t *datagram,
     memcpy(buffer + 8, &n_turn_direction, 1);
     memcpy(buffer + 9, &n_next_expected_event_no, 4);
     memcpy(buffer + 13, datagram->player_name, player_name_len);
+
+    size_t datagram_len = CLIENT_DGRAM_INTEGERS_LEN + player_name_len;
+
+    if(datagram->room != 0) {
+        uint16_t n_room = htons(datagram->room);
+
+        buffer[datagram_len] = '\0';
+        memcpy(buffer + datagram_len + 1, &n_room, 2);
+
+        datagram_len += CLIENT_DGRAM_ROOM_LEN;
+    }
+
+    return datagram_len;
+}
+
+
+/* Checks the player number and the coordinates of the event against the
+ * players and the board of the game
+ */
+static
+bool event_data_valid(const client_game_state_t *state,
+                      uint8_t event_type,
+                      uint8_t player_no,
+                      uint32_t x,
+                      uint32_t y) {
+
+    if(event_type == EVENT_GAME_OVER) {
+        return true;
+    }
+
+    if(player_no >= state->players_count) {
+        return false;
+    }
+
+    return event_type != EVENT_PIXEL ||
+           (x < state->board_dimension_x && y < state->board_dimension_y);
+}
+
+
+/* Applies PIXEL, PLAYER_ELIMINATED or GAME_OVER event which is the next
+ * expected one. Returns false if the event contains nonsense values
+ */
+static
+bool apply_event(client_game_state_t *state,
+                 uint8_t event_type,
+                 uint8_t player_no,
+                 uint32_t x,
+                 uint32_t y) {
+
+    if(!event_data_valid(state, event_type, player_no, x, y)) {
+        return false;
+    }
+
+    if(event_type == EVENT_PIXEL) {
+        state->data_for_gui.event_type = EVENT_PIXEL;
+        state->data_for_gui.player_no = player_no;
+        state->data_for_gui.x = x;
+        state->data_for_gui.y = y;
+        state->data_for_gui.ready_to_send = 1;
+    }
+    else if(event_type == EVENT_PLAYER_ELIMINATED) {
+        if(!state->is_alive[player_no]) {
+            return false;
+        }
+
+        state->is_alive[player_no] = false;
+
+        state->data_for_gui.event_type = EVENT_PLAYER_ELIMINATED;
+        state->data_for_gui.player_no = player_no;
+        state->data_for_gui.ready_to_send = 1;
+    }
+    else {
+        state->game_over = true;
+    }
+
+    state->next_expected++;
+
+    return true;
+}
+
+
+/* Stores the event received ahead of the next expected one in the reorder
+ * buffer. Events already applied or stored are ignored
+ */
+static
+void hold_reordered_event(client_game_state_t *state,
+                          uint32_t event_no,
+                          uint8_t event_type,
+                          uint8_t player_no,
+                          uint32_t x,
+                          uint32_t y) {
+
+    if(event_no < state->next_expected) {
+        return;
+    }
+
+    if(event_no - state->next_expected >= REORDER_BUFFER_CAPACITY) {
+        state->reorder_stats.dropped++;
+        return;
+    }
+
+    reordered_event_t *slot = &state->reorder_buffer[event_no & (REORDER_BUFFER_CAPACITY - 1)];
+
+    if(slot->occupied) {
+        return;
+    }
+
+    slot->event_no = event_no;
+    slot->event_type = event_type;
+    slot->player_no = player_no;
+    slot->x = x;
+    slot->y = y;
+    slot->occupied = true;
+
+    state->reordered_count++;
+    state->reorder_stats.held++;
+}
+
+
+/* Frees the slot of the event which has just been applied (a copy of it
+ * might have been held before)
+ */
+static
+void forget_reordered_event(client_game_state_t *state, uint32_t event_no) {
+    reordered_event_t *slot = &state->reorder_buffer[event_no & (REORDER_BUFFER_CAPACITY - 1)];
+
+    if(state->reordered_count > 0 && slot->occupied && slot->event_no == event_no) {
+        slot->occupied = false;
+        state->reordered_count--;
+    }
+}
+
+
+static
+void clear_reorder_buffer(client_game_state_t *state) {
+    if(state->reordered_count > 0) {
+        memset(state->reorder_buffer, 0, sizeof(state->reorder_buffer));
+        state->reordered_count = 0;
+    }
 }
 
 
@@ -379,76 +550,171 @@ ssize_t deserialize_event_record(client_game_state_t *state,
             state->next_expected++;
         }
     }
-    else if(event_type == EVENT_PIXEL) {
-        if(event_record_size != EVENT_RECORD_LENGTH_PIXEL) {
-            /* Nonsense value */
-            return -2;
-        }
+    else {
+        uint8_t player_no = 0;
+        uint32_t coordinate_x = 0;
+        uint32_t coordinate_y = 0;
 
-        uint8_t player_no = *(uint8_t *) (buffer + EVENT_DATA_BYTE_OFFSET);
-        uint32_t coordinate_x = ntohl(*(uint32_t *) (buffer + EVENT_DATA_BYTE_OFFSET + 1));
-        uint32_t coordinate_y = ntohl(*(uint32_t *) (buffer + EVENT_DATA_BYTE_OFFSET + 5));
+        if(event_type == EVENT_PIXEL) {
+            if(event_record_size != EVENT_RECORD_LENGTH_PIXEL) {
+                /* Nonsense value */
+                return -2;
+            }
 
-        if(coordinate_x >= state->board_dimension_x ||
-           coordinate_y >= state->board_dimension_y) {
-            /* Nonsense value */
-            return -2;
+            player_no = *(uint8_t *) (buffer + EVENT_DATA_BYTE_OFFSET);
+            coordinate_x = ntohl(*(uint32_t *) (buffer + EVENT_DATA_BYTE_OFFSET + 1));
+            coordinate_y = ntohl(*(uint32_t *) (buffer + EVENT_DATA_BYTE_OFFSET + 5));
         }
+        else if(event_type == EVENT_PLAYER_ELIMINATED) {
+            if(event_record_size != EVENT_RECORD_LENGTH_PLAYER_ELIMINATED) {
+                /* Nonsense value */
+                return -2;
+            }
 
-        if(player_no >= state->players_count) {
-            /* Nonsense value */
-            return -2;
+            player_no = *(uint8_t *) (buffer + 9);
         }
-
-        if(event_no == state->next_expected) {
-            state->data_for_gui.event_type = EVENT_PIXEL;
-            state->data_for_gui.player_no = player_no;
-            state->data_for_gui.x = coordinate_x;
-            state->data_for_gui.y = coordinate_y;
-            state->data_for_gui.ready_to_send = 1;
-
-            state->next_expected++;
+        else if(event_type == EVENT_GAME_OVER) {
+            if(event_record_size != EVENT_RECORD_LENGTH_GAME_OVER) {
+                /* Nonsense value */
+                return -2;
+            }
         }
-    }
-    else if(event_type == EVENT_PLAYER_ELIMINATED) {
-        if(event_record_size != EVENT_RECORD_LENGTH_PLAYER_ELIMINATED) {
-            /* Nonsense value */
-            return -2;
+        else {
+            return event_record_size;
         }
 
-        uint8_t player_no = *(uint8_t *) (buffer + 9);
+        if(event_no == state->next_expected) {
+            if(!apply_event(state, event_type, player_no, coordinate_x, coordinate_y)) {
+                /* Nonsense value */
+                return -2;
+            }
 
-        if(player_no >= state->players_count) {
-            /* Nonsense value */
-            return -2;
+            forget_reordered_event(state, event_no);
         }
-
-        if(event_no == state->next_expected) {
-            if(!state->is_alive[player_no]) {
+        else {
+            /* Events received before the NEW_GAME event can be checked
+             * only when they are released
+             */
+            if(state->next_expected > 0 &&
+               !event_data_valid(state, event_type, player_no, coordinate_x, coordinate_y)) {
                 /* Nonsense value */
                 return -2;
             }
 
-            state->is_alive[player_no] = false;
+            hold_reordered_event(state, event_no, event_type, player_no,
+                                 coordinate_x, coordinate_y);
+        }
+    }
 
-            state->data_for_gui.event_type = EVENT_PLAYER_ELIMINATED;
-            state->data_for_gui.player_no = player_no;
-            state->data_for_gui.ready_to_send = 1;
+    return event_record_size;
+}
 
-            state->next_expected++;
+
+int release_reordered_event(client_game_state_t *state) {
+    if(state->reordered_count == 0) {
+        return 0;
+    }
+
+    reordered_event_t *slot =
+        &state->reorder_buffer[state->next_expected & (REORDER_BUFFER_CAPACITY - 1)];
+
+    if(!slot->occupied || slot->event_no != state->next_expected) {
+        return 0;
+    }
+
+    slot->occupied = false;
+    state->reordered_count--;
+
+    if(!apply_event(state, slot->event_type, slot->player_no, slot->x, slot->y)) {
+        return -2;
+    }
+
+    state->reorder_stats.released++;
+
+    return 1;
+}
+
+
+bool accept_server_game_id(client_game_state_t *state, uint32_t received_game_id) {
+    if(received_game_id != state->game_id || !state->played_any) {
+        if(state->game_over) {
+            state->game_id = received_game_id;
+            state->next_expected = 0;
+            state->players_count = 0;
+
+            state->played_any = true;
+            state->game_over = false;
+
+            clear_reorder_buffer(state);
+
+            for(uint8_t i = 0; i < MAX_PLAYERS; ++i) {
+                state->is_alive[i] = true;
+            }
+        }
+        else {
+            return false;
         }
     }
-    else if(event_type == EVENT_GAME_OVER) {
-        if(event_record_size != EVENT_RECORD_LENGTH_GAME_OVER) {
-            /* Nonsense value */
-            return -2;
+
+    return true;
+}
+
+
+bool decode_server_datagram(client_game_state_t *state,
+                            char *buffer,
+                            ssize_t length,
+                            event_applied_callback_t event_applied,
+                            void *argument) {
+
+    if(length > MAX_SERVER_UDP_DGRAM_LENGTH || length < MIN_SERVER_UDP_DGRAM_LENGTH) {
+        return true;
+    }
+
+    uint32_t received_game_id = *(uint32_t *) buffer;
+
+    if(!accept_server_game_id(state, received_game_id)) {
+        return true;
+    }
+
+    ssize_t remaining_bytes = length - 4;
+    ssize_t buffer_offset = 4;
+    ssize_t ret_val;
+
+    while(remaining_bytes > 0) {
+        uint32_t expected_before = state->next_expected;
+
+        ret_val = deserialize_event_record(state, buffer + buffer_offset, remaining_bytes);
+
+        if(ret_val == -1) {
+            break;
+        }
+        else if(ret_val == -2) {
+            return false;
         }
 
-        if(event_no == state->next_expected) {
-            state->game_over = true;
-            state->next_expected++;
+        buffer_offset += ret_val;
+        remaining_bytes -= ret_val;
+
+        /* The record might have been held in the reorder buffer (or
+         * ignored) instead of applied
+         */
+        if(state->next_expected != expected_before && !event_applied(state, argument)) {
+            return true;
+        }
+
+        /* The record might have closed the gap before events held
+         * in the reorder buffer
+         */
+        while((ret_val = release_reordered_event(state)) == 1) {
+            if(!event_applied(state, argument)) {
+                return true;
+            }
+        }
+
+        if(ret_val == -2) {
+            return false;
         }
     }
 
-    return event_record_size;
-}
\ No newline at end of file
+    return true;
+}
@@ -1,6 +1,7 @@
 #ifndef CLIENT_PROTOCOL_H
 #define CLIENT_PROTOCOL_H
 #include <stdint.h>
+#include "histogram.h"
 #include "utils.h"
 
 
@@ -18,6 +19,13 @@
 #define MAX_CLIENT_DGRAM_LENGTH                          33
 
 
+/* Length of the optional room field which may follow the player name:
+ * NUL byte (never allowed in the name) and 16-bit room number. Datagrams
+ * without this field select room 0
+ */
+#define CLIENT_DGRAM_ROOM_LEN                             3
+
+
 /* Size of buffer for storing serialized (packed) form
  * of data from client datagram. Exact size of client
  * datagram sent to server is 33 so the buffer size
@@ -27,13 +35,40 @@
 #define CLIENT_DGRAM_BUFFER_SIZE                         50
 
 
+/* Interval (in nanoseconds) of the regular datagrams to the game server
+ * and the minimal time between two datagrams sent right after changes of
+ * the turn direction (the regular datagrams are delayed after such a
+ * datagram, so a client never sends more than 100 datagrams per second,
+ * which is what the rate limiter of the game server allows)
+ */
+#define KEEPALIVE_INTERVAL_NANOS                   30000000
+#define MIN_INPUT_DGRAM_INTERVAL_NANOS             10000000
+
+
+/* Maximum number of datagrams from the game server received with a single
+ * recvmmsg call (the socket is drained with as many calls as needed)
+ */
+#define SERVER_RECEIVE_BATCH                             32
+
+
 
 /* Size of buffer for sending messages from
  * client to the GUI server (large enough to fit
  * every possible message that is to be sent)
  */
 #define MSG_GUI_BUFFER_LENGTH                          1024
-#define PARTIAL_MSG_BUFFER_LENGTH                        32
+
+
+/* Size of buffer for reading messages from the GUI server (the unfinished
+ * line left from the previous read is kept at its beginning)
+ */
+#define GUI_INPUT_BUFFER_LENGTH                        1024
+
+
+/* Size of buffer in which messages to the GUI server are collected
+ * before they are written to its socket with a single call
+ */
+#define GUI_OUTPUT_BUFFER_LENGTH                      65536
 
 
 #define LENGTH_LEFT_KEY_DOWN                             14
@@ -42,8 +77,22 @@
 #define LENGTH_RIGHT_KEY_UP                              13
 
 
+/* Length of the longest message from the GUI server, longer lines are
+ * skipped
+ */
+#define LENGTH_GUI_MESSAGE_MAX            LENGTH_RIGHT_KEY_DOWN
+
+
+/* Number of events following the next expected one which can be held
+ * until the missing events arrive (has to be a power of two)
+ */
+#define REORDER_BUFFER_CAPACITY                        1024
+
+
 typedef struct client_dgram_t client_dgram_t;
 typedef struct basic_event_data_t basic_event_data_t;
+typedef struct reordered_event_t reordered_event_t;
+typedef struct reorder_stats_t reorder_stats_t;
 typedef struct client_game_state_t client_game_state_t;
 
 
@@ -54,6 +103,7 @@ struct client_dgram_t {
     uint8_t turn_direction;
     uint32_t next_expected_event_no;
     char player_name[20];
+    uint16_t room;
 };
 
 
@@ -67,6 +117,31 @@ struct basic_event_data_t {
 };
 
 
+/* Event received ahead of the next expected one, kept in the slot given
+ * by its number modulo REORDER_BUFFER_CAPACITY
+ */
+struct reordered_event_t {
+    uint32_t event_no;
+    uint32_t x;
+    uint32_t y;
+
+    uint8_t event_type;
+    uint8_t player_no;
+    bool occupied;
+};
+
+
+struct reorder_stats_t {
+    /* Events stored in the reorder buffer, events released from it in
+     * order (each of them would have been dropped and had to be sent by
+     * the game server again) and events too far ahead to be stored
+     */
+    uint64_t held;
+    uint64_t released;
+    uint64_t dropped;
+};
+
+
 struct client_game_state_t {
     uint32_t game_id;
     uint32_t next_expected;
@@ -90,7 +165,50 @@ struct client_game_state_t {
     bool is_alive[MAX_PLAYERS];
     char game_players[MAX_PLAYERS][MAX_PLAYER_NAME_LENGTH + 1];
 
+    /* Player names followed by newline and their lengths (with the
+     * newline), prepared for the messages to the GUI server when the
+     * NEW_GAME event is parsed
+     */
+    char gui_player_names[MAX_PLAYERS][MAX_PLAYER_NAME_LENGTH + 1];
+    uint8_t gui_player_name_lengths[MAX_PLAYERS];
+
     basic_event_data_t data_for_gui;
+
+    /* Time (in nanoseconds of the monotonic clock) of the GUI key event
+     * which changed the turn direction and has not been sent to the server
+     * yet, 0 if there is no such event
+     */
+    uint64_t turn_change_nanos;
+
+    /* Times (in nanoseconds) from the GUI key event to sending of the
+     * datagram carrying the changed turn direction
+     */
+    histogram_t input_latency_histogram;
+
+    /* Turn direction carried by the last datagram sent to the game server
+     * and the time of sending the last datagram right after a change of it
+     */
+    uint8_t sent_turn_direction;
+    uint64_t last_input_dgram_nanos;
+
+    /* Flag set while the change of the turn direction waits for
+     * MIN_INPUT_DGRAM_INTERVAL_NANOS, so that it is counted once
+     */
+    bool input_dgram_delayed;
+
+    /* Numbers of datagrams sent right after a change of the turn direction
+     * and of changes which had to wait for MIN_INPUT_DGRAM_INTERVAL_NANOS
+     */
+    uint64_t input_datagrams;
+    uint64_t input_datagrams_delayed;
+
+    /* Events of the game received ahead of the next expected one and
+     * the number of them
+     */
+    reordered_event_t reorder_buffer[REORDER_BUFFER_CAPACITY];
+    uint32_t reordered_count;
+
+    reorder_stats_t reorder_stats;
 };
 
 
@@ -101,22 +219,30 @@ struct client_game_state_t {
 size_t prepare_message(const client_game_state_t *, char *);
 
 
+/* Prepares the PIXEL message for GUI server for the player (second
+ * argument) and the coordinates (third and fourth argument) given
+ * explicitly. Returns length (in bytes) of created message
+ */
+size_t prepare_pixel_message(const client_game_state_t *, uint8_t, uint32_t, uint32_t, char *);
+
+
 /* Initialises client game state with some default values where necessary
  */
 void initialise_client_game_state(client_game_state_t *);
 
 
 /* Serializes client datagram to char buffer so that it can be sent
- * as binary data through UDP socket to the game server
+ * as binary data through UDP socket to the game server (room field is
+ * appended only for rooms other than 0). Returns length of the datagram
  */
-void serialize_client_dgram(const client_dgram_t *, size_t, char *);
+size_t serialize_client_dgram(const client_dgram_t *, size_t, char *);
 
 
 /* Deserializes client datagram from buffer so that its content
- * can be processed by the game server. Returns 0 on success
- * (if serialized data satisfied the required conditions) and -1
- * when data is considered bad (e.g. too long message, illegal
- * characters in player name etc.)
+ * can be processed by the game server. Returns the length of the
+ * datagram without the room field on success (if serialized data
+ * satisfied the required conditions) and -1 when data is considered
+ * bad (e.g. too long message, illegal characters in player name etc.)
  */
 ssize_t deserialize_client_dgram(client_dgram_t *, char *, ssize_t);
 
@@ -127,9 +253,47 @@ ssize_t deserialize_client_dgram(client_dgram_t *, char *, ssize_t);
  * after parsing the event data or negative integer indicating error: -1
  * if CRC_32 checksum is bad or -2 if CRC_32 checksum is correct but
  * event record contains nonsense values. The latter case leads to
- * termination of the client program
+ * termination of the client program. Events of the game received ahead
+ * of the next expected one are held in the reorder buffer
  */
 ssize_t deserialize_event_record(client_game_state_t *, char *, ssize_t);
 
 
+/* Applies the next expected event if it is held in the reorder buffer
+ * (events received ahead of it are held there by deserialize_event_record
+ * until the missing ones arrive). Returns 1 if the event has been applied,
+ * 0 if it has not been received yet or -2 if it contains nonsense values
+ * (which leads to termination of the client program, as in case of
+ * deserialize_event_record). Should be called until it returns 0 after
+ * each event record
+ */
+int release_reordered_event(client_game_state_t *);
+
+
+/* Checks game_id (in network byte order, as received) of datagram from the
+ * game server. Switches client game state to the new game if the previous
+ * one is over. Returns true if and only if event records of the datagram
+ * should be parsed
+ */
+bool accept_server_game_id(client_game_state_t *, uint32_t);
+
+
+/* Called by decode_server_datagram after each event applied to the client
+ * game state (data_for_gui holds it, ready_to_send is not set only for
+ * GAME_OVER) with the argument passed to decode_server_datagram. Returns
+ * false if the rest of the datagram should not be decoded
+ */
+typedef bool (*event_applied_callback_t)(client_game_state_t *, void *);
+
+
+/* Decodes the datagram from the game server (second argument) of given
+ * length: checks its length and game_id, applies its event records and
+ * the events released from the reorder buffer after each of them, and
+ * calls the callback (fourth argument, with the fifth one) after every
+ * event applied. Returns false if the datagram contains nonsense values,
+ * true otherwise (also if it has been ignored)
+ */
+bool decode_server_datagram(client_game_state_t *, char *, ssize_t, event_applied_callback_t, void *);
+
+
 #endif /* CLIENT_PROTOCOL_H */
@@ -0,0 +1,337 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "event_ring.h"
+
+
+/* Paths of the rings to be unlinked when the process ends. POSIX shared
+ * memory objects are files in /dev/shm, unlink is used instead of
+ * shm_unlink because only the former is async-signal-safe
+ */
+static char unlinked_paths[EVENT_RING_MAX_UNLINKED][NAME_MAX + sizeof(EVENT_RING_SHM_DIRECTORY)];
+static uint32_t unlinked_count = 0;
+
+
+/* Signals which end the process and the actions installed for them before
+ * the ring handler (the signal is passed on to them)
+ */
+static const int ending_signals[] = {SIGINT, SIGTERM, SIGHUP};
+static struct sigaction previous_actions[sizeof(ending_signals) / sizeof(ending_signals[0])];
+
+
+static
+uint32_t padded_record_size(uint32_t length) {
+    return (sizeof(event_ring_record_t) + length + 7) & ~7U;
+}
+
+
+static
+event_ring_t *map_ring(int fd, size_t mapping_size, bool writer) {
+    void *mapping = mmap(NULL, mapping_size, PROT_READ | (writer ? PROT_WRITE : 0),
+                         MAP_SHARED, fd, 0);
+
+    close(fd);
+
+    if(mapping == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+
+    event_ring_t *ring = malloc(sizeof(event_ring_t));
+
+    if(ring == NULL) {
+        perror("malloc");
+        munmap(mapping, mapping_size);
+        return NULL;
+    }
+
+    ring->header = mapping;
+    ring->data = (char *) mapping + sizeof(event_ring_header_t);
+    ring->mapping_size = mapping_size;
+    ring->writer = writer;
+
+    return ring;
+}
+
+
+event_ring_t *event_ring_create(const char *name, uint32_t capacity) {
+    if(capacity == 0 || (capacity & (capacity - 1)) != 0) {
+        fprintf(stderr, "Event ring capacity has to be a power of two\n");
+        return NULL;
+    }
+
+    int fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+
+    if(fd < 0) {
+        perror("shm_open");
+        return NULL;
+    }
+
+    size_t mapping_size = sizeof(event_ring_header_t) + capacity;
+
+    if(ftruncate(fd, mapping_size) < 0) {
+        perror("ftruncate");
+        close(fd);
+        return NULL;
+    }
+
+    event_ring_t *ring = map_ring(fd, mapping_size, true);
+
+    if(ring == NULL) {
+        return NULL;
+    }
+
+    /* Invalidate the ring for readers attached to the previous writer
+     * before it is reset
+     */
+    __atomic_store_n(&ring->header->magic, 0, __ATOMIC_RELEASE);
+
+    ring->header->capacity = capacity;
+    ring->header->commit_position = 0;
+    ring->header->reserve_position = 0;
+    ring->header->game_id = 0;
+    ring->header->generation = 0;
+
+    __atomic_store_n(&ring->header->magic, EVENT_RING_MAGIC, __ATOMIC_RELEASE);
+
+    return ring;
+}
+
+
+static
+void unlink_rings(void) {
+    for(uint32_t i = 0; i < unlinked_count; ++i) {
+        unlink(unlinked_paths[i]);
+    }
+}
+
+
+static
+void handle_ending_signal(int signal_number) {
+    unlink_rings();
+
+    for(size_t i = 0; i < sizeof(ending_signals) / sizeof(ending_signals[0]); ++i) {
+        if(ending_signals[i] == signal_number) {
+            sigaction(signal_number, &previous_actions[i], NULL);
+        }
+    }
+
+    /* Delivered to the previous action once this handler returns */
+    raise(signal_number);
+}
+
+
+bool event_ring_unlink_at_exit(const char *name) {
+    if(unlinked_count == EVENT_RING_MAX_UNLINKED ||
+       strlen(name) >= NAME_MAX) {
+
+        fprintf(stderr, "Event ring %s will not be removed at exit\n", name);
+        return false;
+    }
+
+    snprintf(unlinked_paths[unlinked_count], sizeof(unlinked_paths[unlinked_count]),
+             "%s%s", EVENT_RING_SHM_DIRECTORY, name);
+
+    if(unlinked_count++ > 0) {
+        return true;
+    }
+
+    if(atexit(unlink_rings) != 0) {
+        fprintf(stderr, "Event rings will not be removed at exit\n");
+        return false;
+    }
+
+    struct sigaction ending_action;
+    memset(&ending_action, 0, sizeof(ending_action));
+    ending_action.sa_handler = handle_ending_signal;
+
+    for(size_t i = 0; i < sizeof(ending_signals) / sizeof(ending_signals[0]); ++i) {
+        if(sigaction(ending_signals[i], &ending_action, &previous_actions[i]) < 0) {
+            perror("sigaction");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+event_ring_t *event_ring_open(const char *name) {
+    int fd = shm_open(name, O_RDONLY, 0);
+
+    if(fd < 0) {
+        perror("shm_open");
+        return NULL;
+    }
+
+    struct stat object_stat;
+
+    if(fstat(fd, &object_stat) < 0 ||
+       (size_t) object_stat.st_size < sizeof(event_ring_header_t)) {
+        close(fd);
+        return NULL;
+    }
+
+    event_ring_t *ring = map_ring(fd, object_stat.st_size, false);
+
+    if(ring == NULL) {
+        return NULL;
+    }
+
+    if(__atomic_load_n(&ring->header->magic, __ATOMIC_ACQUIRE) != EVENT_RING_MAGIC ||
+       sizeof(event_ring_header_t) + ring->header->capacity > ring->mapping_size) {
+
+        event_ring_close(ring, name);
+        return NULL;
+    }
+
+    return ring;
+}
+
+
+void event_ring_close(event_ring_t *ring, const char *name) {
+    munmap(ring->header, ring->mapping_size);
+
+    if(ring->writer && shm_unlink(name) < 0) {
+        perror("shm_unlink");
+    }
+
+    free(ring);
+}
+
+
+void event_ring_publish(event_ring_t *ring,
+                        uint32_t game_id,
+                        uint32_t event_no,
+                        const char *record,
+                        uint32_t length) {
+
+    event_ring_header_t *header = ring->header;
+    uint32_t mask = header->capacity - 1;
+    uint32_t size = padded_record_size(length);
+
+    if(size > header->capacity / 2) {
+        return;
+    }
+
+    uint64_t position = header->commit_position;
+    uint32_t offset = position & mask;
+
+    /* Records never wrap around the end of the data area, the rest of it
+     * is filled with padding record if the new one does not fit
+     */
+    uint32_t padding = 0;
+
+    if(offset + size > header->capacity) {
+        padding = header->capacity - offset;
+    }
+
+    __atomic_store_n(&header->reserve_position, position + padding + size, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    if(padding > 0) {
+        if(padding >= sizeof(uint32_t)) {
+            uint32_t marker = EVENT_RING_PADDING;
+            memcpy(ring->data + offset, &marker, sizeof(marker));
+        }
+
+        position += padding;
+        offset = 0;
+    }
+
+    if(event_no == 0) {
+        header->generation++;
+        header->game_id = game_id;
+    }
+
+    event_ring_record_t record_header;
+
+    record_header.length = length;
+    record_header.game_id = game_id;
+    record_header.generation = header->generation;
+    record_header.event_no = event_no;
+
+    memcpy(ring->data + offset, &record_header, sizeof(record_header));
+    memcpy(ring->data + offset + sizeof(record_header), record, length);
+
+    __atomic_store_n(&header->commit_position, position + size, __ATOMIC_RELEASE);
+}
+
+
+uint64_t event_ring_position(event_ring_t *ring) {
+    return __atomic_load_n(&ring->header->commit_position, __ATOMIC_ACQUIRE);
+}
+
+
+ssize_t event_ring_read(event_ring_t *ring,
+                        uint64_t *cursor,
+                        event_ring_record_t *record_header,
+                        char *buffer,
+                        size_t buffer_size) {
+
+    event_ring_header_t *header = ring->header;
+    uint32_t capacity = header->capacity;
+    uint32_t mask = capacity - 1;
+
+    while(1) {
+        uint64_t commit = __atomic_load_n(&header->commit_position, __ATOMIC_ACQUIRE);
+
+        if(*cursor == commit) {
+            return 0;
+        }
+
+        if(commit - *cursor > capacity) {
+            *cursor = commit;
+            return -1;
+        }
+
+        uint32_t offset = *cursor & mask;
+        uint32_t remaining = capacity - offset;
+        uint32_t length = EVENT_RING_PADDING;
+
+        if(remaining >= sizeof(uint32_t)) {
+            memcpy(&length, ring->data + offset, sizeof(length));
+        }
+
+        if(remaining < sizeof(event_ring_record_t) || length == EVENT_RING_PADDING) {
+            /* Padding up to the end of the data area */
+            *cursor += remaining;
+            continue;
+        }
+
+        memcpy(record_header, ring->data + offset, sizeof(event_ring_record_t));
+
+        size_t copied = record_header->length;
+
+        if(copied > buffer_size) {
+            copied = buffer_size;
+        }
+
+        if(copied > remaining - sizeof(event_ring_record_t)) {
+            copied = remaining - sizeof(event_ring_record_t);
+        }
+
+        memcpy(buffer, ring->data + offset + sizeof(event_ring_record_t), copied);
+
+        /* The record is valid only if the writer has not started to
+         * overwrite it while it was being copied
+         */
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        uint64_t reserve = __atomic_load_n(&header->reserve_position, __ATOMIC_RELAXED);
+
+        if(reserve - *cursor > capacity) {
+            *cursor = __atomic_load_n(&header->commit_position, __ATOMIC_ACQUIRE);
+            return -1;
+        }
+
+        *cursor += padded_record_size(record_header->length);
+
+        return copied;
+    }
+}
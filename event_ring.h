@@ -0,0 +1,133 @@
+#ifndef EVENT_RING_H
+#define EVENT_RING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+
+/* Value stored in the ring header once the writer has initialised it
+ */
+#define EVENT_RING_MAGIC                         0x53575231
+
+
+/* Default size (in bytes) of the data area of the ring, has to be
+ * a power of two
+ */
+#define EVENT_RING_DEFAULT_CAPACITY               (1 << 22)
+
+
+/* Length value of a record which only pads the data area up to its end
+ * (the next record starts at the beginning of the data area)
+ */
+#define EVENT_RING_PADDING                       0xFFFFFFFF
+
+
+/* Maximal number of rings removed when the process ends (one per room)
+ * and the directory of POSIX shared memory objects
+ */
+#define EVENT_RING_MAX_UNLINKED                         256
+#define EVENT_RING_SHM_DIRECTORY                  "/dev/shm"
+
+
+typedef struct event_ring_header_t event_ring_header_t;
+typedef struct event_ring_record_t event_ring_record_t;
+typedef struct event_ring_t event_ring_t;
+
+
+/* Header placed at the beginning of the shared memory object
+ */
+struct event_ring_header_t {
+    uint32_t magic;
+
+    /* Size of the data area which follows the header
+     */
+    uint32_t capacity;
+
+    /* Position (total number of bytes ever written) up to which records
+     * are complete and can be read
+     */
+    uint64_t commit_position;
+
+    /* Position up to which the writer may already be overwriting the data
+     * area. Readers compare it with their cursor after copying a record to
+     * detect that the record has been overwritten in the meantime
+     */
+    uint64_t reserve_position;
+
+    /* Id of the game which is currently published and number of games that
+     * have been published so far
+     */
+    uint32_t game_id;
+    uint32_t generation;
+};
+
+
+/* Header of every record in the data area. Followed by length bytes of
+ * event record in exactly the wire format sent in server datagrams
+ * (padded up to the multiple of 8 bytes)
+ */
+struct event_ring_record_t {
+    uint32_t length;
+    uint32_t game_id;
+    uint32_t generation;
+    uint32_t event_no;
+};
+
+
+struct event_ring_t {
+    event_ring_header_t *header;
+    char *data;
+
+    size_t mapping_size;
+    bool writer;
+};
+
+
+/* Creates (or takes over) named POSIX shared memory object with a ring
+ * of given capacity for a single writer. Returns NULL on failure
+ */
+event_ring_t *event_ring_create(const char *, uint32_t);
+
+
+/* Opens existing ring for reading. Returns NULL on failure or when the
+ * writer has not initialised the ring yet
+ */
+event_ring_t *event_ring_open(const char *);
+
+
+/* Unmaps the ring (and unlinks the shared memory object in the writer)
+ */
+void event_ring_close(event_ring_t *, const char *);
+
+
+/* Removes the shared memory object of the ring with given name when the
+ * process exits or is ended by SIGINT, SIGTERM or SIGHUP (the actions
+ * installed for these signals before are carried out afterwards). Returns
+ * false on failure
+ */
+bool event_ring_unlink_at_exit(const char *);
+
+
+/* Appends the event record (wire format, passed as the fourth and fifth
+ * arguments) of the game with given id and event number. Event number 0
+ * starts new generation
+ */
+void event_ring_publish(event_ring_t *, uint32_t, uint32_t, const char *, uint32_t);
+
+
+/* Returns the current commit position, used as the initial cursor of a
+ * reader which is interested only in the records published from now on
+ */
+uint64_t event_ring_position(event_ring_t *);
+
+
+/* Reads the record at the cursor (second argument) to the buffer of given
+ * size and advances the cursor. Returns length of the event record, 0 if
+ * there is no new record and -1 if the reader has been overrun by the
+ * writer (the cursor is then moved to the current commit position)
+ */
+ssize_t event_ring_read(event_ring_t *, uint64_t *, event_ring_record_t *, char *, size_t);
+
+
+#endif /* EVENT_RING_H */
@@ -3,7 +3,15 @@
 #include <stdint.h>
 #include <arpa/inet.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
 #include "game_server_protocol.h"
+#include "log.h"
+#include "trace.h"
 #include "utils.h"
 
 
@@ -44,7 +52,11 @@ void sort_players(server_game_state_t *state) {
 void enqueue_event(server_game_state_t *state, event_data_t *event) {
     uint32_t next_free = state->events_count;
 
-    if(next_free >= state->events_queue_size - 2) {
+    /* The queue allocated from the arena holds the longest possible game
+     * and its pages are pre-faulted between the rounds, it is never
+     * reallocated
+     */
+    if(state->arena.base == NULL && next_free >= state->events_queue_size - 2) {
         void *realloc_ptr = realloc(state->events_queue,
                                     2 * state->events_queue_size * sizeof(event_data_t));
         if(realloc_ptr == NULL) {
@@ -52,6 +64,7 @@ void enqueue_event(server_game_state_t *state, event_data_t *event) {
             exit(1);
         }
 
+        state->events_queue = realloc_ptr;
         state->events_queue_size *= 2;
     }
 
@@ -65,7 +78,12 @@ void enqueue_event(server_game_state_t *state, event_data_t *event) {
 }
 
 
-static
+uint32_t max_game_events(const game_params_t *game_params) {
+    /* New game, pixels, eliminations and game over */
+    return 1 + game_params->board_dimension_x * game_params->board_dimension_y + MAX_PLAYERS + 1;
+}
+
+
 ssize_t serialize_event_record(server_game_state_t *state,
                                uint32_t event_no,
                                char *buffer,
@@ -211,23 +229,91 @@ void send_game_data(server_game_state_t  *state,
                     uint8_t client_no) {
 
     uint32_t first_not_sent = since_event;
-    ssize_t ret_val;
 
     while(first_not_sent < state->events_count) {
-        ssize_t datagram_size = pack_events(state,
-                                            first_not_sent,
-                                            &first_not_sent,
-                                            MAX_SERVER_UDP_DGRAM_LENGTH);
-
-        ret_val = sendto(state->server_socket,
-                         state->server_buffer,
-                         datagram_size,
-                         0,
-                         (struct sockaddr *) &state->players[client_no].conn.address,
-                         state->players[client_no].conn.address_length);
+        pack_burst(state, first_not_sent, &first_not_sent);
+        send_burst(state, client_no);
+    }
+}
+
+
+uint32_t send_limited_game_data(server_game_state_t *state,
+                                uint32_t since_event,
+                                uint8_t client_no,
+                                size_t max_bytes) {
+
+    uint32_t first_not_sent = since_event;
+    size_t remaining_bytes = max_bytes;
+
+    while(first_not_sent < state->events_count) {
+        pack_burst(state, first_not_sent, &first_not_sent);
+
+        /* Leave out the datagrams which exceed the limit */
+        uint8_t fitting = 0;
+
+        while(fitting < state->burst.segments_count &&
+              state->burst.lengths[fitting] <= remaining_bytes) {
+
+            remaining_bytes -= state->burst.lengths[fitting];
+            fitting++;
+        }
+
+        bool truncated = fitting < state->burst.segments_count;
+
+        if(truncated) {
+            state->burst.segments_count = fitting;
+            first_not_sent = state->burst.first_events[fitting];
+        }
+
+        if(fitting > 0) {
+            send_burst(state, client_no);
+        }
+
+        if(truncated) {
+            break;
+        }
+    }
+
+    return first_not_sent;
+}
+
+
+/* Records the latency of the turn direction changes of the players whose
+ * EVENT_PIXEL has just been sent (among the events since since_event)
+ */
+static
+void record_input_latency(server_game_state_t *state, uint32_t since_event) {
+    uint64_t now = 0;
+
+    for(uint8_t i = 0; i < MAX_PLAYERS; ++i) {
+        client_t *client = &state->players[i];
+
+        if(client->turn_change_nanos == 0) {
+            continue;
+        }
 
-        if(ret_val < 0 || ret_val != datagram_size) {
-            perror("sendto");
+        for(uint32_t event_no = since_event; event_no < state->events_count; ++event_no) {
+            event_data_t *event = &state->events_queue[event_no];
+
+            if(event->event_type == EVENT_PIXEL && event->player_number == client->player_number) {
+                if(now == 0) {
+                    now = realtime_nanos();
+                }
+
+                uint64_t latency = now > client->turn_change_nanos ? now - client->turn_change_nanos : 0;
+
+                client->input_latency_samples++;
+                client->input_latency_total += latency;
+
+                if(latency > client->input_latency_max) {
+                    client->input_latency_max = latency;
+                }
+
+                histogram_record(&state->stats.input_latency_histogram, latency);
+
+                client->turn_change_nanos = 0;
+                break;
+            }
         }
     }
 }
@@ -235,35 +321,29 @@ void send_game_data(server_game_state_t  *state,
 
 void broadcast_events(server_game_state_t *state, uint32_t since_event) {
     uint32_t first_not_sent = since_event;
-    ssize_t ret_val;
 
     while(first_not_sent < state->events_count) {
-        ssize_t datagram_size = pack_events(state,
-                                            first_not_sent,
-                                            &first_not_sent,
-                                            MAX_SERVER_UDP_DGRAM_LENGTH);
+        pack_burst(state, first_not_sent, &first_not_sent);
 
         for(uint8_t i = 0; i < MAX_PLAYERS; ++i) {
-            if(state->players[i].conn.is_connection_active) {
-                ret_val = sendto(state->server_socket,
-                                 state->server_buffer,
-                                 datagram_size,
-                                 0,
-                                 (struct sockaddr *) &(state->players[i].conn.address),
-                                 state->players[i].conn.address_length);
-
-                if(ret_val < 0 || ret_val != datagram_size) {
-                    perror("sendto");
-                }
+            if(state->players[i].conn.is_connection_active && !state->players[i].is_bot) {
+                send_burst(state, i);
             }
         }
     }
+
+    record_input_latency(state, since_event);
 }
 
 
 void initiate_game(server_game_state_t *state) {
     sort_players(state);
 
+    /* Changes made before the game are not measured */
+    for(uint8_t i = 0; i < MAX_PLAYERS; ++i) {
+        state->players[i].turn_change_nanos = 0;
+    }
+
     /* Clear the game board before placing players on their initial positions */
     for(uint32_t i = 0; i < state->game_params.board_dimension_x; ++i) {
         for(uint32_t j = 0; j < state->game_params.board_dimension_y; ++j) {
@@ -347,24 +427,24 @@ void initiate_game(server_game_state_t *state) {
 
     broadcast_events(state, 0);
 
-    state->fds[1].fd = timerfd_create(CLOCK_MONOTONIC, 0);
-
-    if(state->fds[1].fd < 0) {
-        perror("timerfd_create");
+    /* With bots the round timer is already running */
+    if(state->bots_count == 0) {
+        state->backend->start_round_timer(state);
     }
-
-    timerfd_settime(state->fds[1].fd, 0, &state->round_params, NULL);
 }
 
 
-ssize_t pack_events(server_game_state_t *state,
-                    uint32_t from_which,
-                    uint32_t *first_not_packed,
-                    ssize_t remaining_space) {
+static
+ssize_t pack_events_to_buffer(server_game_state_t *state,
+                              char *buffer,
+                              uint32_t from_which,
+                              uint32_t until_event,
+                              uint32_t *first_not_packed,
+                              ssize_t remaining_space) {
 
     /* Before any processing, append game id */
     uint32_t conv_game_id = htonl(state->game_id);
-    memcpy(state->server_buffer, &conv_game_id, 4);
+    memcpy(buffer, &conv_game_id, 4);
 
     ssize_t free_space = remaining_space - 4;
     ssize_t datagram_size = 4;
@@ -372,10 +452,10 @@ ssize_t pack_events(server_game_state_t *state,
     ssize_t ret_val;
     uint32_t event_no;
 
-    for(event_no = from_which; event_no < state->events_count; ++event_no) {
+    for(event_no = from_which; event_no < until_event; ++event_no) {
         ret_val = serialize_event_record(state,
                                          event_no,
-                                         state->server_buffer + datagram_size,
+                                         buffer + datagram_size,
                                          free_space);
 
         if(ret_val < 0) {
@@ -392,6 +472,529 @@ ssize_t pack_events(server_game_state_t *state,
 }
 
 
+ssize_t pack_events(server_game_state_t *state,
+                    uint32_t from_which,
+                    uint32_t *first_not_packed,
+                    ssize_t remaining_space) {
+
+    return pack_events_to_buffer(state,
+                                 state->server_buffer,
+                                 from_which,
+                                 state->events_count,
+                                 first_not_packed,
+                                 remaining_space);
+}
+
+
+/* Packs datagrams with events from range [from_which, until_event)
+ * into the burst, see pack_burst
+ */
+static
+void pack_burst_range(server_game_state_t *state,
+                      uint32_t from_which,
+                      uint32_t until_event,
+                      uint32_t *first_not_packed) {
+
+    server_burst_t *burst = &state->burst;
+    size_t offset = 0;
+
+    uint64_t trace_start_time = trace_enabled ? monotonic_nanos() : 0;
+
+    burst->segments_count = 0;
+    burst->generation++;
+    *first_not_packed = from_which;
+
+    while(*first_not_packed < until_event &&
+          burst->segments_count < MAX_BURST_SEGMENTS) {
+
+        burst->first_events[burst->segments_count] = *first_not_packed;
+
+        ssize_t datagram_size = pack_events_to_buffer(state,
+                                                      burst->buffer + offset,
+                                                      *first_not_packed,
+                                                      until_event,
+                                                      first_not_packed,
+                                                      MAX_SERVER_UDP_DGRAM_LENGTH);
+
+        burst->lengths[burst->segments_count] = (uint16_t) datagram_size;
+        burst->segments_count++;
+        offset += datagram_size;
+    }
+
+    burst->first_events[burst->segments_count] = *first_not_packed;
+
+    if(trace_enabled) {
+        trace_record(TRACE_PACK_EVENTS, state->room_id, TRACE_NO_CLIENT,
+                     state->stats.rounds, trace_start_time,
+                     from_which, *first_not_packed - from_which, offset);
+    }
+}
+
+
+void pack_burst(server_game_state_t *state,
+                uint32_t from_which,
+                uint32_t *first_not_packed) {
+
+    pack_burst_range(state, from_which, state->events_count, first_not_packed);
+}
+
+
+int send_datagrams_to(int sock,
+                      const struct sockaddr_in6 *address,
+                      socklen_t address_length,
+                      char *data,
+                      size_t total_size,
+                      uint16_t segment_size) {
+
+    ssize_t ret_val;
+
+    if(total_size == segment_size) {
+        ret_val = sendto(sock,
+                         data,
+                         total_size,
+                         0,
+                         (const struct sockaddr *) address,
+                         address_length);
+
+        if(ret_val < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return SEND_STATUS_WOULD_BLOCK;
+        }
+
+        if(ret_val < 0 || (size_t) ret_val != total_size) {
+            log_error(LOG_ERROR, "sendto");
+        }
+
+        return SEND_STATUS_OK;
+    }
+
+    char control[CMSG_SPACE(sizeof(uint16_t))];
+    struct iovec iov = { data, total_size };
+    struct msghdr msg;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(control, 0, sizeof(control));
+
+    msg.msg_name = (void *) address;
+    msg.msg_namelen = address_length;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_UDP;
+    cmsg->cmsg_type = UDP_SEGMENT;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+    memcpy(CMSG_DATA(cmsg), &segment_size, sizeof(uint16_t));
+
+    ret_val = sendmsg(sock, &msg, 0);
+
+    if(ret_val < 0) {
+        if(errno == EAGAIN || errno == EWOULDBLOCK) {
+            return SEND_STATUS_WOULD_BLOCK;
+        }
+
+        if(errno == EIO || errno == EINVAL || errno == ENOPROTOOPT ||
+           errno == EOPNOTSUPP) {
+            /* Segmentation offload not available for this route / device */
+            return SEND_STATUS_NO_SEGMENTATION;
+        }
+
+        log_error(LOG_ERROR, "sendmsg");
+    }
+    else if((size_t) ret_val != total_size) {
+        log_error(LOG_ERROR, "sendmsg");
+    }
+
+    return SEND_STATUS_OK;
+}
+
+
+/* Sends datagrams to the client directly from the calling thread
+ */
+static
+int poll_send_datagrams(server_game_state_t *state,
+                        uint8_t client_no,
+                        char *data,
+                        size_t total_size,
+                        uint16_t segment_size) {
+
+    int status = send_datagrams_to(state->server_socket,
+                                   &state->players[client_no].conn.address,
+                                   state->players[client_no].conn.address_length,
+                                   data,
+                                   total_size,
+                                   segment_size);
+
+    if(status == SEND_STATUS_NO_SEGMENTATION) {
+        /* Do not try segmentation offload again */
+        state->gso_supported = false;
+    }
+
+    return status;
+}
+
+
+/* Sends the datagrams with the backend of the game, see send_datagrams
+ * in server_backend_t
+ */
+static
+int send_segments(server_game_state_t *state,
+                  uint8_t client_no,
+                  char *data,
+                  size_t total_size,
+                  uint16_t segment_size) {
+
+    uint64_t trace_start_time = trace_enabled ? monotonic_nanos() : 0;
+
+    int status = state->backend->send_datagrams(state, client_no, data, total_size, segment_size);
+
+    if(trace_enabled) {
+        trace_record(TRACE_SEND, state->room_id, client_no,
+                     state->stats.rounds, trace_start_time,
+                     total_size, (total_size + segment_size - 1) / segment_size, status);
+    }
+
+    return status;
+}
+
+
+/* Sends datagrams of the burst to the client, starting from the one with
+ * index passed as the third argument. Returns index of the first datagram
+ * which has not been sent because the socket send buffer is full (equal
+ * to the number of datagrams in the burst if all of them have been sent)
+ */
+static
+uint8_t send_burst_segments(server_game_state_t *state,
+                            uint8_t client_no,
+                            uint8_t first) {
+
+    server_burst_t *burst = &state->burst;
+    size_t offset = 0;
+    int status;
+
+    for(uint8_t i = 0; i < first; ++i) {
+        offset += burst->lengths[i];
+    }
+
+    while(first < burst->segments_count) {
+        uint16_t segment_size = burst->lengths[first];
+        uint8_t last = first + 1;
+        size_t run_size = segment_size;
+
+        /* Gather datagrams of equal length, the last one in a segmented
+         * run is allowed to be shorter
+         */
+        while(last < burst->segments_count && burst->lengths[last] == segment_size) {
+            run_size += burst->lengths[last];
+            last++;
+        }
+
+        if(last < burst->segments_count && burst->lengths[last] < segment_size) {
+            run_size += burst->lengths[last];
+            last++;
+        }
+
+        status = SEND_STATUS_NO_SEGMENTATION;
+
+        if(last - first > 1 && state->gso_supported) {
+            status = send_segments(state, client_no, burst->buffer + offset,
+                                   run_size, segment_size);
+
+            if(status == SEND_STATUS_WOULD_BLOCK) {
+                return first;
+            }
+        }
+
+        if(status == SEND_STATUS_OK) {
+            offset += run_size;
+        }
+        else {
+            for(uint8_t i = first; i < last; ++i) {
+                status = send_segments(state, client_no, burst->buffer + offset,
+                                       burst->lengths[i], burst->lengths[i]);
+
+                if(status == SEND_STATUS_WOULD_BLOCK) {
+                    return i;
+                }
+
+                offset += burst->lengths[i];
+            }
+        }
+
+        first = last;
+    }
+
+    return first;
+}
+
+
+void mark_client_for_resync(server_game_state_t *state, uint8_t client_no, uint32_t game_id) {
+    client_t *client = &state->players[client_no];
+
+    if(!client->resync_needed) {
+        client->resync_needed = true;
+        client->resync_game_id = game_id;
+    }
+}
+
+
+/* Drops everything queued for the client and marks it for resynchronisation
+ */
+static
+void drop_outbound_queue(server_game_state_t *state, client_t *client, uint32_t dropped) {
+    state->stats.datagrams_dropped += client->outbound.count + dropped;
+
+    mark_client_for_resync(state,
+                           client - state->players,
+                           client->outbound.count > 0 ? client->outbound.game_id : state->game_id);
+
+    client->outbound.head = 0;
+    client->outbound.count = 0;
+}
+
+
+/* Queues the datagrams of the burst starting from the one with index
+ * passed as the third argument
+ */
+static
+void queue_burst_segments(server_game_state_t *state, uint8_t client_no, uint8_t first) {
+    client_t *client = &state->players[client_no];
+    outbound_queue_t *queue = &client->outbound;
+    server_burst_t *burst = &state->burst;
+
+    if(client->resync_needed) {
+        /* Events already missing, the client will be resynchronised anyway */
+        state->stats.datagrams_dropped += burst->segments_count - first;
+        return;
+    }
+
+    if(queue->count + (burst->segments_count - first) > OUTBOUND_QUEUE_LENGTH) {
+        drop_outbound_queue(state, client, burst->segments_count - first);
+        return;
+    }
+
+    if(queue->count == 0) {
+        queue->game_id = state->game_id;
+    }
+
+    for(uint8_t i = first; i < burst->segments_count; ++i) {
+        outbound_datagram_t *datagram;
+
+        datagram = &queue->datagrams[(queue->head + queue->count) % OUTBOUND_QUEUE_LENGTH];
+        datagram->first_event = burst->first_events[i];
+        datagram->end_event = burst->first_events[i + 1];
+
+        queue->count++;
+        state->stats.datagrams_queued++;
+    }
+}
+
+
+void send_burst(server_game_state_t *state, uint8_t client_no) {
+    if(state->players[client_no].outbound.count > 0 ||
+       state->players[client_no].resync_needed) {
+
+        /* Keep the order of datagrams - the new ones go after those which
+         * are still waiting
+         */
+        queue_burst_segments(state, client_no, 0);
+        return;
+    }
+
+    uint8_t first_not_sent = send_burst_segments(state, client_no, 0);
+
+    if(first_not_sent < state->burst.segments_count) {
+        state->stats.sends_would_block++;
+        queue_burst_segments(state, client_no, first_not_sent);
+    }
+}
+
+
+/* Sends datagrams queued for the client. Returns false if the socket send
+ * buffer became full in the meantime
+ */
+static
+bool drain_client_queue(server_game_state_t *state, uint8_t client_no) {
+    client_t *client = &state->players[client_no];
+    outbound_queue_t *queue = &client->outbound;
+    uint32_t first_not_packed;
+
+    if(queue->count > 0 && queue->game_id != state->game_id) {
+        /* Game history the datagrams refer to does not exist anymore */
+        drop_outbound_queue(state, client, 0);
+        return true;
+    }
+
+    while(queue->count > 0) {
+        outbound_datagram_t *datagram = &queue->datagrams[queue->head];
+
+        pack_burst_range(state, datagram->first_event, datagram->end_event, &first_not_packed);
+
+        uint8_t first_not_sent = send_burst_segments(state, client_no, 0);
+
+        if(first_not_sent < state->burst.segments_count) {
+            datagram->first_event = state->burst.first_events[first_not_sent];
+            state->stats.sends_would_block++;
+            return false;
+        }
+
+        datagram->first_event = first_not_packed;
+
+        if(datagram->first_event >= datagram->end_event) {
+            queue->head = (queue->head + 1) % OUTBOUND_QUEUE_LENGTH;
+            queue->count--;
+        }
+    }
+
+    return true;
+}
+
+
+void drain_outbound_queues(server_game_state_t *state) {
+    /* Start from a different client each time so that none of them
+     * is favoured when the socket keeps filling up
+     */
+    for(uint8_t i = 0; i < MAX_PLAYERS; ++i) {
+        uint8_t client_no = (state->outbound_first_client + i) % MAX_PLAYERS;
+
+        if(!drain_client_queue(state, client_no)) {
+            state->outbound_first_client = client_no;
+            return;
+        }
+    }
+
+    state->outbound_first_client = (state->outbound_first_client + 1) % MAX_PLAYERS;
+}
+
+
+bool outbound_backlog(server_game_state_t *state) {
+    for(uint8_t i = 0; i < MAX_PLAYERS; ++i) {
+        if(state->players[i].outbound.count > 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+void reset_outbound_queue(server_game_state_t *state, uint8_t client_no) {
+    state->players[client_no].outbound.head = 0;
+    state->players[client_no].outbound.count = 0;
+    state->players[client_no].resync_needed = false;
+}
+
+
+void resync_client(server_game_state_t *state, uint8_t client_no, uint32_t next_expected) {
+    client_t *client = &state->players[client_no];
+
+    if(!client->resync_needed || client->outbound.count > 0) {
+        return;
+    }
+
+    /* Events requested by the client refer to the current game only if
+     * the events were dropped during it, otherwise the whole current game
+     * is sent from its beginning
+     */
+    uint32_t since_event = (client->resync_game_id == state->game_id) ? next_expected : 0;
+
+    client->resync_needed = false;
+    state->stats.resyncs++;
+
+    if(since_event < state->events_count) {
+        client->outbound.game_id = state->game_id;
+        client->outbound.head = 0;
+        client->outbound.count = 1;
+        client->outbound.datagrams[0].first_event = since_event;
+        client->outbound.datagrams[0].end_event = state->events_count;
+    }
+}
+
+
+void print_server_stats(server_game_state_t *state) {
+    fprintf(stderr, "room: %u, rounds: %lu, sends would block: %lu, datagrams queued: %lu, "
+                    "datagrams dropped: %lu, resyncs: %lu, "
+                    "datagrams rate limited: %lu, catch-ups capped: %lu, "
+                    "updates dropped: %lu, tick time: %lu us, bots time: %lu us, "
+                    "tick p50: %lu us, p99: %lu us, p99.9: %lu us, max: %lu us, "
+                    "jitter p50: %lu us, p99: %lu us, p99.9: %lu us, max: %lu us\n",
+            state->room_id,
+            state->stats.rounds,
+            state->stats.sends_would_block,
+            state->stats.datagrams_queued,
+            state->stats.datagrams_dropped,
+            state->stats.resyncs,
+            state->stats.datagrams_rate_limited,
+            state->stats.catchups_capped,
+            state->stats.updates_dropped,
+            state->stats.tick_nanos / 1000,
+            state->stats.bots_nanos / 1000,
+            histogram_percentile(&state->stats.tick_histogram, 50) / 1000,
+            histogram_percentile(&state->stats.tick_histogram, 99) / 1000,
+            histogram_percentile(&state->stats.tick_histogram, 99.9) / 1000,
+            state->stats.tick_histogram.max / 1000,
+            histogram_percentile(&state->stats.jitter_histogram, 50) / 1000,
+            histogram_percentile(&state->stats.jitter_histogram, 99) / 1000,
+            histogram_percentile(&state->stats.jitter_histogram, 99.9) / 1000,
+            state->stats.jitter_histogram.max / 1000);
+
+    const histogram_t *histogram = &state->stats.input_latency_histogram;
+
+    if(histogram->total > 0) {
+        fprintf(stderr, "room: %u, input latency samples: %lu, "
+                        "p50: %lu us, p99: %lu us, p99.9: %lu us, max: %lu us\n",
+                state->room_id,
+                histogram->total,
+                histogram_percentile(histogram, 50) / 1000,
+                histogram_percentile(histogram, 99) / 1000,
+                histogram_percentile(histogram, 99.9) / 1000,
+                histogram->max / 1000);
+    }
+
+    for(uint8_t i = 0; i < MAX_PLAYERS; ++i) {
+        const client_t *client = &state->players[i];
+
+        if(!client->conn.is_connection_active || client->input_latency_samples == 0) {
+            continue;
+        }
+
+        fprintf(stderr, "room: %u, client: %u (%s), input latency samples: %lu, "
+                        "mean: %lu us, max: %lu us\n",
+                state->room_id,
+                i,
+                client->name,
+                client->input_latency_samples,
+                client->input_latency_total / client->input_latency_samples / 1000,
+                client->input_latency_max / 1000);
+    }
+}
+
+
+void enable_receive_timestamps(server_game_state_t *state) {
+    int enable = 1;
+
+    if(setsockopt(state->server_socket, SOL_SOCKET, SO_TIMESTAMPNS, &enable, sizeof(enable)) < 0) {
+        log_error(LOG_WARNING, "setsockopt");
+    }
+}
+
+
+void probe_udp_gso(server_game_state_t *state) {
+    int segment_size = 0;
+
+    /* Setting segment size to 0 on the socket level keeps the default
+     * behaviour (no segmentation) but fails on kernels which do not
+     * know UDP_SEGMENT at all
+     */
+    state->gso_supported = (setsockopt(state->server_socket,
+                                       SOL_UDP,
+                                       UDP_SEGMENT,
+                                       &segment_size,
+                                       sizeof(segment_size)) == 0);
+}
+
+
 
 void update_players_after_game(server_game_state_t *state) {
     state->ready_players = 0;
@@ -406,6 +1009,12 @@ void update_players_after_game(server_game_state_t *state) {
 
                 state->players[i].is_playing = true;
                 state->players[i].is_spectator = false;
+
+                /* Bots are ready for the next game right away */
+                if(state->players[i].is_bot) {
+                    state->players[i].ready = true;
+                    state->ready_players++;
+                }
             }
             else {
                 state->players[i].is_playing = false;
@@ -413,4 +1022,61 @@ void update_players_after_game(server_game_state_t *state) {
             }
         }
     }
-}
\ No newline at end of file
+}
+
+
+static
+void poll_start_round_timer(server_game_state_t *state) {
+    state->fds[1].fd = timerfd_create(CLOCK_MONOTONIC, 0);
+
+    if(state->fds[1].fd < 0) {
+        log_error(LOG_ERROR, "timerfd_create");
+    }
+
+    timerfd_settime(state->fds[1].fd, 0, &state->round_params, NULL);
+}
+
+
+static
+void poll_stop_round_timer(server_game_state_t *state) {
+    if(close(state->fds[1].fd) < 0) {
+        log_error(LOG_ERROR, "close");
+    }
+
+    state->fds[1].fd = -1;
+}
+
+
+static
+void poll_start_client_timer(server_game_state_t *state, uint8_t client_no) {
+    /* Set up descriptor for the client timeout clock
+     */
+    if((state->fds[2 + client_no].fd = timerfd_create(CLOCK_MONOTONIC, 0)) < 0) {
+        log_error(LOG_ERROR, "timerfd_create");
+    }
+
+    /* And set timeout timer to work
+     */
+    if(timerfd_settime(state->fds[2 + client_no].fd, 0, &state->timeout_params, NULL) < 0) {
+        log_error(LOG_ERROR, "timerfd_settime");
+    }
+}
+
+
+static
+void poll_stop_client_timer(server_game_state_t *state, uint8_t client_no) {
+    if(close(state->fds[2 + client_no].fd) < 0) {
+        log_error(LOG_ERROR, "close");
+    }
+
+    state->fds[2 + client_no].fd = -1;
+}
+
+
+const server_backend_t poll_backend = {
+    .send_datagrams = poll_send_datagrams,
+    .start_round_timer = poll_start_round_timer,
+    .stop_round_timer = poll_stop_round_timer,
+    .start_client_timer = poll_start_client_timer,
+    .stop_client_timer = poll_stop_client_timer
+};
@@ -5,6 +5,10 @@
 #include <stdint.h>
 #include <sys/timerfd.h>
 #include <sys/poll.h>
+#include "arena.h"
+#include "event_ring.h"
+#include "histogram.h"
+#include "rate_limiter.h"
 #include "utils.h"
 
 
@@ -20,6 +24,33 @@
 #define MAX_SERVER_UDP_DGRAM_LENGTH                     550
 
 
+/* Maximum number of datagrams that are packed into a single
+ * burst and handed to the kernel at once (with UDP_SEGMENT
+ * when supported). Equal to the kernel UDP_MAX_SEGMENTS limit
+ */
+#define MAX_BURST_SEGMENTS                               64
+
+
+/* Maximum number of datagrams that can wait in the outbound queue
+ * of a single client for the server socket to become writable
+ */
+#define OUTBOUND_QUEUE_LENGTH                            32
+
+
+/* Maximum number of bytes of game history sent to a client whose address
+ * has not been verified yet (it has not proven that it receives datagrams
+ * sent to this address). Limits the reply to a single spoofed datagram
+ */
+#define UNVERIFIED_CATCHUP_BYTES        (2 * MAX_SERVER_UDP_DGRAM_LENGTH)
+
+
+/* Results of sending datagrams through the server backend
+ */
+#define SEND_STATUS_OK                                    0
+#define SEND_STATUS_NO_SEGMENTATION                       1
+#define SEND_STATUS_WOULD_BLOCK                           2
+
+
 #define INTEGER_FIELDS_LEN_EVENT_RECORD_NEW_GAME         21
 #define EVENT_FIELDS_LENGTH_NEW_GAME_RAW                 13
 
@@ -68,6 +99,13 @@
 #define DEFAULT_EVENTS_QUEUE_SIZE                      4096
 
 
+/* Number of events of the queue allocated from the arena which are
+ * pre-faulted when the game state is created (the history of a usual
+ * game), the rest is pre-faulted in chunks when the queue grows
+ */
+#define PREFAULTED_EVENTS_QUEUE_SIZE                  65536
+
+
 /* Constants representing the states of the game
  */
 #define GAME_STATE_GAME_STARTED                           1
@@ -78,10 +116,15 @@
 
 
 typedef struct connection_data_t connection_data_t;
+typedef struct outbound_datagram_t outbound_datagram_t;
+typedef struct outbound_queue_t outbound_queue_t;
 typedef struct client_t client_t;
 typedef struct event_data_t event_data_t;
 typedef struct seed_status_t seed_status_t;
 typedef struct game_params_t game_params_t;
+typedef struct server_burst_t server_burst_t;
+typedef struct server_stats_t server_stats_t;
+typedef struct server_backend_t server_backend_t;
 typedef struct server_game_state_t server_game_state_t;
 
 
@@ -105,6 +148,29 @@ struct connection_data_t {
 };
 
 
+struct outbound_datagram_t {
+    /* Range of events [first_event, end_event) which has not been sent
+     * yet. Datagrams are packed again from the game history when the
+     * socket becomes writable (the history does not change during the game)
+     */
+    uint32_t first_event;
+    uint32_t end_event;
+};
+
+
+struct outbound_queue_t {
+    /* Cyclic buffer of datagrams waiting to be sent
+     */
+    outbound_datagram_t datagrams[OUTBOUND_QUEUE_LENGTH];
+    uint8_t head;
+    uint8_t count;
+
+    /* Id of the game the queued events belong to
+     */
+    uint32_t game_id;
+};
+
+
 struct client_t {
     /* Status of client's connection (address, length of address,
      * session_id and flag which indicates whether connection is
@@ -171,6 +237,57 @@ struct client_t {
      * indicated whether client should be disconnected)
      */
     bool message;
+
+    /* Datagrams which could not be sent because the server socket
+     * send buffer was full
+     */
+    outbound_queue_t outbound;
+
+    /* Flag which indicates that the outbound queue has overflowed and
+     * the events have been dropped. The client is resynchronised from
+     * the event number it requests in its next datagram
+     */
+    bool resync_needed;
+
+    /* Id of the game during which the events have been dropped
+     */
+    uint32_t resync_game_id;
+
+    /* Flag which indicates whether the client has proven that it receives
+     * datagrams sent to its address (by requesting an event sent to it in
+     * the capped catch-up). Until then the catch-up is limited to
+     * UNVERIFIED_CATCHUP_BYTES
+     */
+    bool verified;
+
+    /* Range of events [catchup_from, catchup_end) of the game with id
+     * catchup_game_id sent in the capped catch-up
+     */
+    uint32_t catchup_from;
+    uint32_t catchup_end;
+    uint32_t catchup_game_id;
+
+    /* Flag which indicates whether the player is a bot steered by the
+     * server (it has no address, nothing is sent to it and it never
+     * timeouts)
+     */
+    bool is_bot;
+
+    /* Time of receipt (in nanoseconds of the realtime clock) of the turn
+     * direction change which has not been reflected in any EVENT_PIXEL of
+     * the player sent yet, 0 if there is no such change
+     */
+    uint64_t turn_change_nanos;
+
+    /* Number, sum and maximum of the times (in nanoseconds) from receipt
+     * of the turn direction change to sending of the first EVENT_PIXEL of
+     * the player which follows it. Their distribution is kept only for
+     * the whole room (input_latency_histogram of the stats), so that
+     * the client stays small enough to be swapped when sorting
+     */
+    uint64_t input_latency_samples;
+    uint64_t input_latency_total;
+    uint64_t input_latency_max;
 };
 
 
@@ -234,12 +351,126 @@ struct game_params_t {
 };
 
 
+struct server_burst_t {
+    /* Consecutive datagrams packed one after another, exactly in
+     * the form in which they are sent to the clients
+     */
+    char buffer[MAX_BURST_SEGMENTS * MAX_SERVER_UDP_DGRAM_LENGTH];
+
+    /* Length of each of the packed datagrams
+     */
+    uint16_t lengths[MAX_BURST_SEGMENTS];
+
+    /* Number of the first event packed into each datagram, followed
+     * by the number of the first event which has not been packed
+     */
+    uint32_t first_events[MAX_BURST_SEGMENTS + 1];
+
+    /* Number of datagrams currently stored in the buffer
+     */
+    uint8_t segments_count;
+
+    /* Incremented each time the burst is packed anew, so that
+     * asynchronous backends know when their copy is outdated
+     */
+    uint32_t generation;
+};
+
+
+struct server_stats_t {
+    /* Number of rounds played
+     */
+    uint64_t rounds;
+
+    /* Number of sends which could not be completed because the server
+     * socket send buffer was full
+     */
+    uint64_t sends_would_block;
+
+    /* Number of datagrams put into outbound queues, and dropped from them
+     * (on overflow or when the game they belong to is over)
+     */
+    uint64_t datagrams_queued;
+    uint64_t datagrams_dropped;
+
+    /* Number of clients resynchronised after their events were dropped
+     */
+    uint64_t resyncs;
+
+    /* Number of datagrams dropped by the rate limiter before parsing
+     */
+    uint64_t datagrams_rate_limited;
+
+    /* Number of catch-ups limited for unverified addresses
+     */
+    uint64_t catchups_capped;
+
+    /* Number of client datagrams dropped because the simulation thread
+     * did not keep up with the I/O thread
+     */
+    uint64_t updates_dropped;
+
+    /* Time (in nanoseconds) spent on the rounds, and the part of it spent
+     * on steering the bots
+     */
+    uint64_t tick_nanos;
+    uint64_t bots_nanos;
+
+    /* Durations (in nanoseconds) of the rounds
+     */
+    histogram_t tick_histogram;
+
+    /* Deviations (in nanoseconds) of the intervals between the starts of
+     * consecutive rounds from the round period
+     */
+    histogram_t jitter_histogram;
+
+    /* Input latencies (in nanoseconds) of all the players of the room
+     */
+    histogram_t input_latency_histogram;
+};
+
+
+/* Set of operations through which the game logic performs its I/O.
+ * The default implementation (poll_backend) uses plain system calls
+ * and timer descriptors polled in the main loop, other backends may
+ * queue the operations and complete them asynchronously
+ */
+struct server_backend_t {
+    /* Sends total_size bytes of consecutive datagrams to the client with
+     * id passed as the second argument. Each datagram is segment_size
+     * long (except for the last one, which can be shorter); when total_size
+     * is equal to segment_size a single datagram is sent. Returns one of
+     * SEND_STATUS_ constants: SEND_STATUS_NO_SEGMENTATION if the datagrams
+     * could not be segmented by the kernel and SEND_STATUS_WOULD_BLOCK if
+     * the socket send buffer is full (nothing has been sent in both cases)
+     */
+    int (*send_datagrams)(server_game_state_t *, uint8_t, char *, size_t, uint16_t);
+
+    /* Starts (and stops) the periodic round timer of the game
+     */
+    void (*start_round_timer)(server_game_state_t *);
+    void (*stop_round_timer)(server_game_state_t *);
+
+    /* Starts (and stops) the 2 second timeout timer of the client
+     * with id passed as the second argument
+     */
+    void (*start_client_timer)(server_game_state_t *, uint8_t);
+    void (*stop_client_timer)(server_game_state_t *, uint8_t);
+};
+
+
 struct server_game_state_t {
     /* Descriptor of server UDP socket which handles
      * incoming connections from the clients
      */
     int32_t server_socket;
 
+    /* Number of the room hosting this game (selected by the clients
+     * in their datagrams, 0 when the server hosts a single game)
+     */
+    uint16_t room_id;
+
     /* Id of the currently played game
      */
     uint32_t game_id;
@@ -278,6 +509,41 @@ struct server_game_state_t {
      */
     char server_buffer[MAX_SERVER_UDP_DGRAM_LENGTH];
 
+    /* Datagrams which are about to be sent to the clients. Packed once
+     * and then sent to each of the recipients (possibly with a single
+     * call segmented by the kernel)
+     */
+    server_burst_t burst;
+
+    /* Flag which indicates whether the kernel accepts UDP_SEGMENT
+     * (generic segmentation offload) on the server socket. Cleared
+     * on the first failure so that the plain sendto path is used
+     */
+    bool gso_supported;
+
+    /* Counters of outbound queues activity
+     */
+    server_stats_t stats;
+
+    /* Number of statistics requests which have already been handled
+     * for this game
+     */
+    uint32_t stats_requests_handled;
+
+    /* Client from which draining of outbound queues starts next time
+     */
+    uint8_t outbound_first_client;
+
+    /* Time (in nanoseconds of the monotonic clock) of the start of the last
+     * round, 0 if the round timer has been stopped since then
+     */
+    uint64_t last_round_start;
+
+    /* Number of bots among the players. While there are any, the round
+     * timer runs also between the games (so that the bots can start them)
+     */
+    uint8_t bots_count;
+
     /* Parameters describing the game status at start (initial number of players)
      * and their original names - they are stored here since the ones in client_t
      * structures may vary depending on whether the client timeouts and some
@@ -315,11 +581,18 @@ struct server_game_state_t {
     /* Dynamic array which stores game history (all events of the game since its
      * beginning). When the size is not enough to fit a new event, its size is
      * being increased and the memory is reallocated to twice as big size as
-     * before reallocation
+     * before reallocation. The queue allocated from the arena has room for
+     * the longest possible game and is never reallocated, its pages are
+     * pre-faulted in chunks between the rounds, ahead of the events
      */
     event_data_t *events_queue;
     uint32_t events_queue_size;
 
+    /* Arena from which the state, the board and the event queue have been
+     * allocated (with NULL base if they have been allocated on the heap)
+     */
+    arena_t arena;
+
     /* Address and integer variable which are for handling incoming data
      * from UDP server sockets. Moreover they are used for identification
      * of the clients / detecting new connections
@@ -327,6 +600,12 @@ struct server_game_state_t {
     struct sockaddr_in6 receive_address;
     socklen_t receive_address_length;
 
+    /* Time of receipt (in nanoseconds of the realtime clock) of the datagram
+     * from receive_address, taken by the kernel when the socket provides
+     * receive timestamps
+     */
+    uint64_t receive_nanos;
+
     /* Structure containing data about timeout interval. Used when new player
      * to set timerfd for him (handles client 2s-timeouts)
      */
@@ -349,9 +628,31 @@ struct server_game_state_t {
      * specification
      */
     seed_status_t random;
+
+    /* Backend through which datagrams are sent and timers are handled,
+     * together with its private data (NULL for poll_backend)
+     */
+    const server_backend_t *backend;
+    void *backend_data;
+
+    /* Per source address token buckets checked before a datagram is
+     * parsed (NULL when disabled)
+     */
+    rate_limiter_t *rate_limiter;
+
+    /* Shared memory ring to which every broadcast event is published for
+     * consumers running on the same host (NULL when disabled)
+     */
+    event_ring_t *event_ring;
 };
 
 
+/* Default backend: synchronous sendto / sendmsg and timer descriptors
+ * stored in fds array of server_game_state_t structure
+ */
+extern const server_backend_t poll_backend;
+
+
 /* Function which generates random integer values according to the task
  * specification. Takes as parameter a pointer to seed_status_t structure
  * that is a component of server_game_state_t structure
@@ -373,6 +674,20 @@ void sort_players(server_game_state_t *);
 void enqueue_event(server_game_state_t *, event_data_t *);
 
 
+/* Returns the maximal number of events of a single game played on the
+ * board of given dimensions: every pixel event takes a free field of the
+ * board and every player is eliminated at most once
+ */
+uint32_t max_game_events(const game_params_t *);
+
+
+/* Serializes the event (second argument) of the queue to the buffer
+ * of given size in the form of the event record of the datagram. Returns
+ * the size of the record or -1 if it does not fit in the buffer
+ */
+ssize_t serialize_event_record(server_game_state_t *, uint32_t, char *, ssize_t);
+
+
 /* Broadcasts all events since specified event_no to the players
  * that are connected to the server
  */
@@ -386,6 +701,14 @@ void broadcast_events(server_game_state_t *, uint32_t);
 void send_game_data(server_game_state_t *, uint32_t, uint8_t);
 
 
+/* Sends the game data since specified event number (second argument) to
+ * the client with given id (third argument), but no more than the number of
+ * bytes passed as the fourth argument. Returns the number of the first
+ * event which has not been sent
+ */
+uint32_t send_limited_game_data(server_game_state_t *, uint32_t, uint8_t, size_t);
+
+
 /* Updates player statuses after the game has been finished. Some
  * fields are set to default values and some are changed depending
  * on the client state at the end of the game (including change of
@@ -414,4 +737,80 @@ void initiate_game(server_game_state_t *);
 ssize_t pack_events(server_game_state_t *, uint32_t, uint32_t *, ssize_t);
 
 
+/* Sends datagrams (third and fourth argument) through the socket to the
+ * given address, with plain sendto (single datagram) or with a single
+ * sendmsg call and UDP_SEGMENT control message set to the segment size
+ * (run of datagrams). Returns one of SEND_STATUS_* values
+ */
+int send_datagrams_to(int, const struct sockaddr_in6 *, socklen_t, char *, size_t, uint16_t);
+
+
+/* Packs as many datagrams as fit in the burst structure located in
+ * server_game_state_t, starting from event with number passed as the
+ * second argument. The number of the first event that has not been
+ * packed is stored in the integer to which the third argument points
+ */
+void pack_burst(server_game_state_t *, uint32_t, uint32_t *);
+
+
+/* Sends the datagrams currently stored in the burst to the client with
+ * id passed as the second argument. Runs of equally sized datagrams are
+ * passed to the kernel in a single call with UDP_SEGMENT set, the remaining
+ * ones (or all of them when segmentation offload is not supported) are
+ * sent one by one
+ */
+void send_burst(server_game_state_t *, uint8_t);
+
+
+/* Sends as many queued datagrams as possible (until the server socket
+ * send buffer becomes full again). Executed when the socket is writable
+ */
+void drain_outbound_queues(server_game_state_t *);
+
+
+/* Returns true if and only if any of the clients has datagrams waiting
+ * in its outbound queue
+ */
+bool outbound_backlog(server_game_state_t *);
+
+
+/* Drops the datagrams queued for the client with id passed as the second
+ * argument (used when the client slot is being released or reassigned)
+ */
+void reset_outbound_queue(server_game_state_t *, uint8_t);
+
+
+/* Marks the client with id passed as the second argument for
+ * resynchronisation after datagrams of the game with id passed as the third
+ * argument have been lost (on its next datagram the client gets the events
+ * again from the one it is waiting for). The first loss is remembered
+ */
+void mark_client_for_resync(server_game_state_t *, uint8_t, uint32_t);
+
+
+/* Queues the events since the number passed as the third argument for the
+ * client which needed resynchronisation (with id passed as the second
+ * argument)
+ */
+void resync_client(server_game_state_t *, uint8_t, uint32_t);
+
+
+/* Prints the counters of server activity to the standard error
+ */
+void print_server_stats(server_game_state_t *);
+
+
+/* Checks whether UDP generic segmentation offload can be used on the
+ * server socket and sets gso_supported flag accordingly
+ */
+void probe_udp_gso(server_game_state_t *);
+
+
+/* Asks the kernel to timestamp the datagrams received on the server socket
+ * (SO_TIMESTAMPNS). Without it the datagrams are timestamped when they are
+ * taken from the socket
+ */
+void enable_receive_timestamps(server_game_state_t *);
+
+
 #endif /* GAME_SERVER_PROTOCOL_H */
@@ -0,0 +1,74 @@
+#include <string.h>
+#include "histogram.h"
+
+
+/* Number of bits which select the bucket within a power of two range
+ */
+#define SUB_BUCKET_BITS                                   4
+
+
+static
+uint32_t bucket_index(uint64_t value) {
+    if(value < HISTOGRAM_SUB_BUCKETS) {
+        return value;
+    }
+
+    uint32_t magnitude = 63 - __builtin_clzll(value);
+    uint32_t sub_bucket = (value >> (magnitude - SUB_BUCKET_BITS)) & (HISTOGRAM_SUB_BUCKETS - 1);
+
+    return (magnitude - SUB_BUCKET_BITS + 1) * HISTOGRAM_SUB_BUCKETS + sub_bucket;
+}
+
+
+static
+uint64_t bucket_upper_bound(uint32_t index) {
+    if(index < HISTOGRAM_SUB_BUCKETS) {
+        return index;
+    }
+
+    uint32_t magnitude = index / HISTOGRAM_SUB_BUCKETS + SUB_BUCKET_BITS - 1;
+    uint64_t sub_bucket = index % HISTOGRAM_SUB_BUCKETS;
+    uint32_t shift = magnitude - SUB_BUCKET_BITS;
+
+    return ((HISTOGRAM_SUB_BUCKETS + sub_bucket + 1) << shift) - 1;
+}
+
+
+void histogram_reset(histogram_t *histogram) {
+    memset(histogram, 0, sizeof(histogram_t));
+}
+
+
+void histogram_record(histogram_t *histogram, uint64_t value) {
+    histogram->counts[bucket_index(value)]++;
+    histogram->total++;
+
+    if(value > histogram->max) {
+        histogram->max = value;
+    }
+}
+
+
+uint64_t histogram_percentile(const histogram_t *histogram, double percent) {
+    if(histogram->total == 0) {
+        return 0;
+    }
+
+    uint64_t rank = (uint64_t) (percent / 100 * histogram->total);
+    uint64_t counted = 0;
+
+    if(rank >= histogram->total) {
+        return histogram->max;
+    }
+
+    for(uint32_t i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+        counted += histogram->counts[i];
+
+        if(counted > rank) {
+            uint64_t upper_bound = bucket_upper_bound(i);
+            return upper_bound < histogram->max ? upper_bound : histogram->max;
+        }
+    }
+
+    return histogram->max;
+}
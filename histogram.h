@@ -0,0 +1,48 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+
+
+/* Every power of two range of values is split into this many buckets
+ * (so the value reported for a bucket is off by at most 1/16 of it)
+ */
+#define HISTOGRAM_SUB_BUCKETS                            16
+
+
+/* Number of buckets needed to cover all 64 bit values
+ */
+#define HISTOGRAM_BUCKETS                               976
+
+
+typedef struct histogram_t histogram_t;
+
+
+/* Histogram of durations (or any other 64 bit values) with logarithmic
+ * buckets, fixed size and no allocation on record
+ */
+struct histogram_t {
+    uint64_t counts[HISTOGRAM_BUCKETS];
+    uint64_t total;
+    uint64_t max;
+};
+
+
+/* Clears all the buckets
+ */
+void histogram_reset(histogram_t *);
+
+
+/* Counts the value passed as the second argument
+ */
+void histogram_record(histogram_t *, uint64_t);
+
+
+/* Returns the value below which given percent (second argument, from 0
+ * to 100) of the recorded values lies, rounded up to the upper bound of
+ * its bucket. Returns 0 for the empty histogram
+ */
+uint64_t histogram_percentile(const histogram_t *, double);
+
+
+#endif /* HISTOGRAM_H */
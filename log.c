@@ -0,0 +1,381 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "log.h"
+
+
+/* Maximal length of a single formatted record and size of the buffer in
+ * which the flushing thread collects records before writing them
+ */
+#define LOG_LINE_LENGTH                                 256
+#define LOG_BATCH_SIZE                                16384
+
+
+#define CACHE_LINE                                       64
+
+
+typedef struct log_record_t log_record_t;
+typedef struct log_ring_t log_ring_t;
+
+
+/* Slot of the ring. The sequence tells whose turn it is: the slot is free
+ * for the producer at position p when it is equal to p, and holds the record
+ * for the consumer when it is equal to p + 1
+ */
+struct log_record_t {
+    uint64_t sequence;
+
+    const char *format;
+    int64_t arguments[2];
+
+    /* Value of errno to be described after the message (0 if none)
+     */
+    int error;
+    int level;
+};
+
+
+/* Bounded ring with many producers (threads which log) and a single
+ * consumer (thread which flushes the records, serialised by the lock)
+ */
+struct log_ring_t {
+    uint64_t enqueue_position __attribute__((aligned(CACHE_LINE)));
+    uint64_t dequeue_position __attribute__((aligned(CACHE_LINE)));
+
+    /* Current second and the number of records accepted in it, and the
+     * numbers of records suppressed by the rate limit and dropped because
+     * the ring was full (since they were last reported)
+     */
+    uint64_t window __attribute__((aligned(CACHE_LINE)));
+    uint64_t window_count;
+    uint64_t suppressed;
+    uint64_t dropped;
+
+    int level;
+    bool started;
+
+    pthread_t thread;
+    pthread_mutex_t flush_lock;
+
+    log_record_t records[LOG_RING_CAPACITY];
+};
+
+
+static log_ring_t log_ring = {
+    .level = LOG_DEFAULT_LEVEL,
+    .flush_lock = PTHREAD_MUTEX_INITIALIZER
+};
+
+
+static const char *level_names[] = {"error", "warning", "info", "debug"};
+
+
+/* Formats the record into the buffer (at most LOG_LINE_LENGTH bytes, with
+ * the trailing newline) and returns its length
+ */
+static
+size_t format_record(const log_record_t *record, char *buffer) {
+    size_t length = 0;
+    int next_argument = 0;
+
+    length += snprintf(buffer, LOG_LINE_LENGTH, "%s: ", level_names[record->level]);
+
+    for(const char *c = record->format; *c != '\0' && length < LOG_LINE_LENGTH - 2; ++c) {
+        if(*c != '%') {
+            buffer[length++] = *c;
+            continue;
+        }
+
+        ++c;
+
+        while(*c == 'l') {
+            ++c;
+        }
+
+        int64_t argument = next_argument < 2 ? record->arguments[next_argument] : 0;
+        int written = 0;
+
+        switch(*c) {
+            case 'd':
+                written = snprintf(buffer + length, LOG_LINE_LENGTH - length, "%ld", (long) argument);
+                next_argument++;
+                break;
+            case 'u':
+                written = snprintf(buffer + length, LOG_LINE_LENGTH - length, "%lu",
+                                   (unsigned long) argument);
+                next_argument++;
+                break;
+            case 'x':
+                written = snprintf(buffer + length, LOG_LINE_LENGTH - length, "%lx",
+                                   (unsigned long) argument);
+                next_argument++;
+                break;
+            case '%':
+                buffer[length] = '%';
+                written = 1;
+                break;
+            default:
+                /* Unsupported conversion is dropped */
+                if(*c == '\0') {
+                    --c;
+                }
+                break;
+        }
+
+        length += written;
+    }
+
+    if(record->error != 0 && length < LOG_LINE_LENGTH - 2) {
+        char description[LOG_LINE_LENGTH];
+
+        if(strerror_r(record->error, description, sizeof(description)) != 0) {
+            snprintf(description, sizeof(description), "error %d", record->error);
+        }
+
+        length += snprintf(buffer + length, LOG_LINE_LENGTH - length, ": %s", description);
+    }
+
+    if(length > LOG_LINE_LENGTH - 1) {
+        length = LOG_LINE_LENGTH - 1;
+    }
+
+    buffer[length++] = '\n';
+
+    return length;
+}
+
+
+static
+void write_all(const char *buffer, size_t length) {
+    while(length > 0) {
+        ssize_t written = write(STDERR_FILENO, buffer, length);
+
+        if(written < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if(written <= 0) {
+            return;
+        }
+
+        buffer += written;
+        length -= written;
+    }
+}
+
+
+/* Reports the records lost since the last report */
+static
+size_t format_losses(char *buffer) {
+    uint64_t suppressed = __atomic_exchange_n(&log_ring.suppressed, 0, __ATOMIC_RELAXED);
+    uint64_t dropped = __atomic_exchange_n(&log_ring.dropped, 0, __ATOMIC_RELAXED);
+
+    if(suppressed == 0 && dropped == 0) {
+        return 0;
+    }
+
+    log_record_t record;
+    memset(&record, 0, sizeof(record));
+
+    record.level = LOG_WARNING;
+    record.format = "log records suppressed by rate limit: %lu, dropped on full ring: %lu";
+    record.arguments[0] = suppressed;
+    record.arguments[1] = dropped;
+
+    return format_record(&record, buffer);
+}
+
+
+/* Formats and writes all the records waiting in the ring. Returns false
+ * if there were none
+ */
+static
+bool drain_ring(void) {
+    char batch[LOG_BATCH_SIZE];
+    size_t length = 0;
+    bool drained = false;
+
+    pthread_mutex_lock(&log_ring.flush_lock);
+
+    while(1) {
+        uint64_t position = log_ring.dequeue_position;
+        log_record_t *record = &log_ring.records[position & (LOG_RING_CAPACITY - 1)];
+
+        if(__atomic_load_n(&record->sequence, __ATOMIC_ACQUIRE) != position + 1) {
+            break;
+        }
+
+        if(length + LOG_LINE_LENGTH > sizeof(batch)) {
+            write_all(batch, length);
+            length = 0;
+        }
+
+        length += format_record(record, batch + length);
+
+        __atomic_store_n(&record->sequence, position + LOG_RING_CAPACITY, __ATOMIC_RELEASE);
+        log_ring.dequeue_position = position + 1;
+
+        drained = true;
+    }
+
+    if(length + LOG_LINE_LENGTH > sizeof(batch)) {
+        write_all(batch, length);
+        length = 0;
+    }
+
+    length += format_losses(batch + length);
+
+    if(length > 0) {
+        write_all(batch, length);
+    }
+
+    pthread_mutex_unlock(&log_ring.flush_lock);
+
+    return drained;
+}
+
+
+static
+void *run_flush_thread(void *argument) {
+    (void) argument;
+
+    struct timespec interval = {0, LOG_FLUSH_INTERVAL_MILLIS * 1000000L};
+
+    while(1) {
+        if(!drain_ring()) {
+            nanosleep(&interval, NULL);
+        }
+    }
+
+    return NULL;
+}
+
+
+bool log_start(int level) {
+    log_ring.level = level;
+
+    for(uint64_t i = 0; i < LOG_RING_CAPACITY; ++i) {
+        log_ring.records[i].sequence = i;
+    }
+
+    log_ring.enqueue_position = 0;
+    log_ring.dequeue_position = 0;
+
+    /* Signals are handled by the threads which run the game */
+    sigset_t blocked_signals;
+    sigset_t previous_signals;
+
+    sigfillset(&blocked_signals);
+    pthread_sigmask(SIG_BLOCK, &blocked_signals, &previous_signals);
+
+    int err = pthread_create(&log_ring.thread, NULL, run_flush_thread, NULL);
+
+    pthread_sigmask(SIG_SETMASK, &previous_signals, NULL);
+
+    if(err != 0) {
+        errno = err;
+        perror("pthread_create");
+        return false;
+    }
+
+    __atomic_store_n(&log_ring.started, true, __ATOMIC_RELEASE);
+
+    atexit(log_flush);
+
+    return true;
+}
+
+
+void log_flush(void) {
+    if(__atomic_load_n(&log_ring.started, __ATOMIC_ACQUIRE)) {
+        while(drain_ring()) {
+        }
+    }
+}
+
+
+/* Checks the rate limit of the current second */
+static
+bool within_rate_limit(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+
+    uint64_t second = now.tv_sec;
+    uint64_t window = __atomic_load_n(&log_ring.window, __ATOMIC_RELAXED);
+
+    if(window != second &&
+       __atomic_compare_exchange_n(&log_ring.window, &window, second, false,
+                                   __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+
+        __atomic_store_n(&log_ring.window_count, 0, __ATOMIC_RELAXED);
+    }
+
+    return __atomic_fetch_add(&log_ring.window_count, 1, __ATOMIC_RELAXED) < LOG_RATE_LIMIT;
+}
+
+
+static
+void log_write(int level, int error, const char *format, int64_t first, int64_t second) {
+    if(level > log_ring.level) {
+        return;
+    }
+
+    if(!__atomic_load_n(&log_ring.started, __ATOMIC_ACQUIRE)) {
+        char buffer[LOG_LINE_LENGTH];
+        log_record_t record = {0, format, {first, second}, error, level};
+
+        write_all(buffer, format_record(&record, buffer));
+        return;
+    }
+
+    if(!within_rate_limit()) {
+        __atomic_fetch_add(&log_ring.suppressed, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    uint64_t position = __atomic_load_n(&log_ring.enqueue_position, __ATOMIC_RELAXED);
+    log_record_t *record;
+
+    while(1) {
+        record = &log_ring.records[position & (LOG_RING_CAPACITY - 1)];
+
+        int64_t difference = (int64_t) (__atomic_load_n(&record->sequence, __ATOMIC_ACQUIRE) - position);
+
+        if(difference == 0) {
+            if(__atomic_compare_exchange_n(&log_ring.enqueue_position, &position, position + 1, true,
+                                           __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        }
+        else if(difference < 0) {
+            __atomic_fetch_add(&log_ring.dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        else {
+            position = __atomic_load_n(&log_ring.enqueue_position, __ATOMIC_RELAXED);
+        }
+    }
+
+    record->format = format;
+    record->arguments[0] = first;
+    record->arguments[1] = second;
+    record->error = error;
+    record->level = level;
+
+    __atomic_store_n(&record->sequence, position + 1, __ATOMIC_RELEASE);
+}
+
+
+void log_message(int level, const char *format, int64_t first, int64_t second) {
+    log_write(level, 0, format, first, second);
+}
+
+
+void log_error(int level, const char *operation) {
+    log_write(level, errno, operation, 0, 0);
+}
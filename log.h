@@ -0,0 +1,68 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/* Levels of the log records, records above the level set in log_start
+ * are dropped right at the call
+ */
+#define LOG_ERROR                                         0
+#define LOG_WARNING                                       1
+#define LOG_INFO                                          2
+#define LOG_DEBUG                                         3
+
+
+/* Level used until log_start is called with another one
+ */
+#define LOG_DEFAULT_LEVEL                          LOG_INFO
+
+
+/* Number of records which fit in the ring between the producers and
+ * the flushing thread (has to be a power of two)
+ */
+#define LOG_RING_CAPACITY                              4096
+
+
+/* Maximal number of records accepted per second, the rest is counted
+ * and reported by the flushing thread
+ */
+#define LOG_RATE_LIMIT                                 1000
+
+
+/* Time (in milliseconds) for which the flushing thread sleeps when the
+ * ring is empty
+ */
+#define LOG_FLUSH_INTERVAL_MILLIS                        10
+
+
+/* Starts the thread which formats the records and writes them to the
+ * standard error output. Until then (and in the programs which never
+ * call it) the records are written synchronously by the calling thread.
+ * Returns false on failure
+ */
+bool log_start(int);
+
+
+/* Writes the records still waiting in the ring. Called at exit
+ */
+void log_flush(void);
+
+
+/* Logs the message of given level. The message is formatted by the
+ * flushing thread, so the format has to be a string literal and may only
+ * contain integer conversions (%d, %u, %ld, %lu, %x) of the two integer
+ * arguments which follow it
+ */
+void log_message(int, const char *, int64_t, int64_t);
+
+
+/* Logs the error of the operation named by the second argument together
+ * with the description of the current errno, like perror (the name has
+ * to be a string literal)
+ */
+void log_error(int, const char *);
+
+
+#endif /* LOG_H */
@@ -0,0 +1,110 @@
+#include <string.h>
+#include "rate_limiter.h"
+
+
+#define TOKEN_SCALE                                    1000
+#define NANOS_PER_TOKEN_UNIT     (1000000000ULL / (RATE_LIMIT_TOKENS_PER_SEC * TOKEN_SCALE))
+#define RATE_LIMIT_SETS_COUNT    (RATE_LIMIT_TABLE_SIZE / RATE_LIMIT_SET_SIZE)
+
+
+/* Returns the address the bucket is kept for: IPv4 (mapped) addresses
+ * as they are, IPv6 addresses cut down to the /64 prefix, as any host
+ * gets the whole prefix to spoof from
+ */
+static
+struct in6_addr bucket_address(const struct sockaddr_in6 *address) {
+    struct in6_addr key = address->sin6_addr;
+
+    if(!IN6_IS_ADDR_V4MAPPED(&key)) {
+        memset(key.s6_addr + 8, 0, 8);
+    }
+
+    return key;
+}
+
+
+static
+uint32_t hash_address(const struct in6_addr *address) {
+    const uint8_t *bytes = address->s6_addr;
+    uint32_t hash = 2166136261U;
+
+    for(size_t i = 0; i < sizeof(address->s6_addr); ++i) {
+        hash = (hash ^ bytes[i]) * 16777619U;
+    }
+
+    return hash;
+}
+
+
+static
+void refill(rate_bucket_t *bucket, uint64_t now) {
+    uint64_t elapsed = now - bucket->last_refill;
+    uint64_t tokens = bucket->tokens + elapsed / NANOS_PER_TOKEN_UNIT;
+
+    if(tokens > RATE_LIMIT_BURST * TOKEN_SCALE) {
+        tokens = RATE_LIMIT_BURST * TOKEN_SCALE;
+    }
+
+    bucket->tokens = tokens;
+    bucket->last_refill = now;
+}
+
+
+/* Returns the bucket of the address in its set, or a free or idle bucket
+ * of the set handed over to the address, or NULL if all the buckets of
+ * the set are in use
+ */
+static
+rate_bucket_t *find_bucket(rate_limiter_t *limiter, const struct in6_addr *address, uint64_t now) {
+    uint32_t set = hash_address(address) & (RATE_LIMIT_SETS_COUNT - 1);
+    rate_bucket_t *buckets = &limiter->buckets[set * RATE_LIMIT_SET_SIZE];
+    rate_bucket_t *replaced = NULL;
+
+    for(size_t i = 0; i < RATE_LIMIT_SET_SIZE; ++i) {
+        rate_bucket_t *bucket = &buckets[i];
+
+        if(!bucket->used) {
+            if(replaced == NULL || replaced->used) {
+                replaced = bucket;
+            }
+        }
+        else if(memcmp(&bucket->address, address, sizeof(struct in6_addr)) == 0) {
+            refill(bucket, now);
+            return bucket;
+        }
+        else if(now - bucket->last_refill >= RATE_LIMIT_IDLE_NANOS &&
+                (replaced == NULL || (replaced->used && bucket->last_refill < replaced->last_refill))) {
+            replaced = bucket;
+        }
+    }
+
+    if(replaced != NULL) {
+        replaced->address = *address;
+        replaced->tokens = RATE_LIMIT_BURST * TOKEN_SCALE;
+        replaced->last_refill = now;
+        replaced->used = true;
+    }
+
+    return replaced;
+}
+
+
+void initialise_rate_limiter(rate_limiter_t *limiter) {
+    memset(limiter, 0, sizeof(rate_limiter_t));
+}
+
+
+bool rate_limiter_allow(rate_limiter_t *limiter,
+                        const struct sockaddr_in6 *address,
+                        uint64_t now) {
+
+    struct in6_addr key = bucket_address(address);
+    rate_bucket_t *bucket = find_bucket(limiter, &key, now);
+
+    if(bucket == NULL || bucket->tokens < TOKEN_SCALE) {
+        return false;
+    }
+
+    bucket->tokens -= TOKEN_SCALE;
+    return true;
+}
@@ -0,0 +1,74 @@
+#ifndef RATE_LIMITER_H
+#define RATE_LIMITER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <arpa/inet.h>
+
+
+/* Number of token buckets kept by the rate limiter and the number of
+ * buckets in a set (both have to be powers of two). Addresses are mapped
+ * to sets by hash, without any dynamic allocation, and take any bucket of
+ * their set
+ */
+#define RATE_LIMIT_TABLE_SIZE                          1024
+#define RATE_LIMIT_SET_SIZE                               4
+
+
+/* Number of nanoseconds after which the bucket of an address which sent
+ * nothing in the meantime can be given to another address (regular
+ * client is never idle that long)
+ */
+#define RATE_LIMIT_IDLE_NANOS                    1000000000ULL
+
+
+/* Number of datagrams per second which can be sent from a single address
+ * (regular client sends one datagram every 30ms) and the maximal number
+ * of datagrams in a burst
+ */
+#define RATE_LIMIT_TOKENS_PER_SEC                       100
+#define RATE_LIMIT_BURST                                 50
+
+
+typedef struct rate_bucket_t rate_bucket_t;
+typedef struct rate_limiter_t rate_limiter_t;
+
+
+struct rate_bucket_t {
+    /* Address the bucket currently belongs to (only the /64 prefix
+     * of IPv6 addresses other than IPv4-mapped ones)
+     */
+    struct in6_addr address;
+
+    bool used;
+
+    /* Number of tokens (in thousandths of token) and the time of the last
+     * refill (that is of the last datagram) in nanoseconds
+     */
+    uint32_t tokens;
+    uint64_t last_refill;
+};
+
+
+struct rate_limiter_t {
+    rate_bucket_t buckets[RATE_LIMIT_TABLE_SIZE];
+};
+
+
+/* Empties the table of buckets
+ */
+void initialise_rate_limiter(rate_limiter_t *);
+
+
+/* Takes one token from the bucket of the address passed as the second
+ * argument, refilling it first according to the time (in nanoseconds)
+ * passed as the third argument. Ports are not taken into account and IPv6
+ * addresses share the bucket of their /64 prefix. An address without
+ * a bucket takes a free one or one idle for RATE_LIMIT_IDLE_NANOS in its
+ * set, if there is none only its datagram is dropped. Returns false if
+ * the datagram should be dropped
+ */
+bool rate_limiter_allow(rate_limiter_t *, const struct sockaddr_in6 *, uint64_t);
+
+
+#endif /* RATE_LIMITER_H */
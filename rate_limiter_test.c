@@ -0,0 +1,186 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include "rate_limiter.h"
+
+
+/* Checks that the rate limiter keeps letting through a regular client
+ * (one datagram every 30ms) while it is flooded with datagrams from
+ * spoofed addresses, that it limits the whole /64 prefix of an IPv6
+ * address and that an address idle for long enough gives its bucket away.
+ * Time is simulated, the test takes no time
+ */
+
+
+#define NANOS_PER_MSEC                               1000000ULL
+#define CLIENT_INTERVAL_NANOS                   (30 * NANOS_PER_MSEC)
+#define FLOOD_DATAGRAMS_PER_MSEC                        200
+#define TEST_DURATION_MSEC                            10000
+
+
+static int failures = 0;
+
+
+static
+void check(bool condition, const char *description) {
+    if(!condition) {
+        fprintf(stderr, "FAILED: %s\n", description);
+        failures++;
+    }
+}
+
+
+static
+struct sockaddr_in6 ipv4_address(uint32_t ipv4, uint16_t port) {
+    struct sockaddr_in6 address;
+    memset(&address, 0, sizeof(address));
+
+    address.sin6_family = AF_INET6;
+    address.sin6_port = htons(port);
+    address.sin6_addr.s6_addr[10] = 0xFF;
+    address.sin6_addr.s6_addr[11] = 0xFF;
+    ipv4 = htonl(ipv4);
+    memcpy(address.sin6_addr.s6_addr + 12, &ipv4, 4);
+
+    return address;
+}
+
+
+static
+struct sockaddr_in6 ipv6_address(uint64_t prefix, uint64_t interface, uint16_t port) {
+    struct sockaddr_in6 address;
+    memset(&address, 0, sizeof(address));
+
+    address.sin6_family = AF_INET6;
+    address.sin6_port = htons(port);
+
+    for(int i = 0; i < 8; ++i) {
+        address.sin6_addr.s6_addr[i] = prefix >> (56 - 8 * i);
+        address.sin6_addr.s6_addr[8 + i] = interface >> (56 - 8 * i);
+    }
+
+    return address;
+}
+
+
+/* Sends the datagrams of the client every 30ms and a flood of datagrams
+ * from random addresses (random ports as well) in between, returns the
+ * number of datagrams of the client which were dropped
+ */
+static
+uint32_t flood(rate_limiter_t *limiter, const struct sockaddr_in6 *client,
+               bool ipv6_flood, uint64_t start) {
+
+    uint32_t dropped = 0;
+    uint64_t next_client_datagram = start;
+
+    for(uint64_t msec = 0; msec < TEST_DURATION_MSEC; ++msec) {
+        uint64_t now = start + msec * NANOS_PER_MSEC;
+
+        for(int i = 0; i < FLOOD_DATAGRAMS_PER_MSEC; ++i) {
+            uint64_t random = ((uint64_t) rand() << 32) ^ rand();
+            struct sockaddr_in6 spoofed = ipv6_flood ?
+                                          ipv6_address(random, random * 31, rand()) :
+                                          ipv4_address(random, rand());
+
+            rate_limiter_allow(limiter, &spoofed, now);
+        }
+
+        if(now >= next_client_datagram) {
+            if(!rate_limiter_allow(limiter, client, now)) {
+                dropped++;
+            }
+
+            next_client_datagram += CLIENT_INTERVAL_NANOS;
+        }
+    }
+
+    return dropped;
+}
+
+
+static
+void test_flood_does_not_starve_client(bool ipv6_flood) {
+    static rate_limiter_t limiter;
+    initialise_rate_limiter(&limiter);
+
+    struct sockaddr_in6 client = ipv4_address(0x0A000001, 2021);
+    uint64_t start = 1000 * NANOS_PER_MSEC;
+
+    /* The client is established before the flood starts
+     */
+    check(rate_limiter_allow(&limiter, &client, start), "first datagram of the client is allowed");
+
+    uint32_t dropped = flood(&limiter, &client, ipv6_flood, start + CLIENT_INTERVAL_NANOS);
+
+    check(dropped == 0, ipv6_flood ? "IPv6 flood drops no datagram of the client" :
+                                     "IPv4 flood drops no datagram of the client");
+}
+
+
+static
+void test_prefix_is_limited(void) {
+    static rate_limiter_t limiter;
+    initialise_rate_limiter(&limiter);
+
+    uint64_t now = 1000 * NANOS_PER_MSEC;
+    uint32_t allowed = 0;
+
+    /* Every datagram from another address (and port) of the same /64
+     * takes a token from the same bucket
+     */
+    for(uint32_t i = 0; i < 1000; ++i) {
+        struct sockaddr_in6 address = ipv6_address(0x20010DB800000001ULL, i + 1, i);
+
+        if(rate_limiter_allow(&limiter, &address, now)) {
+            allowed++;
+        }
+    }
+
+    check(allowed == RATE_LIMIT_BURST, "burst of a /64 prefix is limited");
+}
+
+
+static
+void test_idle_bucket_is_reused(void) {
+    static rate_limiter_t limiter;
+    initialise_rate_limiter(&limiter);
+
+    uint64_t now = 1000 * NANOS_PER_MSEC;
+
+    /* Fills every bucket of every set with an address
+     */
+    for(uint32_t i = 0; i < 1000000; ++i) {
+        struct sockaddr_in6 address = ipv4_address(i, 1);
+        rate_limiter_allow(&limiter, &address, now);
+    }
+
+    struct sockaddr_in6 newcomer = ipv4_address(0xC0A80001, 2021);
+
+    check(!rate_limiter_allow(&limiter, &newcomer, now + 1),
+          "newcomer is dropped while its set is in use");
+    check(rate_limiter_allow(&limiter, &newcomer, now + RATE_LIMIT_IDLE_NANOS),
+          "newcomer takes a bucket idle for long enough");
+}
+
+
+int main(void) {
+    srand(2021);
+
+    test_flood_does_not_starve_client(false);
+    test_flood_does_not_starve_client(true);
+    test_prefix_is_limited();
+    test_idle_bucket_is_reused();
+
+    if(failures > 0) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+
+    printf("rate limiter: all checks passed\n");
+
+    return 0;
+}
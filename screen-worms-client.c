@@ -1,3 +1,5 @@
+#define _GNU_SOURCE
+
 #include <arpa/inet.h>
 #include <stdio.h>
 #include <stdbool.h>
@@ -12,7 +14,11 @@
 #include <sys/timerfd.h>
 #include <sys/time.h>
 #include <errno.h>
+#include <signal.h>
+#include <time.h>
 #include <netinet/tcp.h>
+#include "capture.h"
+#include "client_prediction.h"
 #include "client_protocol.h"
 #include "game_server_protocol.h"
 #include "utils.h"
@@ -23,6 +29,9 @@ static char *server_address = "";
 static char *server_port = "2021";
 static char *gui_address = "localhost";
 static char *gui_port = "20210";
+static char *room = "0";
+static char *turning_speed = "0";
+static char *capture_file_name = NULL;
 
 
 /* Static buffer for storing serialized data
@@ -31,15 +40,78 @@ static char *gui_port = "20210";
 static char client_dgram_buffer[CLIENT_DGRAM_BUFFER_SIZE];
 
 
-/* Static buffer for storing data sent in UDP
- * datagram from game server to the client
+/* Static buffers for storing data sent in UDP datagrams from game server
+ * to the client, filled by a single recvmmsg call (one byte longer than
+ * the longest datagram, so that a longer one can be recognised)
+ */
+static char server_dgram_buffers[SERVER_RECEIVE_BATCH][MAX_SERVER_UDP_DGRAM_LENGTH + 1];
+static struct iovec server_dgram_iovecs[SERVER_RECEIVE_BATCH];
+static struct mmsghdr server_dgram_headers[SERVER_RECEIVE_BATCH];
+static char server_dgram_controls[SERVER_RECEIVE_BATCH][CMSG_SPACE(sizeof(struct timespec))];
+
+
+/* Numbers of datagrams received from the game server and of the poll
+ * wakeups which drained them
+ */
+static uint64_t server_dgrams_received = 0;
+static uint64_t server_dgram_wakeups = 0;
+
+
+/* Messages for the GUI server produced since the last flush. They are
+ * written with a single call at the end of each poll wakeup (so that
+ * a datagram full of events does not become a TCP segment per event)
+ */
+static char gui_output_buffer[GUI_OUTPUT_BUFFER_LENGTH];
+static size_t gui_output_length = 0;
+
+
+/* Receive time (in nanoseconds of the realtime clock, as the kernel
+ * timestamps) of the datagram being decoded and of the oldest datagram
+ * whose messages wait for the GUI server (0 if none waits). Times from
+ * the receipt of the oldest datagram to the end of the write of its
+ * messages go to the histogram
+ */
+static uint64_t server_dgram_receive_nanos = 0;
+static uint64_t gui_output_receive_nanos = 0;
+static histogram_t gui_output_latency_histogram;
+
+
+/* Prediction of the own worm, the predicted pixels are sent to the GUI
+ * server ahead of the ones from the game server (static because of the
+ * size of its board)
+ */
+static client_prediction_t prediction;
+
+
+/* Messages of the current game which come from the game server (starting
+ * with NEW_GAME), kept only with the prediction. The GUI server cannot
+ * erase a pixel, so a game with a wrong predicted pixel is repainted by
+ * sending them again
+ */
+static char *gui_history = NULL;
+static size_t gui_history_length = 0;
+static size_t gui_history_size = 0;
+
+
+/* Length of the history to be sent again by the pending repaint (the
+ * history as it was when the wrong pixel was found last)
  */
-static char server_dgram_buffer[MAX_SERVER_UDP_DGRAM_LENGTH + 1];
+static size_t gui_repaint_length = 0;
 
 
-static char client_to_gui_buffer[MSG_GUI_BUFFER_LENGTH];
-static char partial_gui_msg[PARTIAL_MSG_BUFFER_LENGTH];
-static ssize_t partial_gui_msg_length;
+/* Capture of the datagrams received from the game server (NULL if they
+ * are not captured)
+ */
+static capture_t *capture = NULL;
+
+
+/* Data read from the GUI server, starting with the unfinished line left
+ * from the previous read. The rest of a line which is too long to be any
+ * of the messages is skipped
+ */
+static char gui_input_buffer[GUI_INPUT_BUFFER_LENGTH];
+static size_t gui_input_length = 0;
+static bool gui_input_skipping = false;
 
 
 /* Static structures for resolving addresses
@@ -63,10 +135,18 @@ static uint64_t player_session_id;
 static bool continue_working = true;
 
 
+/* Set by SIGUSR1 handler, the input latency and the statistics of the
+ * reorder buffer and of receiving are printed by the main loop
+ */
+static volatile sig_atomic_t stats_requested = 0;
+
+
 static
 void print_program_usage(const char *program_name) {
 	fprintf(stderr, "Usage: %s game_server_address [-n player_name] [-p game_server_port] "
-                   "[-i gui_server_address] [-r gui_server_port]\n", program_name);
+                   "[-i gui_server_address] [-r gui_server_port] [-g room] "
+                   "[-t turning speed of the game server (enables prediction)] "
+                   "[-c capture file]\n", program_name);
 }
 
 
@@ -74,7 +154,7 @@ static
 void parse_program_arguments(int argc, char *argv[]) {
 	int option = 0;
 	
-	while((option = getopt(argc, argv + 1, "n:p:i:r:")) != -1) {
+	while((option = getopt(argc, argv + 1, "n:p:i:r:g:t:c:")) != -1) {
 		switch(option) {
 			case 'n':
 				player_name = optarg;
@@ -88,6 +168,15 @@ void parse_program_arguments(int argc, char *argv[]) {
 			case 'r':
 				gui_port = optarg;
 				break;
+			case 'g':
+				room = optarg;
+				break;
+			case 't':
+				turning_speed = optarg;
+				break;
+			case 'c':
+				capture_file_name = optarg;
+				break;
 			default:
 				print_program_usage(argv[0]);
 				exit(1);
@@ -96,6 +185,83 @@ void parse_program_arguments(int argc, char *argv[]) {
 }
 
 
+static
+void handle_stats_signal(int signal_number) {
+    (void) signal_number;
+    stats_requested = 1;
+}
+
+
+static
+void print_input_latency(const client_game_state_t *state) {
+    const histogram_t *histogram = &state->input_latency_histogram;
+
+    fprintf(stderr, "input latency (GUI key to send) samples: %lu, "
+                    "p50: %lu us, p99: %lu us, p99.9: %lu us, max: %lu us, "
+                    "immediate datagrams: %lu, delayed by the limit: %lu\n",
+            histogram->total,
+            histogram_percentile(histogram, 50) / 1000,
+            histogram_percentile(histogram, 99) / 1000,
+            histogram_percentile(histogram, 99.9) / 1000,
+            histogram->max / 1000,
+            state->input_datagrams,
+            state->input_datagrams_delayed);
+}
+
+
+static
+void print_receive_stats(void) {
+    const histogram_t *histogram = &gui_output_latency_histogram;
+
+    fprintf(stderr, "server datagrams: %lu, poll wakeups draining them: %lu\n",
+            server_dgrams_received,
+            server_dgram_wakeups);
+
+    if(capture != NULL) {
+        fprintf(stderr, "captured datagrams: %lu (%lu bytes of records)\n",
+                capture->header->records_count,
+                capture->header->data_length);
+    }
+
+    fprintf(stderr, "GUI output latency (datagram receipt to GUI write) writes: %lu, "
+                    "p50: %lu us, p99: %lu us, p99.9: %lu us, max: %lu us\n",
+            histogram->total,
+            histogram_percentile(histogram, 50) / 1000,
+            histogram_percentile(histogram, 99) / 1000,
+            histogram_percentile(histogram, 99.9) / 1000,
+            histogram->max / 1000);
+}
+
+
+static
+void print_prediction_stats(void) {
+    fprintf(stderr, "prediction pixels predicted: %lu, checked: %lu, correct: %lu, tracking lost: %lu, "
+                    "repaints: %lu, error p50: %lu px, p99: %lu px, max: %lu px, "
+                    "lead of correct p50: %lu us, p99: %lu us\n",
+            prediction.pixels_predicted,
+            prediction.error_histogram.total,
+            prediction.pixels_correct,
+            prediction.tracking_lost,
+            prediction.repaints,
+            histogram_percentile(&prediction.error_histogram, 50),
+            histogram_percentile(&prediction.error_histogram, 99),
+            prediction.error_histogram.max,
+            histogram_percentile(&prediction.lead_histogram, 50) / 1000,
+            histogram_percentile(&prediction.lead_histogram, 99) / 1000);
+}
+
+
+static
+void print_reorder_stats(const client_game_state_t *state) {
+    fprintf(stderr, "reorder buffer events held: %lu, released in order: %lu, "
+                    "dropped (too far ahead): %lu, waiting: %u\n",
+            state->reorder_stats.held,
+            state->reorder_stats.released,
+            state->reorder_stats.dropped,
+            state->reordered_count);
+}
+
+
 static
 void check_getaddrinfo(int ret_val) {
     if(ret_val == EAI_SYSTEM) { /* system error */
@@ -146,9 +312,7 @@ void handle_keepalive(client_dgram_t  *data, client_game_state_t *state) {
      * client_dgram_buffer so as to send this data to the game
      * server
      */
-    serialize_client_dgram(data, strlen(player_name), client_dgram_buffer);
-
-    ssize_t datagram_len = CLIENT_DGRAM_INTEGERS_LEN + strlen(player_name);
+    ssize_t datagram_len = serialize_client_dgram(data, strlen(player_name), client_dgram_buffer);
 
     ssize_t ret_val = sendto(state->server_socket,
                             client_dgram_buffer,
@@ -159,169 +323,427 @@ void handle_keepalive(client_dgram_t  *data, client_game_state_t *state) {
 
     if(ret_val != datagram_len) {
         perror("sendto");
+        return;
+    }
+
+    state->sent_turn_direction = data->turn_direction;
+
+    if(state->turn_change_nanos != 0) {
+        histogram_record(&state->input_latency_histogram, monotonic_nanos() - state->turn_change_nanos);
+        state->turn_change_nanos = 0;
     }
 }
 
 
-/* Function which handles getting information about events data
- * obtained from the game server
+/* Sends the datagram right after a change of the turn direction, unless the
+ * previous such datagram has been sent less than
+ * MIN_INPUT_DGRAM_INTERVAL_NANOS ago. The regular datagrams continue
+ * KEEPALIVE_INTERVAL_NANOS after it.
+ * Returns the time (in milliseconds, for poll) after which the delayed
+ * change should be sent or -1 if nothing waits
  */
 static
-void handle_server_message(client_game_state_t *state) {
-    ssize_t read_bytes = recvfrom(state->server_socket,
-                                  server_dgram_buffer,
-                                  sizeof(server_dgram_buffer),
-                                  0,
-                                  addr_result_server->ai_addr,
-                                  &addr_result_server->ai_addrlen);
-
-    if(read_bytes > MAX_SERVER_UDP_DGRAM_LENGTH) {
-        return;
+int send_turn_change(client_dgram_t *data, client_game_state_t *state, int timer_fd) {
+    if(state->client_turn_direction == state->sent_turn_direction) {
+        state->input_dgram_delayed = false;
+        return -1;
     }
 
-    if(read_bytes < 0) {
-        perror("recvfrom");
-        exit(1);
+    uint64_t now = monotonic_nanos();
+    uint64_t since_send = now - state->last_input_dgram_nanos;
+
+    if(since_send < MIN_INPUT_DGRAM_INTERVAL_NANOS) {
+        uint64_t wait_nanos = MIN_INPUT_DGRAM_INTERVAL_NANOS - since_send;
+
+        if(!state->input_dgram_delayed) {
+            state->input_dgram_delayed = true;
+            state->input_datagrams_delayed++;
+        }
+
+        return (int) ((wait_nanos + 999999) / 1000000);
     }
-    else if(read_bytes < MIN_SERVER_UDP_DGRAM_LENGTH) {
-        fprintf(stderr, "Datagram length lower than minimal expected\n");
-        return;
+
+    handle_keepalive(data, state);
+    state->last_input_dgram_nanos = now;
+    state->input_datagrams++;
+    state->input_dgram_delayed = false;
+
+    struct itimerspec spec = {
+        { 0, KEEPALIVE_INTERVAL_NANOS },
+        { 0, KEEPALIVE_INTERVAL_NANOS }
+    };
+
+    if(timerfd_settime(timer_fd, 0, &spec, NULL) < 0) {
+        perror("timerfd_settime");
     }
 
-    uint32_t received_game_id = *(uint32_t *) server_dgram_buffer;
+    return -1;
+}
 
-    if(received_game_id != state->game_id || !state->played_any) {
-        if(state->game_over) {
-            state->game_id = received_game_id;
-            state->next_expected = 0;
-            state->players_count = 0;
 
-            state->played_any = true;
-            state->game_over = false;
+static
+void write_gui(client_game_state_t *state, const char *buffer, size_t length) {
+    size_t written = 0;
+
+    while(written < length) {
+        ssize_t ret_write = write(state->gui_socket, buffer + written, length - written);
 
-            for(uint8_t i = 0; i < MAX_PLAYERS; ++i) {
-                state->is_alive[i] = true;
+        if(ret_write < 0) {
+            if(errno == EINTR) {
+                continue;
             }
+
+            perror("write");
+            exit(1);
         }
-        else {
-            return;
+
+        written += ret_write;
+    }
+}
+
+
+/* Writes the messages collected for the GUI server to its socket, after
+ * the repaint of the game if a predicted pixel has turned out to be wrong.
+ * The repaint replaces the picture of the GUI server (with the wrong
+ * predicted pixels) by the game as received from the game server so far
+ */
+static
+void flush_gui_output(client_game_state_t *state) {
+    if(prediction.repaint_needed) {
+        write_gui(state, gui_history, gui_repaint_length);
+
+        prediction.repaint_needed = false;
+        prediction.repaints++;
+    }
+
+    write_gui(state, gui_output_buffer, gui_output_length);
+
+    gui_output_length = 0;
+
+    if(gui_output_receive_nanos != 0) {
+        uint64_t now = realtime_nanos();
+
+        if(now > gui_output_receive_nanos) {
+            histogram_record(&gui_output_latency_histogram, now - gui_output_receive_nanos);
         }
+
+        gui_output_receive_nanos = 0;
     }
+}
 
-    bool continue_parsing = true;
-    ssize_t remaining_bytes = read_bytes - 4;
-    ssize_t ret_val;
-    ssize_t buffer_offset = 4;
 
-    while(continue_parsing) {
-        ret_val = deserialize_event_record(state,
-                                           server_dgram_buffer + buffer_offset,
-                                           remaining_bytes);
+/* Keeps the message (just prepared from the event of the game server) in
+ * the history of the game
+ */
+static
+void append_gui_history(const char *message, size_t length, bool new_game) {
+    if(new_game) {
+        gui_history_length = 0;
+    }
 
-        if(ret_val == -1) {
-            break;
+    if(gui_history_length + length > gui_history_size) {
+        size_t new_size = gui_history_size > 0 ? 2 * gui_history_size : GUI_OUTPUT_BUFFER_LENGTH;
+
+        while(gui_history_length + length > new_size) {
+            new_size *= 2;
         }
-        else if(ret_val == -2) {
-            fprintf(stderr, "Strange data from game server... terminating\n");
+
+        char *realloc_ptr = realloc(gui_history, new_size);
+
+        if(realloc_ptr == NULL) {
+            perror("realloc");
             exit(1);
         }
-        else {
-            buffer_offset += ret_val;
-            remaining_bytes -= ret_val;
 
-            if(state->data_for_gui.ready_to_send) {
-                size_t length_to_be_sent = prepare_message(state, client_to_gui_buffer);
+        gui_history = realloc_ptr;
+        gui_history_size = new_size;
+    }
 
-                ssize_t ret_write = write(state->gui_socket, client_to_gui_buffer, length_to_be_sent);
+    memcpy(gui_history + gui_history_length, message, length);
+    gui_history_length += length;
+}
 
-                if (ret_write < 0) {
-                    perror("write");
-                    exit(1);
-                }
 
-                state->data_for_gui.ready_to_send = 0;
-            }
+/* Passes the event applied last to the prediction of the own worm and
+ * appends the messages about the pixels predicted after it. If a pixel
+ * sent before has turned out to be wrong, the messages not written yet
+ * are dropped (those from the game server are in the history) and the
+ * game is repainted once, when the output is flushed. NEW_GAME (e.g. right
+ * after GAME_OVER in the same batch) cancels the pending repaint
+ */
+static
+void append_predicted_pixels(client_game_state_t *state) {
+    const basic_event_data_t *event = &state->data_for_gui;
+    uint32_t predicted_x[PREDICTION_HORIZON];
+    uint32_t predicted_y[PREDICTION_HORIZON];
+    uint8_t predicted_count = 0;
+
+    if(!event->ready_to_send) {
+        if(state->game_over) {
+            prediction_game_over(&prediction);
         }
+    }
+    else if(event->event_type == EVENT_NEW_GAME) {
+        prediction_new_game(&prediction, state);
+    }
+    else if(event->event_type == EVENT_PLAYER_ELIMINATED) {
+        prediction_player_eliminated(&prediction, event->player_no);
+    }
+    else if(event->event_type == EVENT_PIXEL) {
+        predicted_count = prediction_pixel(&prediction,
+                                           event->player_no,
+                                           event->x,
+                                           event->y,
+                                           state->client_turn_direction,
+                                           monotonic_nanos(),
+                                           predicted_x,
+                                           predicted_y);
+    }
 
-        if(remaining_bytes == 0) {
-            continue_parsing = false;
+    if(prediction.repaint_needed) {
+        gui_output_length = 0;
+        gui_repaint_length = gui_history_length;
+    }
+
+    for(uint8_t i = 0; i < predicted_count; ++i) {
+        if(gui_output_length + MSG_GUI_BUFFER_LENGTH > GUI_OUTPUT_BUFFER_LENGTH) {
+            flush_gui_output(state);
         }
+
+        gui_output_length += prepare_pixel_message(state,
+                                                   event->player_no,
+                                                   predicted_x[i],
+                                                   predicted_y[i],
+                                                   gui_output_buffer + gui_output_length);
     }
 }
 
 
+/* Appends the message about the event applied last to the messages for
+ * the GUI server, if there is any (called by decode_server_datagram)
+ */
 static
-void handle_gui_message(client_game_state_t *state) {
-    memset(client_to_gui_buffer, 0, MSG_GUI_BUFFER_LENGTH);
+bool append_gui_message(client_game_state_t *state, void *argument) {
+    (void) argument;
 
-    ssize_t read_bytes = read(state->gui_socket,
-                              client_to_gui_buffer,
-                              MSG_GUI_BUFFER_LENGTH);
+    if(state->data_for_gui.ready_to_send) {
+        if(gui_output_length + MSG_GUI_BUFFER_LENGTH > GUI_OUTPUT_BUFFER_LENGTH) {
+            flush_gui_output(state);
+        }
 
-    if(read_bytes < 0) {
-        if(errno == EINTR) {
-            return;
+        size_t length = prepare_message(state, gui_output_buffer + gui_output_length);
+
+        if(prediction.turning_speed > 0) {
+            append_gui_history(gui_output_buffer + gui_output_length,
+                               length,
+                               state->data_for_gui.event_type == EVENT_NEW_GAME);
         }
-        else {
-            perror("read");
-            exit(1);
+
+        gui_output_length += length;
+
+        if(gui_output_receive_nanos == 0) {
+            gui_output_receive_nanos = server_dgram_receive_nanos;
         }
     }
-    else if(read_bytes == 0) {
-        fprintf(stderr, "Connection to GUI server lost...\n");
-        continue_working = false;
+
+    /* GAME_OVER has no message, but it ends the prediction as well */
+    if(prediction.turning_speed > 0) {
+        append_predicted_pixels(state);
+    }
+
+    state->data_for_gui.ready_to_send = 0;
+
+    return true;
+}
+
+
+/* Decodes the datagram from the game server and appends the messages
+ * about the events applied to the output for the GUI server
+ */
+static
+void handle_server_datagram(client_game_state_t *state,
+                            char *server_dgram_buffer,
+                            ssize_t read_bytes) {
+
+    if(read_bytes < MIN_SERVER_UDP_DGRAM_LENGTH) {
+        fprintf(stderr, "Datagram length lower than minimal expected\n");
+        return;
+    }
+
+    if(!decode_server_datagram(state, server_dgram_buffer, read_bytes, append_gui_message, NULL)) {
+        fprintf(stderr, "Strange data from game server... terminating\n");
         exit(1);
     }
-    else {
-        ssize_t len = 0;
-        bool newline = false;
+}
 
-        /* Check if new line is present in current TCP message
-         */
-        while(!newline && len < read_bytes) {
-            if(client_to_gui_buffer[len] == '\n') {
-                newline = true;
+
+/* Receives all the datagrams waiting on the game server socket, in batches
+ * of SERVER_RECEIVE_BATCH, and decodes them in order of arrival. Messages
+ * for the GUI server are written for the whole batch at the end of the
+ * poll wakeup
+ */
+static
+void handle_server_messages(client_game_state_t *state) {
+    int received;
+
+    server_dgram_wakeups++;
+
+    do {
+        for(int i = 0; i < SERVER_RECEIVE_BATCH; ++i) {
+            server_dgram_iovecs[i].iov_base = server_dgram_buffers[i];
+            server_dgram_iovecs[i].iov_len = sizeof(server_dgram_buffers[i]);
+
+            memset(&server_dgram_headers[i].msg_hdr, 0, sizeof(struct msghdr));
+            server_dgram_headers[i].msg_hdr.msg_iov = &server_dgram_iovecs[i];
+            server_dgram_headers[i].msg_hdr.msg_iovlen = 1;
+            server_dgram_headers[i].msg_hdr.msg_control = server_dgram_controls[i];
+            server_dgram_headers[i].msg_hdr.msg_controllen = sizeof(server_dgram_controls[i]);
+        }
+
+        received = recvmmsg(state->server_socket,
+                            server_dgram_headers,
+                            SERVER_RECEIVE_BATCH,
+                            MSG_DONTWAIT,
+                            NULL);
+
+        if(received < 0) {
+            if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                return;
             }
 
-            ++len;
+            perror("recvmmsg");
+            exit(1);
         }
 
-        ssize_t start = partial_gui_msg_length;
+        server_dgrams_received += received;
 
-        partial_gui_msg_length += len;
+        for(int i = 0; i < received; ++i) {
+            server_dgram_receive_nanos = receive_timestamp(&server_dgram_headers[i].msg_hdr);
 
-        if(newline && (size_t) partial_gui_msg_length < PARTIAL_MSG_BUFFER_LENGTH) {
-            for(ssize_t i = start; i < partial_gui_msg_length; ++i) {
-                partial_gui_msg[i] = client_to_gui_buffer[i];
+            if(capture != NULL &&
+               !capture_append(capture,
+                               server_dgram_receive_nanos,
+                               server_dgram_buffers[i],
+                               server_dgram_headers[i].msg_len)) {
+
+                fprintf(stderr, "Capture file cannot grow, capturing stopped\n");
+                capture_close(capture);
+                capture = NULL;
             }
 
-            if(partial_gui_msg_length == LENGTH_LEFT_KEY_DOWN &&
-               strcmp(partial_gui_msg, "LEFT_KEY_DOWN\n") == 0) {
+            handle_server_datagram(state,
+                                   server_dgram_buffers[i],
+                                   server_dgram_headers[i].msg_len);
+        }
+    } while(received == SERVER_RECEIVE_BATCH);
+}
+
 
-                state->client_turn_direction = 2;
+/* Applies the message (line) from the GUI server of given length (with the
+ * newline). The messages have distinct lengths, so the length selects the
+ * only message which the line can be
+ */
+static
+void apply_gui_message(client_game_state_t *state, const char *line, size_t length) {
+    uint8_t turn_direction;
+
+    switch(length) {
+        case LENGTH_LEFT_KEY_DOWN:
+            if(memcmp(line, "LEFT_KEY_DOWN\n", LENGTH_LEFT_KEY_DOWN) != 0) {
+                return;
             }
-            else if(partial_gui_msg_length == LENGTH_RIGHT_KEY_DOWN &&
-                    strcmp(partial_gui_msg, "RIGHT_KEY_DOWN\n") == 0) {
 
-                state->client_turn_direction = 1;
+            turn_direction = 2;
+            break;
+        case LENGTH_RIGHT_KEY_DOWN:
+            if(memcmp(line, "RIGHT_KEY_DOWN\n", LENGTH_RIGHT_KEY_DOWN) != 0) {
+                return;
             }
-            else if(partial_gui_msg_length == LENGTH_LEFT_KEY_UP &&
-                    strcmp(partial_gui_msg, "LEFT_KEY_UP\n") == 0) {
 
-                state->client_turn_direction = 0;
+            turn_direction = 1;
+            break;
+        case LENGTH_LEFT_KEY_UP:
+            if(memcmp(line, "LEFT_KEY_UP\n", LENGTH_LEFT_KEY_UP) != 0) {
+                return;
             }
-            else if(partial_gui_msg_length == LENGTH_RIGHT_KEY_UP &&
-                    strcmp(partial_gui_msg, "RIGHT_KEY_UP\n") == 0) {
 
-                state->client_turn_direction = 0;
+            turn_direction = 0;
+            break;
+        case LENGTH_RIGHT_KEY_UP:
+            if(memcmp(line, "RIGHT_KEY_UP\n", LENGTH_RIGHT_KEY_UP) != 0) {
+                return;
             }
+
+            turn_direction = 0;
+            break;
+        default:
+            return;
+    }
+
+    /* The latency is measured from the first change which waits
+     * for the next datagram
+     */
+    if(turn_direction != state->client_turn_direction &&
+       state->turn_change_nanos == 0) {
+
+        state->turn_change_nanos = monotonic_nanos();
+    }
+
+    state->client_turn_direction = turn_direction;
+}
+
+
+static
+void handle_gui_message(client_game_state_t *state) {
+    ssize_t read_bytes = read(state->gui_socket,
+                              gui_input_buffer + gui_input_length,
+                              GUI_INPUT_BUFFER_LENGTH - gui_input_length);
+
+    if(read_bytes < 0) {
+        if(errno == EINTR) {
+            return;
         }
+        else {
+            perror("read");
+            exit(1);
+        }
+    }
+    else if(read_bytes == 0) {
+        fprintf(stderr, "Connection to GUI server lost...\n");
+        continue_working = false;
+        exit(1);
+    }
+
+    size_t end = gui_input_length + read_bytes;
+    size_t line_start = 0;
+    char *newline;
+
+    /* Every complete line of the read is applied (key events which come
+     * together must not be lost)
+     */
+    while((newline = memchr(gui_input_buffer + line_start, '\n', end - line_start)) != NULL) {
+        size_t line_end = newline - gui_input_buffer + 1;
 
-        if(newline) {
-            memset(partial_gui_msg, 0, PARTIAL_MSG_BUFFER_LENGTH);
-            partial_gui_msg_length = 0;
+        if(!gui_input_skipping) {
+            apply_gui_message(state, gui_input_buffer + line_start, line_end - line_start);
         }
+
+        gui_input_skipping = false;
+        line_start = line_end;
     }
+
+    /* The unfinished line is moved to the beginning of the buffer, unless
+     * it is already too long to be any of the messages
+     */
+    size_t tail_length = end - line_start;
+
+    if(tail_length >= LENGTH_GUI_MESSAGE_MAX) {
+        gui_input_skipping = true;
+        tail_length = 0;
+    }
+
+    memmove(gui_input_buffer, gui_input_buffer + line_start, tail_length);
+    gui_input_length = tail_length;
 }
 
 
@@ -334,7 +756,6 @@ int main(int argc, char *argv[]) {
     }
 
     player_session_id = 1000000 * tv.tv_sec + tv.tv_usec;
-    partial_gui_msg_length = 0; /* set to initial value equal 0 */
 
 	if(argc < 2) {
 		print_program_usage(argv[0]);
@@ -353,6 +774,16 @@ int main(int argc, char *argv[]) {
 	    exit(1);
 	}
 
+	if(!check_integer(room) || strlen(room) > 5 || atoi(room) > UINT16_MAX) {
+	    fprintf(stderr, "Bad room provided (has to be an integer in range 0-%d)\n", UINT16_MAX);
+	    exit(1);
+	}
+
+	if(!check_integer(turning_speed) || strlen(turning_speed) > 2 || atoi(turning_speed) > MAX_TURNING_SPEED) {
+	    fprintf(stderr, "Bad turning speed provided (has to be an integer in range 0-%d)\n", MAX_TURNING_SPEED);
+	    exit(1);
+	}
+
 	server_address = argv[1];
 
 	addr_hints_server.ai_socktype = SOCK_DGRAM;
@@ -386,13 +817,23 @@ int main(int argc, char *argv[]) {
         exit(1);
     }
 
+    /* Kernel receive timestamps are the start of the GUI output latency
+     * (the time of the recvmmsg call is used without them)
+     */
+    if(setsockopt(socket_srv, SOL_SOCKET, SO_TIMESTAMPNS, (void *) &opt, sizeof(opt)) < 0) {
+        perror("setsockopt");
+    }
+
 	if(connect(socket_gui, addr_result_gui->ai_addr, addr_result_gui->ai_addrlen) < 0) {
 	    perror("connect");
 	    exit(1);
 	}
 
     int timer_fd = timerfd_create(CLOCK_MONOTONIC,  0);
-    struct itimerspec spec = { { 0, 30000000 }, { 0, 30000000 } };
+    struct itimerspec spec = {
+        { 0, KEEPALIVE_INTERVAL_NANOS },
+        { 0, KEEPALIVE_INTERVAL_NANOS }
+    };
 
     if(timer_fd < 0) {
         perror("timerfd_create");
@@ -401,8 +842,26 @@ int main(int argc, char *argv[]) {
 
     timerfd_settime(timer_fd, 0, &spec, NULL);
 
+    struct sigaction stats_action;
+    memset(&stats_action, 0, sizeof(stats_action));
+    stats_action.sa_handler = handle_stats_signal;
+
+    if(sigaction(SIGUSR1, &stats_action, NULL) < 0) {
+        perror("sigaction");
+        exit(1);
+    }
+
     client_game_state_t  game_state;
     initialise_client_game_state(&game_state);
+    initialise_prediction(&prediction, atoi(turning_speed));
+
+    if(capture_file_name != NULL) {
+        capture = capture_create(capture_file_name);
+
+        if(capture == NULL) {
+            exit(1);
+        }
+    }
 
     game_state.server_socket = socket_srv;
     game_state.gui_socket = socket_gui;
@@ -419,6 +878,7 @@ int main(int argc, char *argv[]) {
     client_dgram_t data;
 
     data.session_id = player_session_id;
+    data.room = atoi(room);
     memcpy(data.player_name, player_name, strlen(player_name));
 
     uint64_t timers_elapsed;
@@ -439,8 +899,24 @@ int main(int argc, char *argv[]) {
 
     ssize_t ret_val;
 
+    /* Time (in milliseconds) until the delayed change of the turn direction
+     * can be sent, -1 if there is no such change
+     */
+    int input_wait = -1;
+
 	while(continue_working) {
-        int ret = poll(fds, 3, -1);
+        int ret = poll(fds, 3, input_wait);
+
+        if(stats_requested) {
+            stats_requested = 0;
+            print_input_latency(&game_state);
+            print_reorder_stats(&game_state);
+            print_receive_stats();
+
+            if(prediction.turning_speed > 0) {
+                print_prediction_stats();
+            }
+        }
 
         if(ret > 0) {
             if(fds[0].revents & POLLIN) {
@@ -454,13 +930,20 @@ int main(int argc, char *argv[]) {
             }
 
             if(fds[1].revents & POLLIN) {
-                handle_server_message(&game_state);
+                handle_server_messages(&game_state);
             }
 
             if(fds[2].revents & POLLIN) {
                 handle_gui_message(&game_state);
             }
         }
+
+        input_wait = send_turn_change(&data, &game_state, timer_fd);
+
+        /* Nothing waits for the GUI longer than the current wakeup */
+        if(gui_output_length > 0 || prediction.repaint_needed) {
+            flush_gui_output(&game_state);
+        }
 	}
 
     if(close(socket_srv) < 0) {
@@ -476,5 +959,9 @@ int main(int argc, char *argv[]) {
     freeaddrinfo(addr_result_server);
     freeaddrinfo(addr_result_gui);
 
+    if(capture != NULL) {
+        capture_close(capture);
+    }
+
 	exit(0);
 }
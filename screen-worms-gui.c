@@ -0,0 +1,558 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "utils.h"
+
+
+/* Stand-in for the GUI server, for benchmarks and soak tests of the client
+ * without the real GUI. Accepts a single connection of screen-worms-client,
+ * validates and counts the lines it sends (NEW_GAME, PIXEL and
+ * PLAYER_ELIMINATED) and may press the keys on a fixed schedule. Prints
+ * the number of lines received every second and the summary at the end
+ * (when the client disconnects, the duration passes or on SIGINT or
+ * SIGTERM). Exits with status 2 if any line was invalid
+ */
+
+
+/* Size of buffer for the lines received from the client (the unfinished
+ * line left from the previous read is kept at its beginning) and the
+ * longest line accepted (NEW_GAME with all the players and the longest
+ * names is shorter)
+ */
+#define LINE_BUFFER_LENGTH                            65536
+#define MAX_LINE_LENGTH                                1024
+
+
+/* Number of invalid lines printed before they are only counted
+ */
+#define MAX_INVALID_PRINTED                              10
+
+
+#define NANOS_PER_SEC                            1000000000
+
+
+typedef struct gui_game_t gui_game_t;
+typedef struct gui_stats_t gui_stats_t;
+
+
+/* Game described by the last NEW_GAME line
+ */
+struct gui_game_t {
+    bool started;
+
+    uint32_t max_x;
+    uint32_t max_y;
+
+    uint8_t players_count;
+    char players[MAX_PLAYERS][MAX_PLAYER_NAME_LENGTH + 1];
+    bool eliminated[MAX_PLAYERS];
+};
+
+
+struct gui_stats_t {
+    uint64_t new_games;
+    uint64_t pixels;
+    uint64_t eliminations;
+    uint64_t invalid;
+};
+
+
+static char *port = "20210";
+static uint32_t key_period_millis = 0;
+static uint32_t duration_secs = 0;
+
+
+static char line_buffer[LINE_BUFFER_LENGTH];
+static size_t line_length = 0;
+
+
+static gui_game_t game;
+static gui_stats_t stats;
+
+
+/* Set by SIGINT and SIGTERM handler, the summary is printed before exit
+ */
+static volatile sig_atomic_t stop_requested = 0;
+
+
+/* Keys pressed and released in turn when key presses are scripted
+ */
+static const char *key_messages[] = {
+    "LEFT_KEY_DOWN\n", "LEFT_KEY_UP\n", "RIGHT_KEY_DOWN\n", "RIGHT_KEY_UP\n"
+};
+
+
+static
+void print_program_usage(const char *program_name) {
+    fprintf(stderr, "Usage: %s [-p port] [-k key period in ms] [-t duration in s]\n",
+            program_name);
+}
+
+
+static
+void parse_program_arguments(int argc, char *argv[]) {
+    int option = 0;
+
+    while((option = getopt(argc, argv, "p:k:t:")) != -1) {
+        switch(option) {
+            case 'p':
+                port = optarg;
+                break;
+            case 'k':
+                if(!check_integer(optarg)) {
+                    print_program_usage(argv[0]);
+                    exit(1);
+                }
+
+                key_period_millis = strtoul(optarg, NULL, 10);
+                break;
+            case 't':
+                if(!check_integer(optarg)) {
+                    print_program_usage(argv[0]);
+                    exit(1);
+                }
+
+                duration_secs = strtoul(optarg, NULL, 10);
+                break;
+            default:
+                print_program_usage(argv[0]);
+                exit(1);
+        }
+    }
+
+    if(argc != optind || !check_integer(port)) {
+        print_program_usage(argv[0]);
+        exit(1);
+    }
+}
+
+
+static
+void handle_stop_signal(int signal_number) {
+    (void) signal_number;
+    stop_requested = 1;
+}
+
+
+/* Parses the decimal number which ends at the separator (space or the end
+ * of the line), advances the position past the separator. Returns false
+ * if there is no such number
+ */
+static
+bool parse_number(const char **position, const char *end, uint32_t *value) {
+    const char *current = *position;
+    uint64_t result = 0;
+
+    if(current == end || *current < '0' || *current > '9') {
+        return false;
+    }
+
+    while(current < end && *current >= '0' && *current <= '9') {
+        result = result * 10 + (*current - '0');
+
+        if(result > UINT32_MAX) {
+            return false;
+        }
+
+        current++;
+    }
+
+    if(current < end) {
+        if(*current != ' ') {
+            return false;
+        }
+
+        current++;
+    }
+
+    *value = (uint32_t) result;
+    *position = current;
+
+    return true;
+}
+
+
+/* Returns the index of the player of the game with given name or -1
+ */
+static
+int find_player(const char *name, size_t length) {
+    if(length == 0 || length > MAX_PLAYER_NAME_LENGTH) {
+        return -1;
+    }
+
+    for(uint8_t i = 0; i < game.players_count; ++i) {
+        if(strncmp(game.players[i], name, length) == 0 && game.players[i][length] == '\0') {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+
+static
+bool parse_new_game(const char *position, const char *end) {
+    gui_game_t parsed;
+    memset(&parsed, 0, sizeof(parsed));
+
+    if(!parse_number(&position, end, &parsed.max_x) ||
+       !parse_number(&position, end, &parsed.max_y) ||
+       parsed.max_x == 0 || parsed.max_y == 0) {
+
+        return false;
+    }
+
+    while(position < end) {
+        const char *name_end = memchr(position, ' ', end - position);
+        size_t name_length = (name_end != NULL ? name_end : end) - position;
+
+        if(parsed.players_count == MAX_PLAYERS ||
+           name_length == 0 || name_length > MAX_PLAYER_NAME_LENGTH) {
+
+            return false;
+        }
+
+        for(size_t i = 0; i < name_length; ++i) {
+            if(position[i] < PLAYER_NAME_MINIMAL_ASCII || position[i] > PLAYER_NAME_MAXIMAL_ASCII) {
+                return false;
+            }
+        }
+
+        char *name = parsed.players[parsed.players_count];
+        memcpy(name, position, name_length);
+
+        /* Names are sent in alphabetical order */
+        if(parsed.players_count > 0 && strcmp(parsed.players[parsed.players_count - 1], name) >= 0) {
+            return false;
+        }
+
+        parsed.players_count++;
+        position += name_length + (name_end != NULL ? 1 : 0);
+    }
+
+    if(parsed.players_count < 2) {
+        return false;
+    }
+
+    parsed.started = true;
+    game = parsed;
+
+    return true;
+}
+
+
+static
+bool parse_pixel(const char *position, const char *end) {
+    uint32_t x;
+    uint32_t y;
+
+    if(!game.started ||
+       !parse_number(&position, end, &x) ||
+       !parse_number(&position, end, &y)) {
+
+        return false;
+    }
+
+    return x < game.max_x && y < game.max_y && find_player(position, end - position) >= 0;
+}
+
+
+static
+bool parse_player_eliminated(const char *position, const char *end) {
+    int player = find_player(position, end - position);
+
+    if(!game.started || player < 0 || game.eliminated[player]) {
+        return false;
+    }
+
+    game.eliminated[player] = true;
+
+    return true;
+}
+
+
+/* Validates and counts the line (without the newline)
+ */
+static
+void handle_line(const char *line, size_t length) {
+    const char *end = line + length;
+    bool valid = false;
+
+    if(length > 6 && memcmp(line, "PIXEL ", 6) == 0) {
+        valid = parse_pixel(line + 6, end);
+        stats.pixels += valid;
+    }
+    else if(length > 9 && memcmp(line, "NEW_GAME ", 9) == 0) {
+        valid = parse_new_game(line + 9, end);
+        stats.new_games += valid;
+    }
+    else if(length > 18 && memcmp(line, "PLAYER_ELIMINATED ", 18) == 0) {
+        valid = parse_player_eliminated(line + 18, end);
+        stats.eliminations += valid;
+    }
+
+    if(!valid) {
+        if(stats.invalid < MAX_INVALID_PRINTED) {
+            fprintf(stderr, "Invalid line: %.*s\n", (int) length, line);
+        }
+
+        stats.invalid++;
+    }
+}
+
+
+/* Reads the data from the client and handles every complete line. Returns
+ * false when the client has closed the connection
+ */
+static
+bool handle_client_data(int client_socket) {
+    ssize_t read_bytes = read(client_socket,
+                              line_buffer + line_length,
+                              sizeof(line_buffer) - line_length);
+
+    if(read_bytes < 0) {
+        if(errno == EINTR) {
+            return true;
+        }
+
+        perror("read");
+        return false;
+    }
+
+    if(read_bytes == 0) {
+        return false;
+    }
+
+    char *line = line_buffer;
+    char *end = line_buffer + line_length + read_bytes;
+    char *newline;
+
+    while((newline = memchr(line, '\n', end - line)) != NULL) {
+        handle_line(line, newline - line);
+        line = newline + 1;
+    }
+
+    line_length = end - line;
+
+    if(line_length > MAX_LINE_LENGTH) {
+        /* No valid line is that long, drop it */
+        handle_line(line, line_length);
+        line_length = 0;
+    }
+    else {
+        memmove(line_buffer, line, line_length);
+    }
+
+    return true;
+}
+
+
+static
+uint64_t total_lines(void) {
+    return stats.new_games + stats.pixels + stats.eliminations + stats.invalid;
+}
+
+
+static
+int accept_client(void) {
+    int listening_socket = socket(AF_INET6, SOCK_STREAM, 0);
+
+    if(listening_socket < 0) {
+        perror("socket");
+        exit(1);
+    }
+
+    int option_value = 1;
+
+    if(setsockopt(listening_socket, SOL_SOCKET, SO_REUSEADDR, &option_value, sizeof(option_value)) < 0) {
+        perror("setsockopt");
+        exit(1);
+    }
+
+    /* IPv4 clients are accepted as well */
+    option_value = 0;
+
+    if(setsockopt(listening_socket, IPPROTO_IPV6, IPV6_V6ONLY, &option_value, sizeof(option_value)) < 0) {
+        perror("setsockopt");
+        exit(1);
+    }
+
+    struct sockaddr_in6 address;
+    memset(&address, 0, sizeof(address));
+
+    address.sin6_family = AF_INET6;
+    address.sin6_addr = in6addr_any;
+    address.sin6_port = htons(strtoul(port, NULL, 10));
+
+    if(bind(listening_socket, (struct sockaddr *) &address, sizeof(address)) < 0) {
+        perror("bind");
+        exit(1);
+    }
+
+    if(listen(listening_socket, 1) < 0) {
+        perror("listen");
+        exit(1);
+    }
+
+    int client_socket = accept(listening_socket, NULL, NULL);
+
+    if(client_socket < 0) {
+        perror("accept");
+        exit(1);
+    }
+
+    if(close(listening_socket) < 0) {
+        perror("close");
+        exit(1);
+    }
+
+    /* Scripted keys go out as soon as they are pressed */
+    option_value = 1;
+
+    if(setsockopt(client_socket, IPPROTO_TCP, TCP_NODELAY, &option_value, sizeof(option_value)) < 0) {
+        perror("setsockopt");
+        exit(1);
+    }
+
+    return client_socket;
+}
+
+
+static
+void press_key(int client_socket, uint64_t key_presses) {
+    const char *message = key_messages[key_presses % 4];
+
+    if(write(client_socket, message, strlen(message)) < 0) {
+        perror("write");
+    }
+}
+
+
+static
+void print_summary(uint64_t start_nanos, uint64_t peak_lines_per_sec, uint64_t key_presses) {
+    double elapsed_secs = (double) (monotonic_nanos() - start_nanos) / NANOS_PER_SEC;
+
+    fprintf(stderr, "lines: %lu in %.3f s (%.0f per second, peak %lu per second), "
+                    "NEW_GAME: %lu, PIXEL: %lu, PLAYER_ELIMINATED: %lu, invalid: %lu, "
+                    "keys sent: %lu\n",
+            total_lines(),
+            elapsed_secs,
+            elapsed_secs > 0 ? total_lines() / elapsed_secs : 0,
+            peak_lines_per_sec,
+            stats.new_games,
+            stats.pixels,
+            stats.eliminations,
+            stats.invalid,
+            key_presses);
+}
+
+
+int main(int argc, char *argv[]) {
+    parse_program_arguments(argc, argv);
+
+    struct sigaction stop_action;
+    memset(&stop_action, 0, sizeof(stop_action));
+    stop_action.sa_handler = handle_stop_signal;
+
+    if(sigaction(SIGINT, &stop_action, NULL) < 0 ||
+       sigaction(SIGTERM, &stop_action, NULL) < 0) {
+
+        perror("sigaction");
+        exit(1);
+    }
+
+    int client_socket = accept_client();
+
+    uint64_t start_nanos = monotonic_nanos();
+    uint64_t next_report_nanos = start_nanos + NANOS_PER_SEC;
+    uint64_t next_key_nanos = start_nanos + (uint64_t) key_period_millis * MILLIS_TO_NANO_MULTIPLIER;
+    uint64_t end_nanos = start_nanos + (uint64_t) duration_secs * NANOS_PER_SEC;
+
+    uint64_t reported_lines = 0;
+    uint64_t peak_lines_per_sec = 0;
+    uint64_t key_presses = 0;
+
+    struct pollfd client_fd;
+    client_fd.fd = client_socket;
+    client_fd.events = POLLIN;
+
+    while(!stop_requested) {
+        uint64_t now = monotonic_nanos();
+
+        if(duration_secs > 0 && now >= end_nanos) {
+            break;
+        }
+
+        if(now >= next_report_nanos) {
+            uint64_t lines = total_lines() - reported_lines;
+
+            fprintf(stderr, "%lu s: %lu lines per second, invalid so far: %lu\n",
+                    (unsigned long) ((now - start_nanos) / NANOS_PER_SEC),
+                    lines,
+                    stats.invalid);
+
+            if(lines > peak_lines_per_sec) {
+                peak_lines_per_sec = lines;
+            }
+
+            reported_lines += lines;
+            next_report_nanos += NANOS_PER_SEC;
+        }
+
+        if(key_period_millis > 0 && now >= next_key_nanos) {
+            press_key(client_socket, key_presses++);
+            next_key_nanos += (uint64_t) key_period_millis * MILLIS_TO_NANO_MULTIPLIER;
+        }
+
+        /* Sleep until the next report or key press at the latest */
+        uint64_t wakeup_nanos = next_report_nanos;
+
+        if(key_period_millis > 0 && next_key_nanos < wakeup_nanos) {
+            wakeup_nanos = next_key_nanos;
+        }
+
+        if(duration_secs > 0 && end_nanos < wakeup_nanos) {
+            wakeup_nanos = end_nanos;
+        }
+
+        int timeout = wakeup_nanos > now ?
+                      (int) ((wakeup_nanos - now + MILLIS_TO_NANO_MULTIPLIER - 1) / MILLIS_TO_NANO_MULTIPLIER) : 0;
+
+        int ret = poll(&client_fd, 1, timeout);
+
+        if(ret < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+
+            perror("poll");
+            exit(1);
+        }
+
+        if(ret > 0 && (client_fd.revents & (POLLIN | POLLHUP | POLLERR))) {
+            if(!handle_client_data(client_socket)) {
+                break;
+            }
+        }
+    }
+
+    print_summary(start_nanos, peak_lines_per_sec, key_presses);
+
+    if(close(client_socket) < 0) {
+        perror("close");
+        exit(1);
+    }
+
+    return stats.invalid > 0 ? 2 : 0;
+}
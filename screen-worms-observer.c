@@ -0,0 +1,805 @@
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <netinet/tcp.h>
+#include "client_protocol.h"
+#include "game_server_protocol.h"
+#include "utils.h"
+
+
+/* Observer follows many games (of one or many game servers) as a spectator
+ * in a single process and single thread. The games are listed in a file,
+ * one per line:
+ *
+ *     game_server_address game_server_port room gui gui_address gui_port
+ *     game_server_address game_server_port room file path
+ *
+ * Messages of each game go to its own GUI server connection or file, in
+ * the same form as the client sends them. Lines starting with '#' are
+ * skipped. GUI server connections are non-blocking: the messages a GUI
+ * server does not take at once wait in the pending buffer of the session,
+ * and the session is closed when that buffer overflows, so one stalled
+ * GUI server never holds up the other games
+ */
+
+
+/* Maximum number of games followed by one observer process
+ */
+#define OBSERVER_MAX_SESSIONS                          4096
+
+
+/* Maximum length of a line of the file with games
+ */
+#define OBSERVER_LINE_LENGTH                            512
+
+
+/* Keepalive datagrams of the sessions are spread over this many ticks of
+ * the single keepalive timer within KEEPALIVE_INTERVAL_NANOS, so the
+ * datagrams of all the sessions are not sent at once
+ */
+#define OBSERVER_KEEPALIVE_SLOTS                         10
+
+
+/* Maximum number of descriptors returned by a single epoll_wait call
+ */
+#define OBSERVER_EPOLL_EVENTS                            64
+
+
+/* Size of the buffer of messages waiting for a slow GUI server of
+ * a session. It holds the catch-up of a long game joined in progress
+ * (the pages are touched only when the messages are deferred)
+ */
+#define OBSERVER_PENDING_LENGTH                   (1 << 20)
+
+
+/* epoll data of the keepalive timer (server sockets of the sessions use
+ * their indices, outputs the indices with OBSERVER_OUTPUT_TAG set)
+ */
+#define OBSERVER_TIMER_TAG                       UINT32_MAX
+#define OBSERVER_OUTPUT_TAG                      0x80000000
+
+
+typedef struct observer_session_t observer_session_t;
+
+
+/* Game followed by the observer. The output descriptor is a GUI server
+ * socket or a file, the server socket is connected to the game server
+ * (the kernel drops datagrams from other senders)
+ */
+struct observer_session_t {
+    client_game_state_t state;
+    client_dgram_t data;
+
+    int output_fd;
+    bool active;
+
+    /* Messages not yet taken by the GUI server (the output is watched for
+     * EPOLLOUT while there are any). Files are written with blocking calls
+     * and never have pending messages
+     */
+    bool output_is_socket;
+    char *pending;
+    size_t pending_length;
+
+    uint64_t dgrams_received;
+    uint64_t messages_written;
+};
+
+
+static char client_dgram_buffer[CLIENT_DGRAM_BUFFER_SIZE];
+
+
+/* Buffers for the datagrams from the game servers, shared by the sessions
+ * (one session is drained at a time)
+ */
+static char server_dgram_buffers[SERVER_RECEIVE_BATCH][MAX_SERVER_UDP_DGRAM_LENGTH + 1];
+static struct iovec server_dgram_iovecs[SERVER_RECEIVE_BATCH];
+static struct mmsghdr server_dgram_headers[SERVER_RECEIVE_BATCH];
+
+
+/* Messages of the session being drained, written to its output with
+ * a single call after the drain
+ */
+static char output_buffer[GUI_OUTPUT_BUFFER_LENGTH];
+static size_t output_length = 0;
+
+
+static observer_session_t *sessions;
+static uint32_t sessions_count = 0;
+static uint32_t sessions_active = 0;
+
+
+static int epoll_fd = -1;
+
+
+/* Wakeups of the event loop and the keepalive datagrams sent, for
+ * the statistics
+ */
+static uint64_t loop_wakeups = 0;
+static uint64_t keepalives_sent = 0;
+static uint64_t outputs_deferred = 0;
+
+
+static uint64_t start_nanos;
+
+
+/* Set by SIGUSR1 handler, the statistics are printed by the main loop
+ */
+static volatile sig_atomic_t stats_requested = 0;
+
+
+static
+void print_program_usage(const char *program_name) {
+    fprintf(stderr, "Usage: %s games_file\n", program_name);
+}
+
+
+static
+void handle_stats_signal(int signal_number) {
+    (void) signal_number;
+    stats_requested = 1;
+}
+
+
+static
+void print_observer_stats(void) {
+    uint64_t dgrams_received = 0;
+    uint64_t messages_written = 0;
+
+    for(uint32_t i = 0; i < sessions_count; ++i) {
+        dgrams_received += sessions[i].dgrams_received;
+        messages_written += sessions[i].messages_written;
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    uint64_t cpu_micros = (uint64_t) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000
+                          + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+    uint64_t elapsed_micros = (monotonic_nanos() - start_nanos) / 1000;
+
+    fprintf(stderr, "sessions: %u (active: %u), server datagrams: %lu, messages written: %lu, "
+                    "outputs deferred: %lu, keepalives sent: %lu, loop wakeups: %lu\n",
+            sessions_count,
+            sessions_active,
+            dgrams_received,
+            messages_written,
+            outputs_deferred,
+            keepalives_sent,
+            loop_wakeups);
+
+    fprintf(stderr, "CPU time: %lu ms in %lu ms (%.2f%% of a core, %.4f%% per session)\n",
+            cpu_micros / 1000,
+            elapsed_micros / 1000,
+            elapsed_micros > 0 ? 100.0 * cpu_micros / elapsed_micros : 0.0,
+            elapsed_micros > 0 && sessions_count > 0
+                ? 100.0 * cpu_micros / elapsed_micros / sessions_count : 0.0);
+}
+
+
+/* Stops following the game of the session (after an error of its output
+ * or nonsense data from its game server), the other sessions go on
+ */
+static
+void close_session(observer_session_t *session, uint32_t session_no, const char *reason) {
+    fprintf(stderr, "Session %u closed: %s\n", session_no, reason);
+
+    close(session->state.server_socket);
+    close(session->output_fd);
+
+    free(session->pending);
+    session->pending = NULL;
+    session->pending_length = 0;
+
+    session->active = false;
+    sessions_active--;
+}
+
+
+/* Writes as much of the buffer as the output takes without blocking.
+ * Returns the number of bytes written or -1 on error of the output
+ */
+static
+ssize_t write_output(observer_session_t *session, const char *buffer, size_t length) {
+    size_t written = 0;
+
+    while(written < length) {
+        ssize_t ret_write = write(session->output_fd, buffer + written, length - written);
+
+        if(ret_write < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+
+            if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+
+            perror("write");
+            return -1;
+        }
+
+        written += ret_write;
+    }
+
+    return written;
+}
+
+
+/* Watches the output of the session for EPOLLOUT while it has pending
+ * messages
+ */
+static
+void watch_output(observer_session_t *session, uint32_t session_no, bool writable) {
+    struct epoll_event event;
+
+    event.events = writable ? EPOLLOUT : 0;
+    event.data.u32 = session_no | OBSERVER_OUTPUT_TAG;
+
+    if(epoll_ctl(epoll_fd, EPOLL_CTL_MOD, session->output_fd, &event) < 0) {
+        perror("epoll_ctl");
+        exit(1);
+    }
+}
+
+
+/* Writes the messages of the session prepared in the output buffer. Those
+ * the output does not take at once are kept in the pending buffer (after
+ * the messages already there, which go first)
+ */
+static
+void flush_output(observer_session_t *session, uint32_t session_no) {
+    size_t written = 0;
+
+    if(session->pending_length == 0) {
+        ssize_t ret_write = write_output(session, output_buffer, output_length);
+
+        if(ret_write < 0) {
+            output_length = 0;
+            close_session(session, session_no, "output failed");
+            return;
+        }
+
+        written = ret_write;
+    }
+
+    if(written < output_length) {
+        if(session->pending_length + output_length - written > OBSERVER_PENDING_LENGTH) {
+            output_length = 0;
+            close_session(session, session_no, "GUI server too slow, pending messages overflowed");
+            return;
+        }
+
+        if(session->pending_length == 0) {
+            watch_output(session, session_no, true);
+            outputs_deferred++;
+        }
+
+        memcpy(session->pending + session->pending_length,
+               output_buffer + written,
+               output_length - written);
+
+        session->pending_length += output_length - written;
+    }
+
+    output_length = 0;
+}
+
+
+/* Writes the pending messages of the session once its output is writable
+ * again
+ */
+static
+void handle_output_ready(observer_session_t *session, uint32_t session_no, uint32_t events) {
+    if(events & (EPOLLERR | EPOLLHUP)) {
+        close_session(session, session_no, "output closed");
+        return;
+    }
+
+    ssize_t ret_write = write_output(session, session->pending, session->pending_length);
+
+    if(ret_write < 0) {
+        close_session(session, session_no, "output failed");
+        return;
+    }
+
+    memmove(session->pending, session->pending + ret_write, session->pending_length - ret_write);
+    session->pending_length -= ret_write;
+
+    if(session->pending_length == 0) {
+        watch_output(session, session_no, false);
+    }
+}
+
+
+static
+void append_message(observer_session_t *session, uint32_t session_no) {
+    client_game_state_t *state = &session->state;
+
+    if(state->data_for_gui.ready_to_send) {
+        if(output_length + MSG_GUI_BUFFER_LENGTH > GUI_OUTPUT_BUFFER_LENGTH) {
+            flush_output(session, session_no);
+        }
+
+        output_length += prepare_message(state, output_buffer + output_length);
+        session->messages_written++;
+
+        state->data_for_gui.ready_to_send = 0;
+    }
+}
+
+
+/* Appends the message about the event applied to the state of the session
+ * (second argument), called by decode_server_datagram. Stops decoding once
+ * the session is closed
+ */
+static
+bool session_event_applied(client_game_state_t *state, void *argument) {
+    (void) state;
+
+    observer_session_t *session = argument;
+
+    append_message(session, session - sessions);
+
+    return session->active;
+}
+
+
+/* Drains the server socket of the session in batches of SERVER_RECEIVE_BATCH
+ * and writes the messages of all the datagrams with a single call
+ */
+static
+void handle_server_messages(observer_session_t *session, uint32_t session_no) {
+    int received;
+
+    do {
+        for(int i = 0; i < SERVER_RECEIVE_BATCH; ++i) {
+            server_dgram_iovecs[i].iov_base = server_dgram_buffers[i];
+            server_dgram_iovecs[i].iov_len = sizeof(server_dgram_buffers[i]);
+
+            memset(&server_dgram_headers[i].msg_hdr, 0, sizeof(struct msghdr));
+            server_dgram_headers[i].msg_hdr.msg_iov = &server_dgram_iovecs[i];
+            server_dgram_headers[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        received = recvmmsg(session->state.server_socket,
+                            server_dgram_headers,
+                            SERVER_RECEIVE_BATCH,
+                            MSG_DONTWAIT,
+                            NULL);
+
+        if(received < 0) {
+            /* Refused connection is the ICMP error of a keepalive sent
+             * while the game server is down, the datagrams are sent on
+             */
+            if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNREFUSED) {
+                perror("recvmmsg");
+            }
+
+            break;
+        }
+
+        session->dgrams_received += received;
+
+        for(int i = 0; i < received && session->active; ++i) {
+            if(!decode_server_datagram(&session->state,
+                                       server_dgram_buffers[i],
+                                       server_dgram_headers[i].msg_len,
+                                       session_event_applied,
+                                       session)) {
+
+                output_length = 0;
+                close_session(session, session_no, "strange data from game server");
+            }
+        }
+    } while(received == SERVER_RECEIVE_BATCH && session->active);
+
+    if(session->active && output_length > 0) {
+        flush_output(session, session_no);
+    }
+
+    output_length = 0;
+}
+
+
+/* Sends spectator datagram (empty player name, no turn) with the number
+ * of the next expected event to the game server of the session
+ */
+static
+void handle_keepalive(observer_session_t *session) {
+    session->data.turn_direction = 0;
+    session->data.next_expected_event_no = session->state.next_expected;
+
+    size_t length = serialize_client_dgram(&session->data, 0, client_dgram_buffer);
+
+    if(send(session->state.server_socket, client_dgram_buffer, length, 0) != (ssize_t) length) {
+        /* Game server may be down for a while, the datagrams are sent on */
+        if(errno != ECONNREFUSED) {
+            perror("send");
+        }
+    }
+    else {
+        keepalives_sent++;
+    }
+}
+
+
+/* Sends the keepalive datagrams of the sessions assigned to the slot
+ */
+static
+void handle_keepalive_slot(uint32_t slot) {
+    for(uint32_t i = slot; i < sessions_count; i += OBSERVER_KEEPALIVE_SLOTS) {
+        if(sessions[i].active) {
+            handle_keepalive(&sessions[i]);
+        }
+    }
+}
+
+
+static
+int open_output(char *kind, char *first, char *second, uint32_t line_no, bool *is_socket) {
+    if(strcmp(kind, "file") == 0 && first != NULL && second == NULL) {
+        int fd = open(first, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+        if(fd < 0) {
+            perror("open");
+            exit(1);
+        }
+
+        *is_socket = false;
+
+        return fd;
+    }
+
+    if(strcmp(kind, "gui") != 0 || first == NULL || second == NULL || !check_integer(second)) {
+        fprintf(stderr, "Bad output in line %u of games file\n", line_no);
+        exit(1);
+    }
+
+    struct addrinfo addr_hints_gui;
+    struct addrinfo *addr_result_gui;
+
+    memset(&addr_hints_gui, 0, sizeof(addr_hints_gui));
+    addr_hints_gui.ai_socktype = SOCK_STREAM;
+
+    int err = getaddrinfo(first, second, &addr_hints_gui, &addr_result_gui);
+
+    if(err != 0) {
+        fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(err));
+        exit(1);
+    }
+
+    int fd = socket(addr_result_gui->ai_family,
+                    addr_result_gui->ai_socktype,
+                    addr_result_gui->ai_protocol);
+
+    if(fd < 0) {
+        perror("socket");
+        exit(1);
+    }
+
+    int opt = 1;
+
+    if(setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (void *) &opt, sizeof(opt)) < 0) {
+        perror("setsockopt");
+        exit(1);
+    }
+
+    if(connect(fd, addr_result_gui->ai_addr, addr_result_gui->ai_addrlen) < 0) {
+        perror("connect");
+        exit(1);
+    }
+
+    freeaddrinfo(addr_result_gui);
+
+    int socket_flags = fcntl(fd, F_GETFL, 0);
+
+    if(socket_flags < 0 || fcntl(fd, F_SETFL, socket_flags | O_NONBLOCK) < 0) {
+        perror("fcntl");
+        exit(1);
+    }
+
+    *is_socket = true;
+
+    return fd;
+}
+
+
+/* Sets up the session of the game described by the line of games file
+ */
+static
+void open_session(observer_session_t *session, char *line, uint32_t line_no, uint64_t session_id) {
+    char *saveptr;
+    char *server_address = strtok_r(line, " \t\n", &saveptr);
+    char *server_port = strtok_r(NULL, " \t\n", &saveptr);
+    char *room = strtok_r(NULL, " \t\n", &saveptr);
+    char *kind = strtok_r(NULL, " \t\n", &saveptr);
+    char *first = strtok_r(NULL, " \t\n", &saveptr);
+    char *second = strtok_r(NULL, " \t\n", &saveptr);
+
+    if(kind == NULL || strtok_r(NULL, " \t\n", &saveptr) != NULL) {
+        fprintf(stderr, "Bad number of fields in line %u of games file\n", line_no);
+        exit(1);
+    }
+
+    if(!check_integer(server_port)) {
+        fprintf(stderr, "Bad port in line %u of games file (non-digits characters detected)\n", line_no);
+        exit(1);
+    }
+
+    if(!check_integer(room) || strlen(room) > 5 || atoi(room) > UINT16_MAX) {
+        fprintf(stderr, "Bad room in line %u of games file (has to be an integer in range 0-%d)\n",
+                line_no, UINT16_MAX);
+        exit(1);
+    }
+
+    struct addrinfo addr_hints_server;
+    struct addrinfo *addr_result_server;
+
+    memset(&addr_hints_server, 0, sizeof(addr_hints_server));
+    addr_hints_server.ai_socktype = SOCK_DGRAM;
+
+    int err = getaddrinfo(server_address, server_port, &addr_hints_server, &addr_result_server);
+
+    if(err != 0) {
+        fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(err));
+        exit(1);
+    }
+
+    initialise_client_game_state(&session->state);
+
+    session->state.server_socket = socket(addr_result_server->ai_family,
+                                          addr_result_server->ai_socktype,
+                                          addr_result_server->ai_protocol);
+
+    if(session->state.server_socket < 0) {
+        perror("socket");
+        exit(1);
+    }
+
+    if(connect(session->state.server_socket,
+               addr_result_server->ai_addr,
+               addr_result_server->ai_addrlen) < 0) {
+
+        perror("connect");
+        exit(1);
+    }
+
+    freeaddrinfo(addr_result_server);
+
+    session->output_fd = open_output(kind, first, second, line_no, &session->output_is_socket);
+
+    /* Most of the buffer is never touched unless the GUI server stalls */
+    session->pending = session->output_is_socket ? malloc(OBSERVER_PENDING_LENGTH) : NULL;
+    session->pending_length = 0;
+
+    if(session->output_is_socket && session->pending == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+
+    session->state.gui_socket = session->output_fd;
+    session->state.player_name_len = 0;
+    session->state.game_id = 0;
+    session->state.game_over = true;
+    session->state.played_any = false;
+
+    memset(&session->data, 0, sizeof(session->data));
+    session->data.session_id = session_id;
+    session->data.room = atoi(room);
+
+    session->active = true;
+}
+
+
+static
+void read_games_file(const char *path, uint64_t first_session_id) {
+    FILE *games_file = fopen(path, "r");
+
+    if(games_file == NULL) {
+        perror("fopen");
+        exit(1);
+    }
+
+    char line[OBSERVER_LINE_LENGTH];
+    uint32_t line_no = 0;
+
+    while(fgets(line, sizeof(line), games_file) != NULL) {
+        line_no++;
+
+        size_t skipped = strspn(line, " \t\n");
+
+        if(line[skipped] == '\0' || line[skipped] == '#') {
+            continue;
+        }
+
+        if(sessions_count == OBSERVER_MAX_SESSIONS) {
+            fprintf(stderr, "Too many games (at most %d)\n", OBSERVER_MAX_SESSIONS);
+            exit(1);
+        }
+
+        /* Session identifiers differ, so that many sessions of one game
+         * server from the same address are told apart only by the ports
+         */
+        open_session(&sessions[sessions_count], line, line_no, first_session_id + sessions_count);
+        sessions_count++;
+    }
+
+    fclose(games_file);
+
+    sessions_active = sessions_count;
+}
+
+
+int main(int argc, char *argv[]) {
+    struct timeval tv;
+
+    if(gettimeofday(&tv, NULL) < 0) {
+        perror("gettimeofday");
+        exit(1);
+    }
+
+    if(argc != 2) {
+        print_program_usage(argv[0]);
+        exit(1);
+    }
+
+    sessions = calloc(OBSERVER_MAX_SESSIONS, sizeof(observer_session_t));
+
+    if(sessions == NULL) {
+        perror("calloc");
+        exit(1);
+    }
+
+    /* Closed GUI server connection closes its session only */
+    signal(SIGPIPE, SIG_IGN);
+
+    read_games_file(argv[1], 1000000 * tv.tv_sec + tv.tv_usec);
+
+    if(sessions_count == 0) {
+        fprintf(stderr, "No games to follow\n");
+        exit(1);
+    }
+
+    epoll_fd = epoll_create1(0);
+
+    if(epoll_fd < 0) {
+        perror("epoll_create1");
+        exit(1);
+    }
+
+    struct epoll_event event;
+
+    for(uint32_t i = 0; i < sessions_count; ++i) {
+        event.events = EPOLLIN;
+        event.data.u32 = i;
+
+        if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sessions[i].state.server_socket, &event) < 0) {
+            perror("epoll_ctl");
+            exit(1);
+        }
+
+        /* Errors of the GUI server connection are reported without asking,
+         * EPOLLOUT only while there are pending messages
+         */
+        if(sessions[i].output_is_socket) {
+            event.events = 0;
+            event.data.u32 = i | OBSERVER_OUTPUT_TAG;
+
+            if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sessions[i].output_fd, &event) < 0) {
+                perror("epoll_ctl");
+                exit(1);
+            }
+        }
+    }
+
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, 0);
+    struct itimerspec spec = {
+        { 0, KEEPALIVE_INTERVAL_NANOS / OBSERVER_KEEPALIVE_SLOTS },
+        { 0, KEEPALIVE_INTERVAL_NANOS / OBSERVER_KEEPALIVE_SLOTS }
+    };
+
+    if(timer_fd < 0) {
+        perror("timerfd_create");
+        exit(1);
+    }
+
+    timerfd_settime(timer_fd, 0, &spec, NULL);
+
+    event.events = EPOLLIN;
+    event.data.u32 = OBSERVER_TIMER_TAG;
+
+    if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &event) < 0) {
+        perror("epoll_ctl");
+        exit(1);
+    }
+
+    struct sigaction stats_action;
+    memset(&stats_action, 0, sizeof(stats_action));
+    stats_action.sa_handler = handle_stats_signal;
+
+    if(sigaction(SIGUSR1, &stats_action, NULL) < 0) {
+        perror("sigaction");
+        exit(1);
+    }
+
+    struct epoll_event events[OBSERVER_EPOLL_EVENTS];
+    uint64_t timers_elapsed;
+    uint32_t keepalive_slot = 0;
+
+    start_nanos = monotonic_nanos();
+
+    while(sessions_active > 0) {
+        if(stats_requested) {
+            stats_requested = 0;
+            print_observer_stats();
+        }
+
+        int ready = epoll_wait(epoll_fd, events, OBSERVER_EPOLL_EVENTS, -1);
+
+        if(ready < 0) {
+            if(errno != EINTR) {
+                perror("epoll_wait");
+                exit(1);
+            }
+
+            continue;
+        }
+
+        loop_wakeups++;
+
+        for(int i = 0; i < ready; ++i) {
+            uint32_t tag = events[i].data.u32;
+
+            if(tag == OBSERVER_TIMER_TAG) {
+                if(read(timer_fd, &timers_elapsed, sizeof(timers_elapsed)) < 0) {
+                    perror("read");
+                    continue;
+                }
+
+                /* Missed ticks are caught up, but each slot is served
+                 * at most once
+                 */
+                if(timers_elapsed > OBSERVER_KEEPALIVE_SLOTS) {
+                    timers_elapsed = OBSERVER_KEEPALIVE_SLOTS;
+                }
+
+                for(uint64_t k = 0; k < timers_elapsed; ++k) {
+                    handle_keepalive_slot(keepalive_slot);
+                    keepalive_slot = (keepalive_slot + 1) % OBSERVER_KEEPALIVE_SLOTS;
+                }
+            }
+            else if(tag & OBSERVER_OUTPUT_TAG) {
+                uint32_t session_no = tag & ~OBSERVER_OUTPUT_TAG;
+
+                if(sessions[session_no].active) {
+                    handle_output_ready(&sessions[session_no], session_no, events[i].events);
+                }
+            }
+            else if(sessions[tag].active) {
+                handle_server_messages(&sessions[tag], tag);
+            }
+        }
+    }
+
+    fprintf(stderr, "All sessions closed\n");
+    print_observer_stats();
+
+    return 0;
+}
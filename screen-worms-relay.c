@@ -0,0 +1,428 @@
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/poll.h>
+#include <sys/timerfd.h>
+#include <sys/time.h>
+#include "client_protocol.h"
+#include "game_server_protocol.h"
+#include "utils.h"
+
+
+/* Relay connects to the game server as a spectator and re-serves
+ * exactly the same event stream to its own spectators (which can be
+ * other relays), answering their catch-up requests from its own copy
+ * of the game history
+ */
+
+
+/* Number of descriptors polled by relay: descriptors from server game
+ * state (downstream socket, keepalive timer in place of round timer,
+ * client timeout timers) and the upstream socket
+ */
+#define RELAY_POLL_DESCRIPTORS_COUNT     (SERVER_POLL_DESCRIPTORS_COUNT + 1)
+
+
+static char *server_address = "";
+static char *server_port = "2021";
+static char *relay_port = "2022";
+
+
+static char client_dgram_buffer[CLIENT_DGRAM_BUFFER_SIZE];
+static char server_dgram_buffer[MAX_SERVER_UDP_DGRAM_LENGTH + 1];
+
+
+static struct addrinfo addr_hints_server;
+static struct addrinfo *addr_result_server;
+
+
+static
+void print_program_usage(const char *program_name) {
+    fprintf(stderr, "Usage: %s game_server_address [-p game_server_port] "
+                    "[-r relay_port]\n", program_name);
+}
+
+
+static
+void parse_program_arguments(int argc, char *argv[]) {
+    int option = 0;
+
+    while((option = getopt(argc, argv + 1, "p:r:")) != -1) {
+        switch(option) {
+            case 'p':
+                server_port = optarg;
+                break;
+            case 'r':
+                relay_port = optarg;
+                break;
+            default:
+                print_program_usage(argv[0]);
+                exit(1);
+        }
+    }
+}
+
+
+/* Sends spectator datagram (empty player name, no turn) with the number
+ * of the next expected event to the upstream game server
+ */
+static
+void handle_keepalive(client_dgram_t *data, client_game_state_t *upstream) {
+    data->turn_direction = 0;
+    data->next_expected_event_no = upstream->next_expected;
+
+    serialize_client_dgram(data, 0, client_dgram_buffer);
+
+    ssize_t ret_val = sendto(upstream->server_socket,
+                             client_dgram_buffer,
+                             CLIENT_DGRAM_INTEGERS_LEN,
+                             0,
+                             addr_result_server->ai_addr,
+                             addr_result_server->ai_addrlen);
+
+    if(ret_val != CLIENT_DGRAM_INTEGERS_LEN) {
+        perror("sendto");
+    }
+}
+
+
+/* Relay copy of the game history and the first of its events which have
+ * not been relayed yet, passed to mirror_event by decode_server_datagram
+ */
+typedef struct relay_mirror_t relay_mirror_t;
+
+struct relay_mirror_t {
+    server_game_state_t *state;
+    uint32_t first_to_be_relayed;
+};
+
+
+/* Appends event accepted by the upstream decoder to the relay copy of
+ * the game history (called by decode_server_datagram)
+ */
+static
+bool mirror_event(client_game_state_t *upstream, void *argument) {
+    relay_mirror_t *relay_mirror = argument;
+    server_game_state_t *mirror = relay_mirror->state;
+    event_data_t event;
+
+    if(!upstream->data_for_gui.ready_to_send) {
+        /* The only event which is accepted without data for GUI */
+        event.event_type = EVENT_GAME_OVER;
+        enqueue_event(mirror, &event);
+        return true;
+    }
+
+    event.event_type = upstream->data_for_gui.event_type;
+    event.player_number = upstream->data_for_gui.player_no;
+    event.x = upstream->data_for_gui.x;
+    event.y = upstream->data_for_gui.y;
+
+    upstream->data_for_gui.ready_to_send = 0;
+
+    if(event.event_type == EVENT_NEW_GAME) {
+        /* New game, everything is relayed from its beginning */
+        relay_mirror->first_to_be_relayed = 0;
+
+        mirror->game_id = ntohl(upstream->game_id);
+        mirror->events_count = 0;
+        mirror->players_count = upstream->players_count;
+
+        for(uint8_t i = 0; i < upstream->players_count; ++i) {
+            memcpy(mirror->game_primary_player_names[i],
+                   upstream->game_players[i],
+                   MAX_PLAYER_NAME_LENGTH + 1);
+        }
+    }
+
+    enqueue_event(mirror, &event);
+
+    return true;
+}
+
+
+static
+void handle_upstream_message(server_game_state_t *mirror, client_game_state_t *upstream) {
+    ssize_t read_bytes = recvfrom(upstream->server_socket,
+                                  server_dgram_buffer,
+                                  sizeof(server_dgram_buffer),
+                                  0,
+                                  NULL,
+                                  NULL);
+
+    if(read_bytes < 0) {
+        perror("recvfrom");
+        return;
+    }
+
+    relay_mirror_t relay_mirror = {
+        .state = mirror,
+        .first_to_be_relayed = mirror->events_count
+    };
+
+    if(!decode_server_datagram(upstream, server_dgram_buffer, read_bytes, mirror_event, &relay_mirror)) {
+        fprintf(stderr, "Strange data from game server... terminating\n");
+        exit(1);
+    }
+
+    if(relay_mirror.first_to_be_relayed < mirror->events_count) {
+        broadcast_events(mirror, relay_mirror.first_to_be_relayed);
+    }
+}
+
+
+static
+void handle_downstream_timeout(server_game_state_t *mirror, uint8_t client_index) {
+    client_t *client = &mirror->players[client_index];
+
+    if(client->conn.is_connection_active && !client->message) {
+        mirror->backend->stop_client_timer(mirror, client_index);
+
+        client->conn.is_connection_active = false;
+        mirror->connected_players--;
+    }
+
+    client->message = false;
+}
+
+
+static
+void handle_downstream_datagram(server_game_state_t *mirror) {
+    memset(&mirror->receive_address, 0, sizeof(struct sockaddr_in6));
+    mirror->receive_address_length = sizeof(struct sockaddr_in6);
+
+    ssize_t read_bytes = recvfrom(mirror->server_socket,
+                                  mirror->server_buffer,
+                                  sizeof(mirror->server_buffer),
+                                  0,
+                                  (struct sockaddr *) &mirror->receive_address,
+                                  &mirror->receive_address_length);
+
+    if(read_bytes < 0) {
+        perror("recvfrom");
+        return;
+    }
+
+    client_dgram_t dgram;
+
+    if(deserialize_client_dgram(&dgram, mirror->server_buffer, read_bytes) < 0) {
+        return;
+    }
+
+    for(uint8_t i = 0; i < MAX_PLAYERS; ++i) {
+        client_t *client = &mirror->players[i];
+
+        if(client->conn.is_connection_active &&
+           equal_addresses(&client->conn.address, &mirror->receive_address)) {
+
+            if(dgram.session_id >= client->conn.session_id) {
+                client->conn.session_id = dgram.session_id;
+                client->message = true;
+            }
+
+            return;
+        }
+    }
+
+    if(mirror->connected_players == MAX_PLAYERS) {
+        return;
+    }
+
+    /* Every downstream client is a spectator of the relayed game */
+    for(uint8_t i = 0; i < MAX_PLAYERS; ++i) {
+        client_t *client = &mirror->players[i];
+
+        if(!client->conn.is_connection_active) {
+            client->conn.session_id = dgram.session_id;
+            client->conn.is_connection_active = true;
+            client->conn.address = mirror->receive_address;
+            client->conn.address_length = mirror->receive_address_length;
+            client->is_spectator = true;
+            client->message = false;
+
+            mirror->connected_players++;
+            mirror->backend->start_client_timer(mirror, i);
+
+            send_game_data(mirror, dgram.next_expected_event_no, i);
+            return;
+        }
+    }
+}
+
+
+static
+void initialise_mirror(server_game_state_t *mirror, uint16_t port) {
+    memset(mirror, 0, sizeof(server_game_state_t));
+
+    mirror->events_queue = malloc(DEFAULT_EVENTS_QUEUE_SIZE * sizeof(event_data_t));
+    mirror->events_queue_size = DEFAULT_EVENTS_QUEUE_SIZE;
+
+    if(mirror->events_queue == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+
+    mirror->server_socket = socket(AF_INET6, SOCK_DGRAM, 0);
+
+    if(mirror->server_socket < 0) {
+        perror("socket");
+        exit(1);
+    }
+
+    struct sockaddr_in6 relay_addr;
+    memset(&relay_addr, 0, sizeof(struct sockaddr_in6));
+
+    relay_addr.sin6_family = AF_INET6;
+    relay_addr.sin6_addr = in6addr_any;
+    relay_addr.sin6_port = htons(port);
+
+    if(bind(mirror->server_socket, (struct sockaddr *) &relay_addr, sizeof(relay_addr)) < 0) {
+        perror("bind");
+        exit(1);
+    }
+
+    struct itimerspec spec = {{2, 0}, {2, 0}};
+    mirror->timeout_params = spec;
+
+    mirror->backend = &poll_backend;
+    mirror->backend_data = NULL;
+
+    probe_udp_gso(mirror);
+
+    mirror->fds[0].fd = mirror->server_socket;
+    mirror->fds[0].events = POLLIN;
+
+    for(size_t i = 1; i < SERVER_POLL_DESCRIPTORS_COUNT; ++i) {
+        mirror->fds[i].fd = -1;
+        mirror->fds[i].events = POLLIN;
+    }
+}
+
+
+int main(int argc, char *argv[]) {
+    struct timeval tv;
+
+    if(gettimeofday(&tv, NULL) < 0) {
+        perror("gettimeofday");
+        exit(1);
+    }
+
+    if(argc < 2) {
+        print_program_usage(argv[0]);
+        exit(1);
+    }
+
+    parse_program_arguments(argc - 1, argv);
+
+    if(!check_integer(server_port) || !check_integer(relay_port)) {
+        fprintf(stderr, "Bad ports provided (non-digits characters detected)\n");
+        exit(1);
+    }
+
+    server_address = argv[1];
+    addr_hints_server.ai_socktype = SOCK_DGRAM;
+
+    int err = getaddrinfo(server_address,
+                          server_port,
+                          &addr_hints_server,
+                          &addr_result_server);
+
+    if(err != 0) {
+        fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(err));
+        exit(1);
+    }
+
+    server_game_state_t *mirror = malloc(sizeof(server_game_state_t));
+
+    if(mirror == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+
+    initialise_mirror(mirror, atoi(relay_port));
+
+    client_game_state_t upstream;
+    initialise_client_game_state(&upstream);
+
+    upstream.server_socket = socket(addr_result_server->ai_family,
+                                    addr_result_server->ai_socktype,
+                                    addr_result_server->ai_protocol);
+
+    if(upstream.server_socket < 0) {
+        perror("socket");
+        exit(1);
+    }
+
+    upstream.gui_socket = -1;
+    upstream.player_name_len = 0;
+    upstream.game_id = 0;
+    upstream.game_over = true;
+    upstream.played_any = false;
+
+    client_dgram_t data;
+    data.session_id = 1000000 * tv.tv_sec + tv.tv_usec;
+    data.room = 0;
+
+    /* Keepalive timer occupies the slot of round timer, which is not
+     * used by the relay
+     */
+    struct itimerspec spec = { { 0, 30000000 }, { 0, 30000000 } };
+    mirror->fds[1].fd = timerfd_create(CLOCK_MONOTONIC, 0);
+
+    if(mirror->fds[1].fd < 0) {
+        perror("timerfd_create");
+        exit(1);
+    }
+
+    timerfd_settime(mirror->fds[1].fd, 0, &spec, NULL);
+
+    struct pollfd fds[RELAY_POLL_DESCRIPTORS_COUNT];
+    uint64_t timers_elapsed;
+
+    while(1) {
+        memcpy(fds, mirror->fds, sizeof(mirror->fds));
+
+        fds[SERVER_POLL_DESCRIPTORS_COUNT].fd = upstream.server_socket;
+        fds[SERVER_POLL_DESCRIPTORS_COUNT].events = POLLIN;
+        fds[SERVER_POLL_DESCRIPTORS_COUNT].revents = 0;
+
+        if(poll(fds, RELAY_POLL_DESCRIPTORS_COUNT, -1) <= 0) {
+            continue;
+        }
+
+        if(fds[1].revents & POLLIN) {
+            if(read(fds[1].fd, &timers_elapsed, sizeof(timers_elapsed)) < 0) {
+                perror("read");
+            }
+
+            handle_keepalive(&data, &upstream);
+        }
+
+        if(fds[SERVER_POLL_DESCRIPTORS_COUNT].revents & POLLIN) {
+            handle_upstream_message(mirror, &upstream);
+        }
+
+        for(uint8_t i = 0; i < MAX_PLAYERS; ++i) {
+            if(fds[2 + i].revents & POLLIN) {
+                if(read(fds[2 + i].fd, &timers_elapsed, sizeof(timers_elapsed)) < 0) {
+                    perror("read");
+                }
+
+                handle_downstream_timeout(mirror, i);
+            }
+        }
+
+        if(fds[0].revents & POLLIN) {
+            handle_downstream_datagram(mirror);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,233 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+#include "capture.h"
+#include "client_protocol.h"
+#include "game_server_protocol.h"
+#include "utils.h"
+
+
+/* Replays the datagrams captured by the client (see capture.h) through
+ * the decoder of the client as fast as possible: the messages for the GUI
+ * server are prepared exactly as by the client (without prediction) and
+ * written to the output file, if one is given. Prints the time taken per
+ * datagram and per message, for the regression and performance tests of
+ * the decoder
+ */
+
+
+static char *output_file_name = NULL;
+static char *passes_count = "1";
+static char *capture_file_name = NULL;
+
+
+static char output_buffer[GUI_OUTPUT_BUFFER_LENGTH];
+static size_t output_length = 0;
+static int output_fd = -1;
+
+
+static uint64_t messages_prepared = 0;
+static uint64_t message_bytes = 0;
+
+
+static
+void print_program_usage(const char *program_name) {
+    fprintf(stderr, "Usage: %s [-o output_file] [-n number of passes] capture_file\n", program_name);
+}
+
+
+static
+void parse_program_arguments(int argc, char *argv[]) {
+    int option = 0;
+
+    while((option = getopt(argc, argv, "o:n:")) != -1) {
+        switch(option) {
+            case 'o':
+                output_file_name = optarg;
+                break;
+            case 'n':
+                passes_count = optarg;
+                break;
+            default:
+                print_program_usage(argv[0]);
+                exit(1);
+        }
+    }
+
+    if(argc != optind + 1) {
+        print_program_usage(argv[0]);
+        exit(1);
+    }
+
+    capture_file_name = argv[optind];
+}
+
+
+static
+void flush_output(void) {
+    size_t written = 0;
+
+    while(output_fd >= 0 && written < output_length) {
+        ssize_t ret_write = write(output_fd, output_buffer + written, output_length - written);
+
+        if(ret_write < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+
+            perror("write");
+            exit(1);
+        }
+
+        written += ret_write;
+    }
+
+    output_length = 0;
+}
+
+
+static
+bool append_message(client_game_state_t *state, void *argument) {
+    (void) argument;
+
+    if(state->data_for_gui.ready_to_send) {
+        if(output_length + MSG_GUI_BUFFER_LENGTH > GUI_OUTPUT_BUFFER_LENGTH) {
+            flush_output();
+        }
+
+        size_t length = prepare_message(state, output_buffer + output_length);
+
+        output_length += length;
+        message_bytes += length;
+        messages_prepared++;
+
+        state->data_for_gui.ready_to_send = 0;
+    }
+
+    return true;
+}
+
+
+/* Decodes the captured datagram as the client decodes the datagram
+ * received from the game server
+ */
+static
+void replay_datagram(client_game_state_t *state, char *dgram, ssize_t read_bytes) {
+    if(!decode_server_datagram(state, dgram, read_bytes, append_message, NULL)) {
+        fprintf(stderr, "Strange data from game server... terminating\n");
+        exit(1);
+    }
+}
+
+
+int main(int argc, char *argv[]) {
+    parse_program_arguments(argc, argv);
+
+    if(!check_integer(passes_count) || atoi(passes_count) <= 0) {
+        fprintf(stderr, "Bad number of passes provided (has to be a positive integer)\n");
+        exit(1);
+    }
+
+    capture_t *capture = capture_open(capture_file_name);
+
+    if(capture == NULL) {
+        exit(1);
+    }
+
+    if(output_file_name != NULL) {
+        output_fd = open(output_file_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+        if(output_fd < 0) {
+            perror("open");
+            exit(1);
+        }
+    }
+
+    /* Datagrams are decoded in place, the decoder expects them writable
+     * (and one byte longer than the longest datagram, as received)
+     */
+    static char dgram[MAX_SERVER_UDP_DGRAM_LENGTH + 1];
+
+    client_game_state_t *state = malloc(sizeof(client_game_state_t));
+
+    if(state == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+
+    uint32_t passes = atoi(passes_count);
+    uint64_t dgrams_replayed = 0;
+    uint64_t first_receive_nanos = 0;
+    uint64_t last_receive_nanos = 0;
+    uint64_t start = monotonic_nanos();
+
+    for(uint32_t pass = 0; pass < passes; ++pass) {
+        /* Every pass starts as a fresh spectator client */
+        initialise_client_game_state(state);
+
+        state->server_socket = -1;
+        state->gui_socket = output_fd;
+        state->player_name_len = 0;
+        state->game_id = 0;
+        state->next_expected = 0;
+        state->game_over = true;
+        state->played_any = false;
+
+        uint64_t offset = 0;
+        const capture_record_t *record;
+
+        while((record = capture_next(capture, &offset)) != NULL) {
+            uint32_t length = record->length;
+
+            if(length > sizeof(dgram)) {
+                length = sizeof(dgram);
+            }
+
+            memcpy(dgram, (const char *) (record + 1), length);
+            replay_datagram(state, dgram, length);
+
+            if(first_receive_nanos == 0) {
+                first_receive_nanos = record->receive_nanos;
+            }
+
+            last_receive_nanos = record->receive_nanos;
+            dgrams_replayed++;
+        }
+
+        flush_output();
+    }
+
+    uint64_t elapsed = monotonic_nanos() - start;
+
+    fprintf(stderr, "passes: %u, datagrams: %lu, messages: %lu (%lu bytes), "
+                    "captured during: %lu ms\n",
+            passes,
+            dgrams_replayed,
+            messages_prepared,
+            message_bytes,
+            (last_receive_nanos - first_receive_nanos) / 1000000);
+
+    fprintf(stderr, "replay time: %lu ms, per datagram: %lu ns, per message: %lu ns, "
+                    "messages per second: %.0f\n",
+            elapsed / 1000000,
+            dgrams_replayed > 0 ? elapsed / dgrams_replayed : 0,
+            messages_prepared > 0 ? elapsed / messages_prepared : 0,
+            elapsed > 0 ? messages_prepared * 1e9 / elapsed : 0.0);
+
+    if(output_fd >= 0 && close(output_fd) < 0) {
+        perror("close");
+        exit(1);
+    }
+
+    free(state);
+    capture_close(capture);
+
+    return 0;
+}
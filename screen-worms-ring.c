@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include "event_ring.h"
+#include "utils.h"
+
+
+/* Follows the event ring published by the game server (-m option) from
+ * the current position: checks the checksum of every event record and
+ * the continuity of the event numbers within the game, and prints either
+ * every event or (with -s) a summary once per second. The delay (-d, in
+ * microseconds per record) makes the reader slow enough to be overrun by
+ * the server
+ */
+
+
+#define RING_READER_BUFFER_LENGTH                     4096
+#define RING_READER_IDLE_SLEEP_USEC                   1000
+
+
+static char *ring_name = NULL;
+static char *str_delay = "0";
+static bool summary_only = false;
+
+
+static uint64_t records_read = 0;
+static uint64_t bad_checksums = 0;
+static uint64_t gaps = 0;
+static uint64_t overruns = 0;
+
+
+static
+void print_program_usage(const char *program_name) {
+    fprintf(stderr, "Usage: %s [-s] [-d delay per record (usec)] ring_name\n", program_name);
+}
+
+
+static
+void parse_program_arguments(int argc, char *argv[]) {
+    int option = 0;
+
+    while((option = getopt(argc, argv, "sd:")) != -1) {
+        switch(option) {
+            case 's':
+                summary_only = true;
+                break;
+            case 'd':
+                str_delay = optarg;
+                break;
+            default:
+                print_program_usage(argv[0]);
+                exit(1);
+        }
+    }
+
+    if(argc != optind + 1) {
+        print_program_usage(argv[0]);
+        exit(1);
+    }
+
+    ring_name = argv[optind];
+}
+
+
+/* Checks the wire format of the event record: len, event_no, event_type,
+ * event_data and the checksum of all of them but itself
+ */
+static
+bool check_event_record(char *buffer, ssize_t length) {
+    if(length < 13) {
+        return false;
+    }
+
+    uint32_t event_fields_len = ntohl(*(uint32_t *) buffer);
+
+    if((ssize_t) event_fields_len + 8 != length) {
+        return false;
+    }
+
+    uint32_t crc = ntohl(*(uint32_t *) (buffer + 4 + event_fields_len));
+
+    return crc_32(buffer, event_fields_len + 4) == crc;
+}
+
+
+int main(int argc, char *argv[]) {
+    parse_program_arguments(argc, argv);
+
+    if(!check_integer(str_delay)) {
+        fprintf(stderr, "Bad delay provided (has to be a non-negative integer)\n");
+        exit(1);
+    }
+
+    uint32_t delay = atoi(str_delay);
+
+    event_ring_t *ring = event_ring_open(ring_name);
+
+    if(ring == NULL) {
+        fprintf(stderr, "Cannot open event ring %s\n", ring_name);
+        exit(1);
+    }
+
+    static char buffer[RING_READER_BUFFER_LENGTH];
+    event_ring_record_t record_header;
+
+    uint64_t cursor = event_ring_position(ring);
+    uint32_t generation = 0;
+    uint32_t next_event_no = 0;
+    bool following = false;
+
+    uint64_t last_summary = monotonic_nanos();
+    uint64_t records_since_summary = 0;
+
+    while(1) {
+        ssize_t length = event_ring_read(ring, &cursor, &record_header, buffer, sizeof(buffer));
+
+        if(length == 0) {
+            usleep(RING_READER_IDLE_SLEEP_USEC);
+        }
+        else if(length < 0) {
+            /* Events published in the meantime are lost, the numbering
+             * is followed again from the next record
+             */
+            overruns++;
+            following = false;
+
+            if(!summary_only) {
+                printf("overrun, continuing from position %lu\n", cursor);
+            }
+        }
+        else {
+            records_read++;
+            records_since_summary++;
+
+            if(!check_event_record(buffer, length)) {
+                bad_checksums++;
+            }
+
+            if(following && record_header.generation == generation &&
+               record_header.event_no != next_event_no) {
+                gaps++;
+            }
+
+            following = true;
+            generation = record_header.generation;
+            next_event_no = record_header.event_no + 1;
+
+            if(!summary_only) {
+                printf("game %u (generation %u) event %u type %u length %zd\n",
+                       record_header.game_id,
+                       record_header.generation,
+                       record_header.event_no,
+                       length > 8 ? (uint8_t) buffer[8] : 0,
+                       length);
+            }
+
+            if(delay > 0) {
+                usleep(delay);
+            }
+        }
+
+        uint64_t now = monotonic_nanos();
+
+        if(summary_only && now - last_summary >= 1000000000UL) {
+            printf("records: %lu (%lu/s), bad checksums: %lu, gaps: %lu, overruns: %lu\n",
+                   records_read,
+                   records_since_summary * 1000000000UL / (now - last_summary),
+                   bad_checksums,
+                   gaps,
+                   overruns);
+            fflush(stdout);
+
+            last_summary = now;
+            records_since_summary = 0;
+        }
+    }
+
+    event_ring_close(ring, ring_name);
+
+    return 0;
+}
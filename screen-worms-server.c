@@ -5,12 +5,27 @@
 #include <sys/poll.h>
 #include <sys/timerfd.h>
 #include <math.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <limits.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
 #include "game_server_protocol.h"
 #include "client_protocol.h"
+#include "server_uring.h"
+#include "server_threads.h"
+#include "server_rooms.h"
+#include "server_bots.h"
+#include "server_lowlatency.h"
+#include "log.h"
+#include "trace.h"
 #include "utils.h"
 
 
 #define MAX_PLAYERS         25
+#define MAX_WORKERS         64
 
 
 static char *str_port = NULL;
@@ -19,12 +34,36 @@ static char *str_turning_speed = NULL;
 static char *str_rounds_per_sec = NULL;
 static char *str_width = NULL;
 static char *str_height = NULL;
+static char *str_event_ring = NULL;
+static char *str_workers = NULL;
+static char *str_rooms = NULL;
+static char *str_tick_threads = NULL;
+static char *str_bots = NULL;
+static int arena_flags = 0;
+static char *str_core = NULL;
+static char *str_log_level = NULL;
+static char *trace_file = NULL;
+static bool use_fifo = false;
+static bool use_io_uring = false;
+static bool use_io_thread = false;
+static bool disable_gso = false;
+static bool disable_rate_limit = false;
+
+
+/* Incremented by SIGUSR1 handler, server statistics are printed by each of
+ * the games which has not handled the latest request yet
+ */
+static volatile sig_atomic_t stats_requests = 0;
 
 
 static
 void print_program_usage(const char *program_name) {
     fprintf(stderr, "Usage: %s [-p port_number] [-s seed] [-t turning_speed] "
-                    "[-v rounds per second] [-w board width] [-h board height]\n", program_name);
+                    "[-v rounds per second] [-w board width] [-h board height] [-u] [-i] "
+                    "[-m shared memory event ring name] [-n number of workers] "
+                    "[-r number of rooms] [-j number of tick threads] [-b number of bots] "
+                    "[-g] [-l] [-c core of low-latency mode] [-f] [-d log level] "
+                    "[-x trace file] [-o] [-a]\n", program_name);
 }
 
 
@@ -32,7 +71,7 @@ static
 void parse_program_arguments(int argc, char *argv[]) {
     int option = 0;
 
-    while((option = getopt(argc, argv, "p:s:t:v:w:h:")) != -1) {
+    while((option = getopt(argc, argv, "p:s:t:v:w:h:uim:n:r:j:b:glc:fd:x:oa")) != -1) {
         switch(option) {
             case 'p':
                 str_port = optarg;
@@ -52,6 +91,51 @@ void parse_program_arguments(int argc, char *argv[]) {
             case 'h':
                 str_height = optarg;
                 break;
+            case 'u':
+                use_io_uring = true;
+                break;
+            case 'i':
+                use_io_thread = true;
+                break;
+            case 'm':
+                str_event_ring = optarg;
+                break;
+            case 'n':
+                str_workers = optarg;
+                break;
+            case 'r':
+                str_rooms = optarg;
+                break;
+            case 'j':
+                str_tick_threads = optarg;
+                break;
+            case 'b':
+                str_bots = optarg;
+                break;
+            case 'g':
+                arena_flags |= ARENA_HUGE_PAGES;
+                break;
+            case 'l':
+                arena_flags |= ARENA_LOCKED;
+                break;
+            case 'c':
+                str_core = optarg;
+                break;
+            case 'f':
+                use_fifo = true;
+                break;
+            case 'd':
+                str_log_level = optarg;
+                break;
+            case 'x':
+                trace_file = optarg;
+                break;
+            case 'o':
+                disable_gso = true;
+                break;
+            case 'a':
+                disable_rate_limit = true;
+                break;
             default:
                 print_program_usage(argv[0]);
                 exit(1);
@@ -65,84 +149,260 @@ void parse_program_arguments(int argc, char *argv[]) {
 }
 
 
+/* Publishes events since specified event_no to the shared memory ring
+ * (if there is one) in the same form in which they are sent in datagrams
+ */
 static
-void handle_timers(server_game_state_t *state) {
-    ssize_t read_ret_val;
+void publish_events(server_game_state_t *state, uint32_t since_event) {
+    char record[MAX_SERVER_UDP_DGRAM_LENGTH];
+
+    if(state->event_ring == NULL) {
+        return;
+    }
+
+    for(uint32_t event_no = since_event; event_no < state->events_count; ++event_no) {
+        ssize_t record_size = serialize_event_record(state,
+                                                     event_no,
+                                                     record,
+                                                     sizeof(record));
+
+        event_ring_publish(state->event_ring, state->game_id, event_no, record, record_size);
+    }
+}
+
+
+/* Initiates the game and publishes its first events
+ */
+static
+void start_game(server_game_state_t *state) {
+    initiate_game(state);
+    publish_events(state, 0);
+}
+
+
+static
+void handle_client_timeout(server_game_state_t *state, uint8_t client_index) {
     ssize_t disconnected_name_len;
-    ssize_t client_index = 0;
-    uint64_t timers_elapsed;
 
-    for(int i = 2; i < SERVER_POLL_DESCRIPTORS_COUNT; ++i) {
-        if(state->fds[i].revents & POLLIN) {
-            read_ret_val =  read(state->fds[i].fd,
-                                 &timers_elapsed,
-                                 sizeof(timers_elapsed));
+    if(state->players[client_index].conn.is_connection_active &&
+       !state->players[client_index].is_bot &&
+       !state->players[client_index].message) {
 
-            if(read_ret_val < 0) {
-                perror("read");
-            }
+        //fprintf(stderr, "Disconnecting...\n");
 
-            client_index = i - 2;
+        /* Stop the timer which handles current client slot timeouts
+         */
+        state->backend->stop_client_timer(state, client_index);
 
+        /* Disable connection with client and drop datagrams which are
+         * still waiting for it
+         */
+        state->players[client_index].conn.is_connection_active = false;
+        reset_outbound_queue(state, client_index);
 
-            if(state->players[client_index].conn.is_connection_active &&
-               !state->players[client_index].message) {
+        /* Decrease the number of connected players */
+        state->connected_players--;
 
-                //fprintf(stderr, "Disconnecting...\n");
+        /* Length of the name of the players which is being timeouted at the
+         * moment
+         */
+        disconnected_name_len = strlen(state->players[client_index].name);
 
-                /* Close the descriptor corresponding to the timer which
-                 * handles current client slot timeouts
-                 */
-                if(close(state->fds[i].fd) < 0) {
-                    perror("close");
-                }
+        /* Set client name buffer to NUL bytes
+         */
+        memset(state->players[client_index].name, 0, MAX_PLAYER_NAME_LENGTH + 1);
 
-                /* Disable connection with client */
-                state->players[client_index].conn.is_connection_active = false;
+        /* Take some actions when disconnect happens during waiting
+         * for players before new game can begin
+         */
+        if(state->game_status == GAME_STATE_WAITING_FOR_PLAYERS) {
+            if(state->players[client_index].ready) {
+                state->players[client_index].ready = false;
+                state->ready_players--;
+            }
 
-                /* Decrease the number of connected players */
-                state->connected_players--;
+            if(disconnected_name_len > 0) {
+                state->players_count--;
+            }
 
-                /* Length of the name of the players which is being timeouted at the
-                 * moment
-                 */
-                disconnected_name_len = strlen(state->players[client_index].name);
+            state->players[client_index].ready = false;
 
-                /* Set client name buffer to NUL bytes
-                 */
-                memset(state->players[client_index].name, 0, MAX_PLAYER_NAME_LENGTH + 1);
+            if(state->ready_players == state->players_count &&
+               state->ready_players > 1) {
 
-                /* Take some actions when disconnect happens during waiting
-                 * for players before new game can begin
+                /* Initiate new game as all remaining players have been
+                 * marked as ready for participating in new game and there
+                 * are at least two of such players
                  */
-                if(state->game_status == GAME_STATE_WAITING_FOR_PLAYERS) {
-                    if(state->players[client_index].ready) {
-                        state->players[client_index].ready = false;
-                        state->ready_players--;
-                    }
+                start_game(state);
+            }
+        }
+    }
 
-                    if(disconnected_name_len > 0) {
-                        state->players_count--;
-                    }
+    /* Reset the status of acquired message (for further timeout
+     * checks)
+     */
+    state->players[client_index].message = false;
+}
 
-                    state->players[client_index].ready = false;
 
-                    if(state->ready_players == state->players_count &&
-                       state->ready_players > 1) {
+static
+void handle_stats_signal(int signal_number) {
+    (void) signal_number;
+    stats_requests++;
+}
 
-                        /* Initiate new game as all remaining players have been
-                         * marked as ready for participating in new game and there
-                         * are at least two of such players
-                         */
-                        initiate_game(state);
-                    }
+
+/* Creates the server socket bound to given port on all addresses. With
+ * SO_REUSEPORT set (second argument) many sockets can be bound to the same
+ * port and the kernel distributes datagrams among them
+ */
+static
+int create_server_socket(uint32_t server_port, bool reuse_port) {
+    int sock = socket(AF_INET6, SOCK_DGRAM, 0);
+
+    if(sock < 0) {
+        perror("socket");
+        exit(1);
+    }
+
+    int option_value = 1;
+
+    if(reuse_port && setsockopt(sock, SOL_SOCKET, SO_REUSEPORT,
+                                &option_value, sizeof(option_value)) < 0) {
+        perror("setsockopt");
+        exit(1);
+    }
+
+    struct sockaddr_in6 server_addr;
+    memset(&server_addr, 0, sizeof(struct sockaddr_in6));
+
+    server_addr.sin6_family = AF_INET6;
+    server_addr.sin6_addr = in6addr_any;
+    server_addr.sin6_port = htons(server_port);
+
+    if(bind(sock, (struct sockaddr *) &server_addr, sizeof(server_addr)) < 0) {
+        perror("bind");
+        exit(1);
+    }
+
+    return sock;
+}
+
+
+/* Binds the sockets of all workers to the same port and forks the workers.
+ * Returns the socket of the worker in the worker process (and stores its
+ * index under the third argument). The parent process supervises the workers
+ * and never returns
+ *
+ * The kernel picks the socket of the group by the hash of the source and
+ * destination addresses and ports, so a given client always lands on the
+ * same worker as long as the group does not change - all the sockets are
+ * bound before any of the workers starts and the whole server is stopped
+ * when any of the workers exits
+ */
+static
+int start_workers(uint32_t server_port, uint32_t workers_count, uint32_t *worker_index) {
+    int sockets[MAX_WORKERS];
+    pid_t workers[MAX_WORKERS];
+
+    for(uint32_t i = 0; i < workers_count; ++i) {
+        sockets[i] = create_server_socket(server_port, true);
+    }
+
+    pid_t parent = getpid();
+
+    for(uint32_t i = 0; i < workers_count; ++i) {
+        workers[i] = fork();
+
+        if(workers[i] < 0) {
+            perror("fork");
+            exit(1);
+        }
+
+        if(workers[i] == 0) {
+            /* Workers are stopped together with the parent */
+            if(prctl(PR_SET_PDEATHSIG, SIGTERM) < 0 || getppid() != parent) {
+                exit(1);
+            }
+
+            for(uint32_t j = 0; j < workers_count; ++j) {
+                if(j != i) {
+                    close(sockets[j]);
+                }
+            }
+
+            *worker_index = i;
+            return sockets[i];
+        }
+    }
+
+    for(uint32_t i = 0; i < workers_count; ++i) {
+        close(sockets[i]);
+    }
+
+    /* Statistics requests are passed on to the workers */
+    struct sigaction stats_action;
+    memset(&stats_action, 0, sizeof(stats_action));
+    stats_action.sa_handler = handle_stats_signal;
+
+    if(sigaction(SIGUSR1, &stats_action, NULL) < 0) {
+        perror("sigaction");
+        exit(1);
+    }
+
+    sig_atomic_t stats_requests_forwarded = 0;
+
+    while(1) {
+        int status;
+        pid_t finished = waitpid(-1, &status, 0);
+
+        if(finished < 0 && errno == EINTR) {
+            if(stats_requests != stats_requests_forwarded) {
+                stats_requests_forwarded = stats_requests;
+
+                for(uint32_t i = 0; i < workers_count; ++i) {
+                    kill(workers[i], SIGUSR1);
                 }
             }
 
-            /* Reset the status of acquired message (for further timeout
-             * checks)
-             */
-            state->players[client_index].message = false;
+            continue;
+        }
+
+        if(finished < 0) {
+            perror("waitpid");
+            exit(1);
+        }
+
+        fprintf(stderr, "Worker %d exited, stopping the server\n", finished);
+
+        for(uint32_t i = 0; i < workers_count; ++i) {
+            if(workers[i] != finished) {
+                kill(workers[i], SIGTERM);
+            }
+        }
+
+        exit(1);
+    }
+}
+
+
+static
+void handle_timers(server_game_state_t *state) {
+    ssize_t read_ret_val;
+    uint64_t timers_elapsed;
+
+    for(int i = 2; i < SERVER_POLL_DESCRIPTORS_COUNT; ++i) {
+        if(state->fds[i].revents & POLLIN) {
+            read_ret_val =  read(state->fds[i].fd,
+                                 &timers_elapsed,
+                                 sizeof(timers_elapsed));
+
+            if(read_ret_val < 0) {
+                log_error(LOG_ERROR, "read");
+            }
+
+            handle_client_timeout(state, i - 2);
         }
     }
 }
@@ -168,10 +428,15 @@ void handle_new_client(server_game_state_t *state,
     }
 
     /* Update connection data for the new player */
+    reset_outbound_queue(state, index_for_player);
     state->players[index_for_player].conn.session_id = dgram->session_id;
     state->players[index_for_player].conn.is_connection_active = true;
     state->players[index_for_player].conn.address = state->receive_address;
     state->players[index_for_player].conn.address_length = state->receive_address_length;
+    state->players[index_for_player].turn_change_nanos = 0;
+    state->players[index_for_player].input_latency_samples = 0;
+    state->players[index_for_player].input_latency_total = 0;
+    state->players[index_for_player].input_latency_max = 0;
 
     /* Increase the number of connected players */
     state->connected_players++;
@@ -202,28 +467,30 @@ void handle_new_client(server_game_state_t *state,
      */
     memcpy(state->players[index_for_player].name, dgram->player_name, name_length);
 
-    /* Set up descriptor for newly connected client timeout clock
+    /* Setup timeout timer for the newly connected client
      */
-    if((state->fds[2 + index_for_player].fd = timerfd_create(CLOCK_MONOTONIC,  0)) < 0) {
-        perror("timerfd_create");
-    }
+    state->backend->start_client_timer(state, index_for_player);
 
-    /* Setup timeout timer for the newly connected client
+    /* Until the client proves that it receives datagrams sent to its address
+     * only a limited part of the game history is sent to it
      */
-    if(timerfd_settime(state->fds[2 + index_for_player].fd,
-                       0, &state->timeout_params,
-                       NULL) < 0) {
+    client_t *client = &state->players[index_for_player];
 
-        perror("timerfd_settime");
-    }
+    client->catchup_from = dgram->next_expected_event_no;
+    client->catchup_end = send_limited_game_data(state, dgram->next_expected_event_no,
+                                                 index_for_player, UNVERIFIED_CATCHUP_BYTES);
+    client->catchup_game_id = state->game_id;
+    client->verified = client->catchup_end >= state->events_count;
 
-    send_game_data(state, dgram->next_expected_event_no, index_for_player);
+    if(!client->verified) {
+        state->stats.catchups_capped++;
+    }
 
     if(state->game_status == GAME_STATE_WAITING_FOR_PLAYERS &&
        state->ready_players == state->players_count &&
        state->players_count > 1) {
 
-        initiate_game(state);
+        start_game(state);
     }
 }
 
@@ -274,21 +541,10 @@ void handle_existing_client(server_game_state_t *state,
         memset(state->players[addr_index].name, 0, MAX_PLAYER_NAME_LENGTH + 1);
         memcpy(state->players[addr_index].name, dgram->player_name, name_length);
 
-        if(close(state->fds[2 + addr_index].fd) < 0) {
-            perror("close");
-        }
-
-        /* Associate new clock descriptor with newly opened client session
+        /* Associate new timeout timer with newly opened client session
          */
-        if((state->fds[2 + addr_index].fd = timerfd_create(CLOCK_MONOTONIC, 0)) < 0) {
-            perror("timerfd_create");
-        }
-
-        /* And set timeout timer to work
-         */
-        if(timerfd_settime(state->fds[2 + addr_index].fd, 0, &state->timeout_params, NULL) < 0) {
-            perror("timerfd_settime");
-        }
+        state->backend->stop_client_timer(state, addr_index);
+        state->backend->start_client_timer(state, addr_index);
     }
     else if(dgram->session_id < state->players[addr_index].conn.session_id) {
         /* Ignore datagrams with smaller session_id as in the task
@@ -315,6 +571,15 @@ void handle_existing_client(server_game_state_t *state,
             if(!state->players[addr_index].is_spectator &&
                state->alive[addr_index]) {
 
+                /* The latency of the change is measured until the first pixel of
+                 * the worm is sent (later changes before it are not measured)
+                 */
+                if(dgram->turn_direction != state->players[addr_index].turn_direction &&
+                   state->players[addr_index].turn_change_nanos == 0) {
+
+                    state->players[addr_index].turn_change_nanos = state->receive_nanos;
+                }
+
                 /* Update client's worm direction if the client is participating in the game
                  * (is not a spectator) and is alive
                  */
@@ -326,33 +591,40 @@ void handle_existing_client(server_game_state_t *state,
          * has been received from the client
          */
         state->players[addr_index].message = true;
-    }
-}
 
+        /* Send the events again from the one the client is waiting for if
+         * the ones sent previously have been dropped
+         */
+        if(state->players[addr_index].resync_needed) {
+            resync_client(state, addr_index, dgram->next_expected_event_no);
+        }
 
-static
-void handle_client_datagram(server_game_state_t *state) {
-    memset(&state->receive_address, 0, sizeof(struct sockaddr_in6));
-    state->receive_address_length = sizeof(struct sockaddr_in6);
+        /* Requesting an event from the capped catch-up verifies the address,
+         * the rest of the game history is sent then
+         */
+        client_t *client = &state->players[addr_index];
 
-    ssize_t read_bytes = recvfrom(state->server_socket,
-                                  state->server_buffer,
-                                  sizeof(state->server_buffer),
-                                  0,
-                                  (struct sockaddr *) &state->receive_address,
-                                  &state->receive_address_length);
+        if(!client->verified &&
+           client->catchup_game_id == state->game_id &&
+           dgram->next_expected_event_no > client->catchup_from &&
+           dgram->next_expected_event_no <= client->catchup_end) {
 
-    if(read_bytes < 0) {
-        perror("recvfrom");
+            client->verified = true;
+            send_game_data(state, client->catchup_end, addr_index);
+        }
     }
+}
 
-    client_dgram_t dgram;
 
-    ssize_t ret_val = deserialize_client_dgram(&dgram, state->server_buffer, read_bytes);
+/* Applies the datagram (already decoded) which has been received from
+ * the address stored in receive_address field
+ */
+static
+void apply_client_datagram(server_game_state_t *state,
+                           ssize_t read_bytes,
+                           client_dgram_t *dgram) {
 
-    if(ret_val < 0) {
-        return;
-    }
+    uint64_t trace_start_time = trace_enabled ? monotonic_nanos() : 0;
 
     ssize_t name_length = read_bytes - CLIENT_DGRAM_INTEGERS_LEN;
 
@@ -361,7 +633,7 @@ void handle_client_datagram(server_game_state_t *state) {
 
     for(uint8_t i = 0; i < MAX_PLAYERS; ++i) {
         if(name_length > 0 && (strlen(state->players[i].name) == (size_t) name_length) &&
-           strncmp(state->players[i].name, dgram.player_name, name_length) == 0) {
+           strncmp(state->players[i].name, dgram->player_name, name_length) == 0) {
             exists_name = true;
         }
 
@@ -373,14 +645,71 @@ void handle_client_datagram(server_game_state_t *state) {
     }
 
     if(addr_index < MAX_PLAYERS) {
-        handle_existing_client(state, addr_index, read_bytes, &dgram);
+        handle_existing_client(state, addr_index, read_bytes, dgram);
     }
     else if(!exists_name) {
-        handle_new_client(state, read_bytes, &dgram);
+        handle_new_client(state, read_bytes, dgram);
+    }
+
+    if(trace_enabled) {
+        trace_record(TRACE_CLIENT_DATAGRAM, state->room_id,
+                     addr_index < MAX_PLAYERS ? addr_index : TRACE_NO_CLIENT,
+                     state->stats.rounds, trace_start_time,
+                     read_bytes, dgram->turn_direction, dgram->next_expected_event_no);
     }
 }
 
 
+/* Processes the datagram which has been received from the address stored
+ * in receive_address field and copied to the server buffer
+ */
+static
+void process_client_datagram(server_game_state_t *state, ssize_t read_bytes) {
+    client_dgram_t dgram;
+
+    /* Drop the datagram before parsing it if its source exceeded its rate */
+    if(state->rate_limiter != NULL) {
+        if(!rate_limiter_allow(state->rate_limiter, &state->receive_address, monotonic_nanos())) {
+            state->stats.datagrams_rate_limited++;
+            return;
+        }
+    }
+
+    ssize_t datagram_size = deserialize_client_dgram(&dgram, state->server_buffer, read_bytes);
+
+    /* A single game is hosted outside of the rooms mode */
+    if(datagram_size < 0 || dgram.room != state->room_id) {
+        return;
+    }
+
+    apply_client_datagram(state, datagram_size, &dgram);
+}
+
+
+static
+void handle_client_datagram(server_game_state_t *state) {
+    memset(&state->receive_address, 0, sizeof(struct sockaddr_in6));
+    state->receive_address_length = sizeof(struct sockaddr_in6);
+
+    ssize_t read_bytes = receive_datagram(state->server_socket,
+                                          state->server_buffer,
+                                          sizeof(state->server_buffer),
+                                          &state->receive_address,
+                                          &state->receive_address_length,
+                                          &state->receive_nanos);
+
+    if(read_bytes < 0) {
+        if(errno != EAGAIN && errno != EWOULDBLOCK) {
+            log_error(LOG_ERROR, "recvmsg");
+        }
+
+        return;
+    }
+
+    process_client_datagram(state, read_bytes);
+}
+
+
 static
 void handle_board_update(server_game_state_t *state) {
     int32_t x_after_move;
@@ -390,6 +719,18 @@ void handle_board_update(server_game_state_t *state) {
 
     uint32_t first_bo_be_broadcast = state->events_count;
 
+    uint64_t trace_start_time = trace_enabled ? monotonic_nanos() : 0;
+
+    state->stats.rounds++;
+
+    if(state->bots_count > 0) {
+        uint64_t steering_start = monotonic_nanos();
+
+        steer_bots(state);
+
+        state->stats.bots_nanos += monotonic_nanos() - steering_start;
+    }
+
     for(uint8_t i = 0; i < MAX_PLAYERS; ++i) {
         if(!state->players[i].is_playing) {
             continue;
@@ -457,12 +798,12 @@ void handle_board_update(server_game_state_t *state) {
                 current_event.event_type = EVENT_GAME_OVER;
                 enqueue_event(state, &current_event);
 
-                if(close(state->fds[1].fd) < 0) {
-                    perror("close");
+                /* Bots start the next game on one of the following ticks */
+                if(state->bots_count == 0) {
+                    state->backend->stop_round_timer(state);
+                    state->last_round_start = 0;
                 }
 
-                state->fds[1].fd = -1;
-
                 update_players_after_game(state);
                 break;
             }
@@ -473,6 +814,272 @@ void handle_board_update(server_game_state_t *state) {
      * players (and spectators)
      */
     broadcast_events(state, first_bo_be_broadcast);
+    publish_events(state, first_bo_be_broadcast);
+
+    if(trace_enabled) {
+        trace_record(TRACE_BOARD_UPDATE, state->room_id, TRACE_NO_CLIENT,
+                     state->stats.rounds, trace_start_time,
+                     first_bo_be_broadcast, state->events_count - first_bo_be_broadcast,
+                     state->alive_players_count);
+    }
+}
+
+
+static
+void handle_round_tick(server_game_state_t *state) {
+    uint64_t tick_start = monotonic_nanos();
+
+    if(state->last_round_start != 0) {
+        uint64_t period = timespec_nanos(&state->round_params.it_interval);
+        uint64_t interval = tick_start - state->last_round_start;
+
+        histogram_record(&state->stats.jitter_histogram,
+                         interval > period ? interval - period : period - interval);
+    }
+
+    state->last_round_start = tick_start;
+
+    if(state->game_status == GAME_STATE_GAME_STARTED) {
+        log_message(LOG_DEBUG, "Updating the board...", 0, 0);
+        handle_board_update(state);
+
+        uint64_t tick_duration = monotonic_nanos() - tick_start;
+
+        state->stats.tick_nanos += tick_duration;
+        histogram_record(&state->stats.tick_histogram, tick_duration);
+    }
+    else if(state->bots_count > 0 &&
+            state->ready_players == state->players_count &&
+            state->players_count > 1) {
+
+        /* The round timer keeps running while there are bots, the game
+         * starts as soon as the human players (if any) are ready
+         */
+        start_game(state);
+    }
+
+    if(trace_enabled) {
+        trace_record(TRACE_ROUND_TICK, state->room_id, TRACE_NO_CLIENT,
+                     state->stats.rounds, tick_start,
+                     state->game_status, state->events_count, state->players_count);
+    }
+}
+
+
+/* Pre-faults the next chunk of the event queue allocated from the arena
+ * once less than ARENA_GROWTH_SIZE bytes past the last event are faulted,
+ * so that the events of the following rounds (at most a few per player)
+ * are always written to faulted pages. Called between the rounds, never
+ * inside of the tick
+ */
+static
+void prefault_events_queue(server_game_state_t *state) {
+    if(state->arena.base == NULL) {
+        return;
+    }
+
+    size_t queue_end = (char *) (state->events_queue + state->events_count) - state->arena.base;
+
+    if(state->arena.faulted - queue_end < ARENA_GROWTH_SIZE) {
+        arena_prefault(&state->arena, queue_end + ARENA_GROWTH_SIZE);
+    }
+}
+
+
+static
+void handle_stats_request(server_game_state_t *state) {
+    uint32_t requests = __atomic_load_n(&stats_requests, __ATOMIC_RELAXED);
+
+    if(state->stats_requests_handled != requests) {
+        state->stats_requests_handled = requests;
+        print_server_stats(state);
+    }
+}
+
+
+static
+void handle_iteration_done(server_game_state_t *state) {
+    prefault_events_queue(state);
+    handle_stats_request(state);
+}
+
+
+static const server_event_handlers_t server_handlers = {
+    .client_datagram = process_client_datagram,
+    .client_update = apply_client_datagram,
+    .round_tick = handle_round_tick,
+    .client_timeout = handle_client_timeout,
+    .iteration_done = handle_iteration_done
+};
+
+
+/* Allocates and initialises the state of a single game (room) hosted on
+ * the socket passed as the first argument, with given number of bots
+ * among its players. The state uses poll backend and has no rate limiter.
+ * Exits the program on failure
+ */
+static
+server_game_state_t *create_game_state(int sock,
+                                       uint32_t seed,
+                                       const game_params_t *game_params,
+                                       uint16_t room_id,
+                                       uint8_t bots_count,
+                                       const char *event_ring_name) {
+
+    /* The state, the board and the event queue of the longest possible
+     * game are allocated from a single arena, so that the rounds never
+     * allocate memory. The arena is pre-faulted up to the usual length of
+     * the game history, the rest of the queue is only reserved address
+     * space and is pre-faulted in chunks as the history grows
+     */
+    uint32_t board_dimension_x = game_params->board_dimension_x;
+    uint32_t board_dimension_y = game_params->board_dimension_y;
+    uint32_t events_queue_size = max_game_events(game_params) + 2;
+    uint32_t prefaulted_events = events_queue_size < PREFAULTED_EVENTS_QUEUE_SIZE ?
+                                 events_queue_size : PREFAULTED_EVENTS_QUEUE_SIZE;
+
+    size_t fixed_size = arena_aligned_size(sizeof(server_game_state_t)) +
+                        arena_aligned_size(board_dimension_x * sizeof(bool *)) +
+                        arena_aligned_size((size_t) board_dimension_x * board_dimension_y * sizeof(bool));
+
+    size_t arena_size = fixed_size + arena_aligned_size((size_t) events_queue_size * sizeof(event_data_t));
+
+    arena_t arena;
+
+    if(!arena_init(&arena, arena_size, fixed_size + prefaulted_events * sizeof(event_data_t), arena_flags)) {
+        exit(1);
+    }
+
+    /* Allocate memory for server_game_state_t structure */
+    server_game_state_t *state = arena_alloc(&arena, sizeof(server_game_state_t));
+
+    memset(&state->receive_address, 0, sizeof(struct sockaddr_in6));
+
+
+    /* Initialise the game state with the values that will
+     * not change thereafter (board dimensions etc.)
+     */
+    state->game_params = *game_params;
+
+
+    /* Allocate the memory for game board, the columns are consecutive
+     */
+    state->game_board = arena_alloc(&arena, board_dimension_x * sizeof(bool *));
+
+    bool *board_fields = arena_alloc(&arena, (size_t) board_dimension_x * board_dimension_y * sizeof(bool));
+
+    for(uint32_t i = 0; i < board_dimension_x; ++i) {
+        state->game_board[i] = board_fields + (size_t) i * board_dimension_y;
+    }
+
+
+    /* Initialise the game state with default values for the
+     * fields that will be changing
+     */
+    state->ready_players = 0;
+    state->players_count = 0;
+    state->alive_players_count = 0;
+    state->connected_players = 0;
+    state->events_count = 0;
+    state->bots_count = 0;
+
+    state->random.seed = seed;
+    state->random.seed_no = 0;
+
+    state->game_status = GAME_STATE_WAITING_FOR_PLAYERS;
+
+    /* Initialise data for the players */
+    for(uint8_t i = 0; i < MAX_PLAYERS; ++i) {
+        state->players[i].conn.is_connection_active = false;
+        state->players[i].is_playing = false;
+        state->players[i].is_spectator = false;
+        state->players[i].message = false;
+        state->players[i].is_bot = false;
+
+        state->alive[i] = true;
+
+        /* By default fill each of name buffers with ASCII NUL bytes */
+        memset(state->players[i].name, 0, MAX_PLAYER_NAME_LENGTH + 1);
+        memset(state->game_primary_player_names[i], 0, MAX_PLAYER_NAME_LENGTH + 1);
+
+        reset_outbound_queue(state, i);
+    }
+
+    add_bots(state, bots_count);
+
+    memset(&state->stats, 0, sizeof(server_stats_t));
+    histogram_reset(&state->stats.tick_histogram);
+    histogram_reset(&state->stats.jitter_histogram);
+    histogram_reset(&state->stats.input_latency_histogram);
+
+    state->last_round_start = 0;
+
+    state->stats_requests_handled = stats_requests;
+    state->outbound_first_client = 0;
+    state->rate_limiter = NULL;
+
+    state->events_queue = arena_alloc(&arena, (size_t) events_queue_size * sizeof(event_data_t));
+    state->events_queue_size = events_queue_size;
+
+    state->arena = arena;
+
+    prefault_events_queue(state);
+
+    state->server_socket = sock;
+    state->room_id = room_id;
+
+    /* Check whether catch-up and multi-datagram rounds can be handed
+     * to the kernel as single segmented buffers (unless -o turns the
+     * segmentation offload off)
+     */
+    if(disable_gso) {
+        state->gso_supported = false;
+    }
+    else {
+        probe_udp_gso(state);
+    }
+    enable_receive_timestamps(state);
+
+
+    double relay_time = 1 / (double) state->game_params.rounds_per_sec;
+    uint32_t relay_millis = 1000 * relay_time;
+    uint32_t relay_nanos = relay_millis * (uint32_t) MILLIS_TO_NANO_MULTIPLIER;
+
+
+    struct itimerspec spec = {{2, 0}, {2, 0}};
+    struct itimerspec spec_moves = { {0, relay_nanos}, {0, relay_nanos} };
+
+
+    /* Save timeout parameters specification in server data structure */
+    state->timeout_params = spec;
+    state->round_params = spec_moves;
+
+
+    state->fds[0].fd = sock;
+    state->fds[0].events = POLLIN;
+    state->fds[0].revents = 0;
+
+    for(size_t i = 1; i < SERVER_POLL_DESCRIPTORS_COUNT; ++i) {
+        state->fds[i].fd = -1;
+        state->fds[i].events = POLLIN;
+        state->fds[i].revents = 0;
+    }
+
+
+    state->backend = &poll_backend;
+    state->backend_data = NULL;
+
+    state->event_ring = NULL;
+
+    if(event_ring_name != NULL) {
+        state->event_ring = event_ring_create(event_ring_name, EVENT_RING_DEFAULT_CAPACITY);
+
+        if(state->event_ring == NULL || !event_ring_unlink_at_exit(event_ring_name)) {
+            exit(1);
+        }
+    }
+
+    return state;
 }
 
 
@@ -482,7 +1089,10 @@ int main(int argc, char *argv[]) {
 
     if(!check_integer(str_port)          || !check_integer(str_seed)           ||
        !check_integer(str_turning_speed) || !check_integer(str_rounds_per_sec) ||
-       !check_integer(str_width)         || !check_integer(str_height)) {
+       !check_integer(str_width)         || !check_integer(str_height)         ||
+       !check_integer(str_workers)       || !check_integer(str_rooms)          ||
+       !check_integer(str_tick_threads)  || !check_integer(str_bots)           ||
+       !check_integer(str_core)          || !check_integer(str_log_level)) {
 
         print_program_usage(argv[0]);
         exit(1);
@@ -508,6 +1118,10 @@ int main(int argc, char *argv[]) {
     uint32_t rounds_per_sec = str_rounds_per_sec ? atoi(str_rounds_per_sec) : DEFAULT_ROUNDS_PER_SEC;
     uint32_t board_dimension_x = str_width ? atoi(str_width) : DEFAULT_BOARD_WIDTH;
     uint32_t board_dimension_y = str_height ? atoi(str_height) : DEFAULT_BOARD_HEIGHT;
+    uint32_t workers_count = str_workers ? atoi(str_workers) : 1;
+    uint32_t rooms_count = str_rooms ? atoi(str_rooms) : 1;
+    uint32_t bots_count = str_bots ? atoi(str_bots) : 0;
+    uint32_t log_level = str_log_level ? atoi(str_log_level) : LOG_DEFAULT_LEVEL;
 
 
     if(board_dimension_x > MAX_X_SIZE || board_dimension_y > MAX_Y_SIZE ||
@@ -531,163 +1145,270 @@ int main(int argc, char *argv[]) {
     }
 
 
-    /* Allocate memory for server_game_state_t structure */
-    server_game_state_t *state = malloc(sizeof(server_game_state_t));
-
-    if(state == NULL) {
-        perror("malloc");
+    if(workers_count > MAX_WORKERS || workers_count == 0) {
+        fprintf(stderr, "Number of workers incorrect. Maximal accepted value: %d, "
+                        "positive integer\n", MAX_WORKERS);
         exit(1);
     }
 
-    memset(&state->receive_address, 0, sizeof(struct sockaddr_in6));
 
+    if(rooms_count > MAX_ROOMS || rooms_count == 0) {
+        fprintf(stderr, "Number of rooms incorrect. Maximal accepted value: %d, "
+                        "positive integer\n", MAX_ROOMS);
+        exit(1);
+    }
 
-    /* Initialise the game state with the values that will
-     * not change thereafter (board dimensions etc.)
-     */
-    state->game_params.turning_speed = turning_speed;
-    state->game_params.rounds_per_sec = rounds_per_sec;
-    state->game_params.board_dimension_x = board_dimension_x;
-    state->game_params.board_dimension_y = board_dimension_y;
+    if(bots_count > MAX_PLAYERS) {
+        fprintf(stderr, "Number of bots incorrect. Maximal accepted value: %d\n", MAX_PLAYERS);
+        exit(1);
+    }
 
+    if(log_level > LOG_DEBUG) {
+        fprintf(stderr, "Log level incorrect. Maximal accepted value: %d\n", LOG_DEBUG);
+        exit(1);
+    }
 
-    /* Allocate the memory for game board
-     */
-    state->game_board = malloc(board_dimension_x * sizeof(bool *));
+    if(use_fifo && str_core == NULL) {
+        fprintf(stderr, "SCHED_FIFO is requested only in low-latency mode (-c)\n");
+        exit(1);
+    }
 
-    if(state->game_board == NULL) {
-        free(state);
-        perror("malloc");
+    if(str_core != NULL && (use_io_uring || use_io_thread || rooms_count > 1)) {
+        fprintf(stderr, "Low-latency mode runs a single game on the poll loop, "
+                        "-u, -i and -r options cannot be used with it\n");
         exit(1);
     }
 
-    for(uint32_t i = 0; i < state->game_params.board_dimension_x; ++i) {
-        state->game_board[i] = malloc(board_dimension_y * sizeof(bool));
+    if(rooms_count > 1 && (use_io_uring || use_io_thread)) {
+        fprintf(stderr, "Rooms are ticked by their own threads, -u and -i "
+                        "options host a single game only\n");
+        exit(1);
+    }
 
-        if(state->game_board[i] == NULL) {
-            for(uint32_t j = 0; j < i; ++j) {
-                free(state->game_board[j]);
-            }
 
-            free(state->game_board);
-            free(state);
+    /* Rooms are ticked by as many threads as there are processors unless
+     * specified otherwise (there is no use in more threads than rooms)
+     */
+    long processors = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t tick_threads = processors > 0 ? (uint32_t) processors : 1;
 
-            perror("malloc");
-            exit(1);
-        }
+    if(str_tick_threads != NULL) {
+        tick_threads = atoi(str_tick_threads);
     }
 
+    if(tick_threads > rooms_count) {
+        tick_threads = rooms_count;
+    }
 
-    /* Initialise the game state with default values for the
-     * fields that will be changing
-     */
-    state->ready_players = 0;
-    state->alive_players_count = 0;
-    state->connected_players = 0;
-    state->events_count = 0;
+    if(tick_threads > MAX_ROOM_WORKERS || tick_threads == 0) {
+        fprintf(stderr, "Number of tick threads incorrect. Maximal accepted value: %d, "
+                        "positive integer\n", MAX_ROOM_WORKERS);
+        exit(1);
+    }
 
-    state->random.seed = seed;
-    state->random.seed_no = 0;
 
-    state->game_status = GAME_STATE_WAITING_FOR_PLAYERS;
+    game_params_t game_params;
 
-    /* Initialise data for the players */
-    for(uint8_t i = 0; i < MAX_PLAYERS; ++i) {
-        state->players[i].conn.is_connection_active = false;
-        state->players[i].is_playing = false;
-        state->players[i].is_spectator = false;
-        state->players[i].message = false;
+    game_params.turning_speed = turning_speed;
+    game_params.rounds_per_sec = rounds_per_sec;
+    game_params.board_dimension_x = board_dimension_x;
+    game_params.board_dimension_y = board_dimension_y;
 
-        state->alive[i] = true;
 
-        /* By default fill each of name buffers with ASCII NUL bytes */
-        memset(state->players[i].name, 0, MAX_PLAYER_NAME_LENGTH + 1);
-        memset(state->game_primary_player_names[i], 0, MAX_PLAYER_NAME_LENGTH + 1);
-    }
+    /* In sharded mode the parent process only supervises the workers, each
+     * of them continues from here with its own socket and hosts its own game
+     * (with its own seed and event ring)
+     */
+    uint32_t worker_index = 0;
+    char worker_event_ring[NAME_MAX];
+    char worker_trace_file[PATH_MAX];
 
-    state->events_queue = malloc(DEFAULT_EVENTS_QUEUE_SIZE * sizeof(event_data_t));
-    state->events_queue_size = DEFAULT_EVENTS_QUEUE_SIZE;
+    int sock = workers_count > 1 ?
+               start_workers(server_port, workers_count, &worker_index) :
+               create_server_socket(server_port, false);
 
-    if(state->events_queue == NULL) {
-        perror("malloc");
-        exit(1);
+    /* Seeds of the games of all workers and rooms are consecutive, room i
+     * of worker w plays with seed + w * rooms_count + i
+     */
+    seed += worker_index * rooms_count;
+
+    if(workers_count > 1 && str_event_ring != NULL) {
+        snprintf(worker_event_ring, sizeof(worker_event_ring), "%s-%u", str_event_ring, worker_index);
+        str_event_ring = worker_event_ring;
     }
 
-    int sock = socket(AF_INET6, SOCK_DGRAM, 0);
+    if(workers_count > 1 && trace_file != NULL) {
+        snprintf(worker_trace_file, sizeof(worker_trace_file), "%s-%u", trace_file, worker_index);
+        trace_file = worker_trace_file;
+    }
 
-    if(sock < 0) {
-        perror("socket");
+
+    struct sigaction stats_action;
+    memset(&stats_action, 0, sizeof(stats_action));
+    stats_action.sa_handler = handle_stats_signal;
+
+    if(sigaction(SIGUSR1, &stats_action, NULL) < 0) {
+        perror("sigaction");
         exit(1);
     }
 
-    state->server_socket = sock;
 
-    struct sockaddr_in6 server_addr;
-    memset(&server_addr, 0, sizeof(struct sockaddr_in6));
+    /* Datagrams are checked against the rate of their source before they are
+     * parsed, the limiter is shared by all the rooms of the process (-a turns
+     * it off, to measure what it costs and what it protects from)
+     */
+    rate_limiter_t *rate_limiter = NULL;
 
-    server_addr.sin6_family = AF_INET6;
-    server_addr.sin6_addr = in6addr_any;
-    server_addr.sin6_port = htons(server_port);
+    if(!disable_rate_limit) {
+        rate_limiter = malloc(sizeof(rate_limiter_t));
 
-    if(bind(sock, (struct sockaddr *) &server_addr, sizeof(server_addr)) < 0) {
-        perror("bind");
+        if(rate_limiter == NULL) {
+            perror("malloc");
+            exit(1);
+        }
+
+        initialise_rate_limiter(rate_limiter);
+    }
+
+
+    /* From now on the errors of the game loops are formatted and written by
+     * a separate thread, so that they never block the round tick
+     */
+    if(!log_start(log_level)) {
+        exit(1);
+    }
+
+    /* Records of the rounds are kept in memory and written to the trace
+     * file on SIGUSR2 and when the server ends
+     */
+    if(trace_file != NULL && !trace_start(trace_file)) {
         exit(1);
     }
 
 
     int poll_ret_val;
     uint64_t timers_elapsed;
+    ssize_t read_ret_val;
 
 
-    double relay_time = 1 / (double) state->game_params.rounds_per_sec;
-    uint32_t relay_millis = 1000 * relay_time;
-    uint32_t relay_nanos = relay_millis * (uint32_t) MILLIS_TO_NANO_MULTIPLIER;
+    if(rooms_count > 1) {
+        /* Every room is a separate game with its own seed and event ring,
+         * all of them share the socket (and the rate limiter of the network
+         * thread)
+         */
+        server_game_state_t *states[MAX_ROOMS];
+        char room_event_ring[NAME_MAX];
 
+        for(uint16_t i = 0; i < rooms_count; ++i) {
+            if(str_event_ring != NULL) {
+                snprintf(room_event_ring, sizeof(room_event_ring), "%s-%u", str_event_ring, i);
+            }
 
-    struct itimerspec spec = {{2, 0}, {2, 0}};
-    struct itimerspec spec_moves = { {0, relay_nanos}, {0, relay_nanos} };
+            states[i] = create_game_state(sock, seed + i, &game_params, i, bots_count,
+                                          str_event_ring != NULL ? room_event_ring : NULL);
+        }
 
+        int socket_flags = fcntl(sock, F_GETFL, 0);
 
-    /* Save timeout parameters specification in server data structure */
-    state->timeout_params = spec;
-    state->round_params = spec_moves;
+        if(socket_flags < 0 || fcntl(sock, F_SETFL, socket_flags | O_NONBLOCK) < 0) {
+            perror("fcntl");
+            exit(1);
+        }
 
+        server_rooms_t *rooms = rooms_backend_init(states, rooms_count, tick_threads, rate_limiter);
 
-    state->fds[0].fd = sock;
-    state->fds[0].events = POLLIN;
-    state->fds[0].revents = 0;
+        if(rooms == NULL) {
+            exit(1);
+        }
 
-    for(size_t i = 1; i < SERVER_POLL_DESCRIPTORS_COUNT; ++i) {
-        state->fds[i].fd = -1;
-        state->fds[i].events = POLLIN;
-        state->fds[i].revents = 0;
+        for(uint16_t i = 0; i < rooms_count; ++i) {
+            start_bots(states[i]);
+        }
+
+        rooms_backend_run(rooms, &server_handlers);
     }
 
 
-    ssize_t read_ret_val;
+    server_game_state_t *state = create_game_state(sock, seed, &game_params, 0, bots_count, str_event_ring);
+
+    state->rate_limiter = rate_limiter;
+
+    if(use_io_uring) {
+        if(uring_backend_init(state)) {
+            start_bots(state);
+            uring_backend_run(state, &server_handlers);
+        }
+
+        fprintf(stderr, "io_uring not available, using poll\n");
+    }
+
+
+    /* Sends never block the round tick - datagrams which do not fit in the
+     * socket send buffer wait in outbound queues until it becomes writable
+     */
+    int socket_flags = fcntl(sock, F_GETFL, 0);
+
+    if(socket_flags < 0 || fcntl(sock, F_SETFL, socket_flags | O_NONBLOCK) < 0) {
+        perror("fcntl");
+        exit(1);
+    }
+
+    if(use_io_thread) {
+        if(threaded_backend_init(state)) {
+            start_bots(state);
+            threaded_backend_run(state, &server_handlers);
+        }
+
+        fprintf(stderr, "I/O thread not available, using poll\n");
+    }
+
+    /* Workers of the sharded server are pinned to consecutive cores */
+    if(str_core != NULL) {
+        if(lowlatency_backend_init(state, atoi(str_core) + worker_index, use_fifo)) {
+            start_bots(state);
+            lowlatency_backend_run(state, &server_handlers);
+        }
+
+        fprintf(stderr, "Low-latency mode not available, using poll\n");
+    }
+
+    start_bots(state);
 
 
     while(1) {
+        state->fds[0].events = POLLIN;
+
+        if(outbound_backlog(state)) {
+            state->fds[0].events |= POLLOUT;
+        }
+
         poll_ret_val = poll(state->fds, 27, -1);
 
-        if(poll_ret_val) {
+        if(poll_ret_val < 0 && errno != EINTR) {
+            log_error(LOG_ERROR, "poll");
+        }
+
+        handle_stats_request(state);
+
+        if(poll_ret_val > 0) {
             if(state->fds[1].revents & POLLIN) {
                 read_ret_val = read(state->fds[1].fd,
                                     &timers_elapsed,
                                     sizeof(timers_elapsed));
 
                 if(read_ret_val < 0) {
-                    perror("read");
+                    log_error(LOG_ERROR, "read");
                 }
 
-                if(state->game_status == GAME_STATE_GAME_STARTED) {
-                    printf("Updating the board...\n");
-                    handle_board_update(state);
-                }
+                handle_round_tick(state);
             }
 
             handle_timers(state);
 
+            if(state->fds[0].revents & POLLOUT) {
+                drain_outbound_queues(state);
+            }
+
             if(state->fds[0].revents & POLLIN) {
                 handle_client_datagram(state);
             }
@@ -696,10 +1417,10 @@ int main(int argc, char *argv[]) {
 
 
     /* Deallocate the memory that was allocated
-     * for holding server game data
+     * for holding server game data (the arena descriptor is a part of it)
      */
-    free(state->events_queue);
-    free(state);
+    arena_t arena = state->arena;
+    arena_release(&arena);
 
     return 0;
 }
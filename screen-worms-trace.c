@@ -0,0 +1,407 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include "histogram.h"
+#include "trace.h"
+
+
+/* Decoder of the trace written by the server (see trace.h). Prints the
+ * records of all the threads as a single timeline, a summary of durations
+ * of each phase or folded stacks of the phases (nested by time within
+ * each thread), which can be turned into a flame graph
+ */
+
+
+/* Maximal number of distinct stacks of nested phases and their depth
+ */
+#define MAX_STACKS                                      256
+#define MAX_STACK_DEPTH                                  16
+
+
+typedef struct decoded_record_t decoded_record_t;
+typedef struct folded_stack_t folded_stack_t;
+
+
+struct decoded_record_t {
+    trace_record_t record;
+    uint32_t thread_no;
+};
+
+
+struct folded_stack_t {
+    uint8_t types[MAX_STACK_DEPTH];
+    uint8_t depth;
+
+    /* Time (in nanoseconds) spent in the innermost phase itself
+     */
+    uint64_t self_nanos;
+};
+
+
+static const char *type_names[TRACE_RECORD_TYPES] = {
+    "unknown", "round_tick", "client_datagram", "board_update", "pack_events", "send"
+};
+
+
+static bool print_summary = false;
+static bool print_folded = false;
+static char *trace_file_name = NULL;
+
+
+static
+void print_program_usage(const char *program_name) {
+    fprintf(stderr, "Usage: %s [-s] [-f] trace_file\n", program_name);
+}
+
+
+static
+void parse_program_arguments(int argc, char *argv[]) {
+    int option = 0;
+
+    while((option = getopt(argc, argv, "sf")) != -1) {
+        switch(option) {
+            case 's':
+                print_summary = true;
+                break;
+            case 'f':
+                print_folded = true;
+                break;
+            default:
+                print_program_usage(argv[0]);
+                exit(1);
+        }
+    }
+
+    if(argc != optind + 1) {
+        print_program_usage(argv[0]);
+        exit(1);
+    }
+
+    trace_file_name = argv[optind];
+}
+
+
+static
+const char *type_name(uint8_t type) {
+    return type < TRACE_RECORD_TYPES ? type_names[type] : type_names[0];
+}
+
+
+/* Reads the records of all the threads from the trace file, returns their
+ * number and sets the pointer passed as the second argument to them
+ */
+static
+uint64_t read_trace(FILE *file, decoded_record_t **records) {
+    trace_file_header_t file_header;
+
+    if(fread(&file_header, sizeof(file_header), 1, file) != 1 ||
+       file_header.magic != TRACE_FILE_MAGIC) {
+
+        fprintf(stderr, "Not a trace file\n");
+        exit(1);
+    }
+
+    if(file_header.version != TRACE_FILE_VERSION ||
+       file_header.record_size != sizeof(trace_record_t)) {
+
+        fprintf(stderr, "Unsupported version of the trace file: %u\n", file_header.version);
+        exit(1);
+    }
+
+    uint64_t count = 0;
+    uint64_t capacity = 0;
+
+    *records = NULL;
+
+    for(uint32_t i = 0; i < file_header.threads_count; ++i) {
+        trace_thread_header_t thread_header;
+
+        if(fread(&thread_header, sizeof(thread_header), 1, file) != 1) {
+            fprintf(stderr, "Trace file truncated\n");
+            break;
+        }
+
+        if(thread_header.overwritten > 0) {
+            fprintf(stderr, "Thread %u: %lu oldest records overwritten\n",
+                    thread_header.thread_no, (unsigned long) thread_header.overwritten);
+        }
+
+        if(count + thread_header.records_count > capacity) {
+            capacity = count + thread_header.records_count;
+            *records = realloc(*records, capacity * sizeof(decoded_record_t));
+
+            if(*records == NULL) {
+                perror("realloc");
+                exit(1);
+            }
+        }
+
+        for(uint32_t j = 0; j < thread_header.records_count; ++j) {
+            if(fread(&(*records)[count].record, sizeof(trace_record_t), 1, file) != 1) {
+                fprintf(stderr, "Trace file truncated\n");
+                return count;
+            }
+
+            (*records)[count].thread_no = thread_header.thread_no;
+            count++;
+        }
+    }
+
+    return count;
+}
+
+
+/* Orders the records by thread, then by start time, with the enclosing
+ * phase (the longer one) before the phases nested in it
+ */
+static
+int compare_by_thread(const void *first, const void *second) {
+    const decoded_record_t *a = first;
+    const decoded_record_t *b = second;
+
+    if(a->thread_no != b->thread_no) {
+        return a->thread_no < b->thread_no ? -1 : 1;
+    }
+
+    if(a->record.timestamp != b->record.timestamp) {
+        return a->record.timestamp < b->record.timestamp ? -1 : 1;
+    }
+
+    if(a->record.duration != b->record.duration) {
+        return a->record.duration > b->record.duration ? -1 : 1;
+    }
+
+    return 0;
+}
+
+
+static
+int compare_by_time(const void *first, const void *second) {
+    const decoded_record_t *a = first;
+    const decoded_record_t *b = second;
+
+    if(a->record.timestamp != b->record.timestamp) {
+        return a->record.timestamp < b->record.timestamp ? -1 : 1;
+    }
+
+    return compare_by_thread(first, second);
+}
+
+
+static
+void print_record_arguments(const trace_record_t *record) {
+    const uint32_t *arguments = record->arguments;
+
+    switch(record->type) {
+        case TRACE_ROUND_TICK:
+            printf("status %u events %u players %u", arguments[0], arguments[1], arguments[2]);
+            break;
+        case TRACE_CLIENT_DATAGRAM:
+            printf("length %u turn %u next expected %u", arguments[0], arguments[1], arguments[2]);
+            break;
+        case TRACE_BOARD_UPDATE:
+            printf("new events %u..%u alive %u",
+                   arguments[0], arguments[0] + arguments[1], arguments[2]);
+            break;
+        case TRACE_PACK_EVENTS:
+            printf("events %u..%u bytes %u",
+                   arguments[0], arguments[0] + arguments[1], arguments[2]);
+            break;
+        case TRACE_SEND:
+            printf("bytes %u datagrams %u status %u", arguments[0], arguments[1], arguments[2]);
+            break;
+        default:
+            printf("%u %u %u", arguments[0], arguments[1], arguments[2]);
+            break;
+    }
+}
+
+
+static
+void print_timeline(decoded_record_t *records, uint64_t count) {
+    qsort(records, count, sizeof(decoded_record_t), compare_by_time);
+
+    uint64_t origin = count > 0 ? records[0].record.timestamp : 0;
+
+    for(uint64_t i = 0; i < count; ++i) {
+        const trace_record_t *record = &records[i].record;
+
+        printf("%12.3f ms  thread %2u  room %3u  round %6u  %-15s  ",
+               (double) (record->timestamp - origin) / 1000000,
+               records[i].thread_no, record->room, record->round, type_name(record->type));
+
+        if(record->client != TRACE_NO_CLIENT) {
+            printf("client %2u  ", record->client);
+        }
+
+        print_record_arguments(record);
+        printf("  (%.1f us)\n", (double) record->duration / 1000);
+    }
+}
+
+
+static
+void summarise(const decoded_record_t *records, uint64_t count) {
+    histogram_t *histograms = calloc(TRACE_RECORD_TYPES, sizeof(histogram_t));
+    uint64_t total_nanos[TRACE_RECORD_TYPES];
+
+    if(histograms == NULL) {
+        perror("calloc");
+        exit(1);
+    }
+
+    memset(total_nanos, 0, sizeof(total_nanos));
+
+    for(uint64_t i = 0; i < count; ++i) {
+        uint8_t type = records[i].record.type < TRACE_RECORD_TYPES ? records[i].record.type : 0;
+
+        histogram_record(&histograms[type], records[i].record.duration);
+        total_nanos[type] += records[i].record.duration;
+    }
+
+    printf("%-15s %10s %12s %10s %10s %10s %10s %10s\n",
+           "phase", "count", "total us", "mean us", "p50 us", "p99 us", "p99.9 us", "max us");
+
+    for(uint8_t type = 0; type < TRACE_RECORD_TYPES; ++type) {
+        const histogram_t *histogram = &histograms[type];
+
+        if(histogram->total == 0) {
+            continue;
+        }
+
+        printf("%-15s %10lu %12.1f %10.2f %10.2f %10.2f %10.2f %10.2f\n",
+               type_name(type),
+               (unsigned long) histogram->total,
+               (double) total_nanos[type] / 1000,
+               (double) total_nanos[type] / histogram->total / 1000,
+               (double) histogram_percentile(histogram, 50) / 1000,
+               (double) histogram_percentile(histogram, 99) / 1000,
+               (double) histogram_percentile(histogram, 99.9) / 1000,
+               (double) histogram->max / 1000);
+    }
+
+    free(histograms);
+}
+
+
+static
+folded_stack_t *find_stack(folded_stack_t *stacks, uint32_t *stacks_count,
+                           const uint8_t *types, uint8_t depth) {
+
+    for(uint32_t i = 0; i < *stacks_count; ++i) {
+        if(stacks[i].depth == depth && memcmp(stacks[i].types, types, depth) == 0) {
+            return &stacks[i];
+        }
+    }
+
+    if(*stacks_count == MAX_STACKS) {
+        return NULL;
+    }
+
+    folded_stack_t *stack = &stacks[(*stacks_count)++];
+
+    memcpy(stack->types, types, depth);
+    stack->depth = depth;
+    stack->self_nanos = 0;
+
+    return stack;
+}
+
+
+/* Prints the self time of each stack of nested phases, one stack per line
+ * with the phases separated by semicolons (the format of flamegraph.pl)
+ */
+static
+void print_folded_stacks(decoded_record_t *records, uint64_t count) {
+    qsort(records, count, sizeof(decoded_record_t), compare_by_thread);
+
+    folded_stack_t stacks[MAX_STACKS];
+    uint32_t stacks_count = 0;
+
+    /* Phases enclosing the current record: their types, ends and stacks */
+    uint8_t types[MAX_STACK_DEPTH];
+    uint64_t ends[MAX_STACK_DEPTH];
+    folded_stack_t *open_stacks[MAX_STACK_DEPTH];
+    uint8_t depth = 0;
+
+    for(uint64_t i = 0; i < count; ++i) {
+        const trace_record_t *record = &records[i].record;
+        uint64_t end = record->timestamp + record->duration;
+
+        if(i > 0 && records[i].thread_no != records[i - 1].thread_no) {
+            depth = 0;
+        }
+
+        while(depth > 0 && ends[depth - 1] <= record->timestamp) {
+            depth--;
+        }
+
+        /* Time of the nested phase is not the own time of the enclosing one */
+        if(depth > 0 && open_stacks[depth - 1] != NULL) {
+            open_stacks[depth - 1]->self_nanos -= record->duration;
+        }
+
+        if(depth == MAX_STACK_DEPTH) {
+            continue;
+        }
+
+        types[depth] = record->type < TRACE_RECORD_TYPES ? record->type : 0;
+        ends[depth] = end;
+        open_stacks[depth] = find_stack(stacks, &stacks_count, types, depth + 1);
+
+        if(open_stacks[depth] != NULL) {
+            open_stacks[depth]->self_nanos += record->duration;
+        }
+
+        depth++;
+    }
+
+    for(uint32_t i = 0; i < stacks_count; ++i) {
+        for(uint8_t j = 0; j < stacks[i].depth; ++j) {
+            printf("%s%s", j > 0 ? ";" : "", type_name(stacks[i].types[j]));
+        }
+
+        /* Nested phases may be measured as slightly longer than the
+         * enclosing one, which would leave it with negative own time
+         */
+        int64_t self_nanos = (int64_t) stacks[i].self_nanos;
+        printf(" %ld\n", (long) (self_nanos > 0 ? self_nanos : 0));
+    }
+}
+
+
+int main(int argc, char *argv[]) {
+    parse_program_arguments(argc, argv);
+
+    FILE *file = fopen(trace_file_name, "rb");
+
+    if(file == NULL) {
+        perror("fopen");
+        exit(1);
+    }
+
+    decoded_record_t *records;
+    uint64_t count = read_trace(file, &records);
+
+    fclose(file);
+
+    if(print_summary) {
+        summarise(records, count);
+    }
+
+    if(print_folded) {
+        print_folded_stacks(records, count);
+    }
+
+    if(!print_summary && !print_folded) {
+        print_timeline(records, count);
+    }
+
+    free(records);
+
+    return 0;
+}
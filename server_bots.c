@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "server_bots.h"
+#include "utils.h"
+
+
+uint8_t add_bots(server_game_state_t *state, uint8_t bots_count) {
+    uint8_t added = 0;
+
+    for(uint8_t i = 0; i < MAX_PLAYERS && added < bots_count; ++i) {
+        client_t *bot = &state->players[i];
+
+        if(bot->conn.is_connection_active) {
+            continue;
+        }
+
+        memset(&bot->conn, 0, sizeof(connection_data_t));
+        bot->conn.is_connection_active = true;
+
+        memset(bot->name, 0, MAX_PLAYER_NAME_LENGTH + 1);
+        snprintf(bot->name, sizeof(bot->name), "bot%02u", state->bots_count);
+
+        bot->is_bot = true;
+        bot->is_playing = true;
+        bot->is_spectator = false;
+        bot->ready = true;
+        bot->turn_direction = 0;
+
+        state->connected_players++;
+        state->players_count++;
+        state->ready_players++;
+        state->bots_count++;
+
+        added++;
+    }
+
+    return added;
+}
+
+
+void start_bots(server_game_state_t *state) {
+    if(state->bots_count > 0) {
+        state->backend->start_round_timer(state);
+    }
+}
+
+
+/* Returns the number of free pixels (up to BOT_LOOKAHEAD) in front of the
+ * worm at given position moving in given direction (in degrees)
+ */
+static
+uint32_t free_distance(server_game_state_t *state, double x_pos, double y_pos, int32_t direction) {
+    double step_x = cos((double) direction * M_PI / 180);
+    double step_y = sin((double) direction * M_PI / 180);
+
+    int32_t current_x = (int32_t) floor(x_pos);
+    int32_t current_y = (int32_t) floor(y_pos);
+
+    for(uint32_t step = 1; step <= BOT_LOOKAHEAD; ++step) {
+        int32_t x = (int32_t) floor(x_pos + step * step_x);
+        int32_t y = (int32_t) floor(y_pos + step * step_y);
+
+        /* The worm stays on its own pixel for a while */
+        if(x == current_x && y == current_y) {
+            continue;
+        }
+
+        if(x < 0 || (uint32_t) x >= state->game_params.board_dimension_x ||
+           y < 0 || (uint32_t) y >= state->game_params.board_dimension_y ||
+           state->game_board[x][y]) {
+
+            return step - 1;
+        }
+    }
+
+    return BOT_LOOKAHEAD;
+}
+
+
+void steer_bots(server_game_state_t *state) {
+    int32_t turn_angle = BOT_TURN_ROUNDS * state->game_params.turning_speed;
+
+    for(uint8_t i = 0; i < MAX_PLAYERS; ++i) {
+        client_t *bot = &state->players[i];
+
+        if(!bot->is_bot || !bot->is_playing || !state->alive[i]) {
+            continue;
+        }
+
+        uint32_t ahead = free_distance(state, bot->x_pos, bot->y_pos, bot->direction);
+
+        if(ahead == BOT_LOOKAHEAD) {
+            bot->turn_direction = 0;
+            continue;
+        }
+
+        /* Turn direction 1 increases the direction (turns right), 2 turns
+         * left. The bot keeps turning the same way unless the other side
+         * has more space, so that it does not swerve between the two
+         */
+        uint32_t right = free_distance(state, bot->x_pos, bot->y_pos, bot->direction + turn_angle);
+        uint32_t left = free_distance(state, bot->x_pos, bot->y_pos, bot->direction - turn_angle);
+
+        if(right > left) {
+            bot->turn_direction = 1;
+        }
+        else if(left > right) {
+            bot->turn_direction = 2;
+        }
+        else if(bot->turn_direction == 0) {
+            bot->turn_direction = 1;
+        }
+    }
+}
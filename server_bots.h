@@ -0,0 +1,42 @@
+#ifndef SERVER_BOTS_H
+#define SERVER_BOTS_H
+
+#include <stdint.h>
+#include "game_server_protocol.h"
+
+
+/* Number of pixels checked ahead of the bot worm in each of the
+ * directions it can choose
+ */
+#define BOT_LOOKAHEAD                                    16
+
+
+/* Number of rounds of turning assumed when the bot checks the space
+ * on its left and on its right side
+ */
+#define BOT_TURN_ROUNDS                                   3
+
+
+/* Adds given number of bots (second argument) to the free player slots.
+ * Bots are named bot00, bot01 etc. and are ready to play from the start.
+ * Returns the number of bots which have been added (limited by the
+ * number of free slots)
+ */
+uint8_t add_bots(server_game_state_t *, uint8_t);
+
+
+/* Starts the round timer of the game with bots, on its ticks the bots
+ * start new games without waiting for human players. Has to be called
+ * after the backend of the game has been set up
+ */
+void start_bots(server_game_state_t *);
+
+
+/* Chooses turn directions of the alive bots for the next round: a bot
+ * keeps going straight while there is free space ahead of it, otherwise
+ * it turns towards the side with more free space
+ */
+void steer_bots(server_game_state_t *);
+
+
+#endif /* SERVER_BOTS_H */
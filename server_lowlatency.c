@@ -0,0 +1,233 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/poll.h>
+#include <sys/socket.h>
+#include "server_lowlatency.h"
+#include "game_server_protocol.h"
+#include "log.h"
+
+
+typedef struct lowlatency_backend_t lowlatency_backend_t;
+
+
+struct lowlatency_backend_t {
+    /* Deadline of the next round (in nanoseconds of the monotonic clock,
+     * 0 when the round timer is stopped) and the period of the rounds
+     */
+    uint64_t round_deadline;
+    uint64_t round_period;
+};
+
+
+static
+void lowlatency_start_round_timer(server_game_state_t *state) {
+    lowlatency_backend_t *backend = state->backend_data;
+    backend->round_deadline = monotonic_nanos() + backend->round_period;
+}
+
+
+static
+void lowlatency_stop_round_timer(server_game_state_t *state) {
+    lowlatency_backend_t *backend = state->backend_data;
+    backend->round_deadline = 0;
+}
+
+
+static
+int lowlatency_send_datagrams(server_game_state_t *state,
+                              uint8_t client_no,
+                              char *data,
+                              size_t total_size,
+                              uint16_t segment_size) {
+
+    return poll_backend.send_datagrams(state, client_no, data, total_size, segment_size);
+}
+
+
+/* Client timeouts are not latency critical, they stay on timer descriptors
+ * of the poll backend
+ */
+static
+void lowlatency_start_client_timer(server_game_state_t *state, uint8_t client_no) {
+    poll_backend.start_client_timer(state, client_no);
+}
+
+
+static
+void lowlatency_stop_client_timer(server_game_state_t *state, uint8_t client_no) {
+    poll_backend.stop_client_timer(state, client_no);
+}
+
+
+static const server_backend_t lowlatency_backend = {
+    .send_datagrams = lowlatency_send_datagrams,
+    .start_round_timer = lowlatency_start_round_timer,
+    .stop_round_timer = lowlatency_stop_round_timer,
+    .start_client_timer = lowlatency_start_client_timer,
+    .stop_client_timer = lowlatency_stop_client_timer
+};
+
+
+bool lowlatency_backend_init(server_game_state_t *state, int core, bool fifo) {
+    lowlatency_backend_t *backend = malloc(sizeof(lowlatency_backend_t));
+
+    if(backend == NULL) {
+        perror("malloc");
+        return false;
+    }
+
+    backend->round_deadline = 0;
+    backend->round_period = timespec_nanos(&state->round_params.it_interval);
+
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(core, &cpus);
+
+    if(sched_setaffinity(0, sizeof(cpus), &cpus) < 0) {
+        perror("sched_setaffinity");
+        fprintf(stderr, "Game thread not pinned to core %d\n", core);
+    }
+
+    if(fifo) {
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = LOWLATENCY_FIFO_PRIORITY;
+
+        if(sched_setscheduler(0, SCHED_FIFO, &param) < 0) {
+            perror("sched_setscheduler");
+            fprintf(stderr, "Game thread not running under SCHED_FIFO\n");
+        }
+    }
+
+    int busy_poll = LOWLATENCY_BUSY_POLL_MICROS;
+
+    if(setsockopt(state->server_socket, SOL_SOCKET, SO_BUSY_POLL, &busy_poll, sizeof(busy_poll)) < 0) {
+        perror("setsockopt");
+        fprintf(stderr, "Busy polling not enabled on the server socket\n");
+    }
+
+    state->backend = &lowlatency_backend;
+    state->backend_data = backend;
+
+    return true;
+}
+
+
+/* Receives and handles all the datagrams waiting on the (non-blocking)
+ * server socket
+ */
+static
+void receive_datagrams(server_game_state_t *state, const server_event_handlers_t *handlers) {
+    while(1) {
+        memset(&state->receive_address, 0, sizeof(struct sockaddr_in6));
+        state->receive_address_length = sizeof(struct sockaddr_in6);
+
+        ssize_t read_bytes = receive_datagram(state->server_socket,
+                                              state->server_buffer,
+                                              sizeof(state->server_buffer),
+                                              &state->receive_address,
+                                              &state->receive_address_length,
+                                              &state->receive_nanos);
+
+        if(read_bytes < 0) {
+            if(errno != EAGAIN && errno != EWOULDBLOCK) {
+                log_error(LOG_ERROR, "recvmsg");
+            }
+
+            return;
+        }
+
+        handlers->client_datagram(state, read_bytes);
+    }
+}
+
+
+void lowlatency_backend_run(server_game_state_t *state, const server_event_handlers_t *handlers) {
+    lowlatency_backend_t *backend = state->backend_data;
+
+    int poll_ret_val;
+    ssize_t read_ret_val;
+    uint64_t timers_elapsed;
+
+    while(1) {
+        struct timespec timeout;
+        struct timespec *timeout_pointer = NULL;
+
+        if(backend->round_deadline != 0) {
+            uint64_t now = monotonic_nanos();
+            uint64_t wake_up = backend->round_deadline - LOWLATENCY_SPIN_NANOS;
+            uint64_t remaining = wake_up > now ? wake_up - now : 0;
+
+            timeout.tv_sec = remaining / 1000000000ULL;
+            timeout.tv_nsec = remaining % 1000000000ULL;
+            timeout_pointer = &timeout;
+        }
+
+        state->fds[0].events = POLLIN;
+
+        if(outbound_backlog(state)) {
+            state->fds[0].events |= POLLOUT;
+        }
+
+        poll_ret_val = ppoll(state->fds, SERVER_POLL_DESCRIPTORS_COUNT, timeout_pointer, NULL);
+
+        if(poll_ret_val < 0 && errno != EINTR) {
+            log_error(LOG_ERROR, "ppoll");
+        }
+
+        if(poll_ret_val > 0) {
+            for(int i = 2; i < SERVER_POLL_DESCRIPTORS_COUNT; ++i) {
+                if(state->fds[i].revents & POLLIN) {
+                    read_ret_val = read(state->fds[i].fd, &timers_elapsed, sizeof(timers_elapsed));
+
+                    if(read_ret_val < 0) {
+                        log_error(LOG_ERROR, "read");
+                    }
+
+                    handlers->client_timeout(state, i - 2);
+                }
+            }
+
+            if(state->fds[0].revents & POLLOUT) {
+                drain_outbound_queues(state);
+            }
+
+            if(state->fds[0].revents & POLLIN) {
+                receive_datagrams(state, handlers);
+            }
+        }
+
+        if(backend->round_deadline != 0 &&
+           monotonic_nanos() + LOWLATENCY_SPIN_NANOS >= backend->round_deadline) {
+
+            /* Spin up to the deadline, the datagrams which come meanwhile
+             * are still applied before the round
+             */
+            uint64_t now;
+
+            while((now = monotonic_nanos()) < backend->round_deadline) {
+                receive_datagrams(state, handlers);
+            }
+
+            /* Deadlines which have been missed are skipped (as timer
+             * descriptors report them as a single expiration)
+             */
+            if(backend->round_deadline != 0) {
+                do {
+                    backend->round_deadline += backend->round_period;
+                } while(backend->round_deadline <= now);
+
+                handlers->round_tick(state);
+            }
+        }
+
+        handlers->iteration_done(state);
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef SERVER_LOWLATENCY_H
+#define SERVER_LOWLATENCY_H
+
+#include <stdbool.h>
+#include "game_server_protocol.h"
+#include "server_uring.h"
+
+
+/* Time (in nanoseconds) before the round deadline from which the game
+ * thread stops sleeping and spins (receiving datagrams) until the deadline
+ */
+#define LOWLATENCY_SPIN_NANOS                        200000
+
+
+/* Time (in microseconds) for which the kernel busy-polls the device queue
+ * on receive from the server socket (SO_BUSY_POLL)
+ */
+#define LOWLATENCY_BUSY_POLL_MICROS                      50
+
+
+/* Priority of the game thread under SCHED_FIFO
+ */
+#define LOWLATENCY_FIFO_PRIORITY                         50
+
+
+/* Pins the calling (game) thread to given core (second argument), puts it
+ * under SCHED_FIFO if the third argument is true, enables busy polling on
+ * the server socket and installs low-latency backend in server_game_state_t
+ * structure. Pinning, scheduling and busy polling which are not permitted
+ * are reported and skipped. Returns false (leaving the default backend
+ * untouched) on failure
+ */
+bool lowlatency_backend_init(server_game_state_t *, int, bool);
+
+
+/* Runs the main loop of the game: like the poll loop, but the rounds are
+ * kept as absolute deadlines instead of a timer descriptor. The thread
+ * sleeps until shortly before the deadline and spins for the rest of the
+ * time, receiving datagrams meanwhile. Never returns
+ */
+void lowlatency_backend_run(server_game_state_t *, const server_event_handlers_t *);
+
+
+#endif /* SERVER_LOWLATENCY_H */
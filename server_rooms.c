@@ -0,0 +1,647 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include "server_rooms.h"
+#include "game_server_protocol.h"
+#include "client_protocol.h"
+#include "spsc_ring.h"
+#include "log.h"
+
+
+/* Time (in nanoseconds) after which a room retries to send the datagrams
+ * waiting in its outbound queues
+ */
+#define ROOMS_BACKLOG_RETRY_NANOS                   1000000ULL
+
+
+#define ROOMS_NO_DEADLINE                            UINT64_MAX
+
+
+typedef struct room_update_t room_update_t;
+typedef struct room_t room_t;
+typedef struct room_queue_t room_queue_t;
+
+
+/* Record of the inbox of the room: decoded client datagram and its sender
+ */
+struct room_update_t {
+    struct sockaddr_in6 address;
+    socklen_t address_length;
+    uint64_t receive_nanos;
+
+    ssize_t datagram_size;
+    client_dgram_t dgram;
+};
+
+
+struct room_t {
+    server_game_state_t *state;
+    server_rooms_t *rooms;
+
+    /* Decoded datagrams of the clients of this room (produced by the network
+     * thread, consumed by the worker which currently runs the room)
+     */
+    spsc_ring_t inbox;
+
+    /* Deadlines (in nanoseconds of the monotonic clock, 0 when the timer
+     * is stopped) and periods of the round timer and client timers. Used
+     * only by the worker which currently runs the room
+     */
+    uint64_t round_deadline;
+    uint64_t round_period;
+
+    uint64_t client_deadlines[MAX_PLAYERS];
+    uint64_t client_period;
+
+    /* Earliest deadline of the room, published to the network thread
+     * (ROOMS_NO_DEADLINE if there is none)
+     */
+    uint64_t next_deadline;
+
+    /* Flag which indicates whether the room is queued or running. A room
+     * is run by at most one worker at a time
+     */
+    bool scheduled;
+
+    /* Worker on whose queue the room is put when it is scheduled
+     */
+    uint32_t home_worker;
+
+    /* Number of datagrams dropped because the inbox was full (updated by
+     * the network thread)
+     */
+    uint64_t updates_dropped;
+};
+
+
+/* Queue of scheduled rooms of a single worker. The worker takes rooms from
+ * the front, the other workers steal them from the back
+ */
+struct room_queue_t {
+    pthread_mutex_t lock;
+
+    room_t **rooms;
+    uint32_t head;
+    uint32_t count;
+};
+
+
+struct server_rooms_t {
+    room_t *rooms;
+    uint16_t rooms_count;
+
+    room_queue_t *queues;
+    pthread_t *workers;
+    uint32_t workers_count;
+
+    /* Number of queued rooms, idle workers wait on the condition variable
+     * until it becomes positive
+     */
+    pthread_mutex_t idle_lock;
+    pthread_cond_t idle_condition;
+    uint32_t pending;
+
+    /* Deadline until which the network thread sleeps (0 while it checks
+     * the deadlines of the rooms) and the event descriptor through which
+     * the rooms with earlier deadlines wake it up
+     */
+    uint64_t network_deadline;
+    int wakeup_event;
+
+    int server_socket;
+    rate_limiter_t *rate_limiter;
+    const server_event_handlers_t *handlers;
+
+    /* Number of datagrams dropped by the rate limiter (updated by the
+     * network thread)
+     */
+    uint64_t datagrams_rate_limited;
+};
+
+
+/* Timers of the rooms are deadlines checked by the worker which runs
+ * the room, the network thread schedules the room when the earliest
+ * of them passes
+ */
+static
+void rooms_start_round_timer(server_game_state_t *state) {
+    room_t *room = state->backend_data;
+    room->round_deadline = monotonic_nanos() + room->round_period;
+}
+
+
+static
+void rooms_stop_round_timer(server_game_state_t *state) {
+    room_t *room = state->backend_data;
+    room->round_deadline = 0;
+}
+
+
+static
+void rooms_start_client_timer(server_game_state_t *state, uint8_t client_no) {
+    room_t *room = state->backend_data;
+    room->client_deadlines[client_no] = monotonic_nanos() + room->client_period;
+}
+
+
+static
+void rooms_stop_client_timer(server_game_state_t *state, uint8_t client_no) {
+    room_t *room = state->backend_data;
+    room->client_deadlines[client_no] = 0;
+}
+
+
+/* Rooms share the server socket, datagrams are sent directly by the worker
+ * which runs the room
+ */
+static
+int rooms_send_datagrams(server_game_state_t *state,
+                         uint8_t client_no,
+                         char *data,
+                         size_t total_size,
+                         uint16_t segment_size) {
+
+    return poll_backend.send_datagrams(state, client_no, data, total_size, segment_size);
+}
+
+
+static const server_backend_t rooms_backend = {
+    .send_datagrams = rooms_send_datagrams,
+    .start_round_timer = rooms_start_round_timer,
+    .stop_round_timer = rooms_stop_round_timer,
+    .start_client_timer = rooms_start_client_timer,
+    .stop_client_timer = rooms_stop_client_timer
+};
+
+
+static
+void schedule_room(server_rooms_t *rooms, room_t *room) {
+    if(__atomic_exchange_n(&room->scheduled, true, __ATOMIC_SEQ_CST)) {
+        /* Already queued, or running and checks for work when done */
+        return;
+    }
+
+    room_queue_t *queue = &rooms->queues[room->home_worker];
+
+    pthread_mutex_lock(&queue->lock);
+    queue->rooms[(queue->head + queue->count) % rooms->rooms_count] = room;
+    queue->count++;
+    pthread_mutex_unlock(&queue->lock);
+
+    pthread_mutex_lock(&rooms->idle_lock);
+    rooms->pending++;
+    pthread_cond_signal(&rooms->idle_condition);
+    pthread_mutex_unlock(&rooms->idle_lock);
+}
+
+
+/* Takes a room from the front of the queue of the worker or steals one from
+ * the back of the queue of another worker. Returns NULL if all queues are
+ * empty
+ */
+static
+room_t *take_room(server_rooms_t *rooms, uint32_t worker) {
+    room_t *room = NULL;
+
+    for(uint32_t i = 0; i < rooms->workers_count && room == NULL; ++i) {
+        room_queue_t *queue = &rooms->queues[(worker + i) % rooms->workers_count];
+
+        pthread_mutex_lock(&queue->lock);
+
+        if(queue->count > 0) {
+            if(i == 0) {
+                room = queue->rooms[queue->head];
+                queue->head = (queue->head + 1) % rooms->rooms_count;
+            }
+            else {
+                room = queue->rooms[(queue->head + queue->count - 1) % rooms->rooms_count];
+            }
+
+            queue->count--;
+        }
+
+        pthread_mutex_unlock(&queue->lock);
+    }
+
+    if(room != NULL) {
+        pthread_mutex_lock(&rooms->idle_lock);
+        rooms->pending--;
+        pthread_mutex_unlock(&rooms->idle_lock);
+    }
+
+    return room;
+}
+
+
+/* Moves the deadline past the current time by a whole number of periods
+ * (expirations which have been missed are reported as a single one)
+ */
+static
+void advance_deadline(uint64_t *deadline, uint64_t period, uint64_t now) {
+    do {
+        *deadline += period;
+    } while(*deadline <= now);
+}
+
+
+/* Applies waiting datagrams, handles expired timers and publishes the next
+ * deadline of the room. Called by a worker which owns the room for the time
+ * of the call
+ */
+static
+void run_room(server_rooms_t *rooms, room_t *room) {
+    server_game_state_t *state = room->state;
+    const server_event_handlers_t *handlers = rooms->handlers;
+
+    room_update_t *update;
+    uint32_t length;
+
+    while((update = spsc_ring_peek(&room->inbox, &length)) != NULL) {
+        state->receive_address = update->address;
+        state->receive_address_length = update->address_length;
+        state->receive_nanos = update->receive_nanos;
+
+        handlers->client_update(state, update->datagram_size, &update->dgram);
+
+        spsc_ring_release(&room->inbox);
+    }
+
+    uint64_t now = monotonic_nanos();
+
+    for(uint8_t i = 0; i < MAX_PLAYERS; ++i) {
+        if(room->client_deadlines[i] != 0 && room->client_deadlines[i] <= now) {
+            advance_deadline(&room->client_deadlines[i], room->client_period, now);
+            handlers->client_timeout(state, i);
+        }
+    }
+
+    if(room->round_deadline != 0 && room->round_deadline <= now) {
+        advance_deadline(&room->round_deadline, room->round_period, now);
+        handlers->round_tick(state);
+    }
+
+    if(outbound_backlog(state)) {
+        drain_outbound_queues(state);
+    }
+
+    /* Datagrams are rate limited before their room is known, each of the
+     * rooms reports the count of the whole process
+     */
+    state->stats.updates_dropped = __atomic_load_n(&room->updates_dropped, __ATOMIC_RELAXED);
+    state->stats.datagrams_rate_limited = __atomic_load_n(&rooms->datagrams_rate_limited,
+                                                          __ATOMIC_RELAXED);
+
+    handlers->iteration_done(state);
+
+    uint64_t next_deadline = ROOMS_NO_DEADLINE;
+
+    for(uint8_t i = 0; i < MAX_PLAYERS; ++i) {
+        if(room->client_deadlines[i] != 0 && room->client_deadlines[i] < next_deadline) {
+            next_deadline = room->client_deadlines[i];
+        }
+    }
+
+    if(room->round_deadline != 0 && room->round_deadline < next_deadline) {
+        next_deadline = room->round_deadline;
+    }
+
+    if(outbound_backlog(state) && now + ROOMS_BACKLOG_RETRY_NANOS < next_deadline) {
+        next_deadline = now + ROOMS_BACKLOG_RETRY_NANOS;
+    }
+
+    __atomic_store_n(&room->next_deadline, next_deadline, __ATOMIC_SEQ_CST);
+
+    if(next_deadline < __atomic_load_n(&rooms->network_deadline, __ATOMIC_SEQ_CST)) {
+        if(eventfd_write(rooms->wakeup_event, 1) < 0) {
+            log_error(LOG_ERROR, "eventfd_write");
+        }
+    }
+
+    __atomic_store_n(&room->scheduled, false, __ATOMIC_SEQ_CST);
+
+    /* Datagrams or deadlines which came while the room was running could not
+     * schedule it again
+     */
+    if(!spsc_ring_empty(&room->inbox) || next_deadline <= monotonic_nanos()) {
+        schedule_room(rooms, room);
+    }
+}
+
+
+typedef struct room_worker_t room_worker_t;
+
+
+struct room_worker_t {
+    server_rooms_t *rooms;
+    uint32_t index;
+};
+
+
+static
+void *run_worker(void *argument) {
+    room_worker_t *worker = argument;
+    server_rooms_t *rooms = worker->rooms;
+
+    while(1) {
+        room_t *room = take_room(rooms, worker->index);
+
+        if(room != NULL) {
+            run_room(rooms, room);
+            continue;
+        }
+
+        pthread_mutex_lock(&rooms->idle_lock);
+
+        while(rooms->pending == 0) {
+            pthread_cond_wait(&rooms->idle_condition, &rooms->idle_lock);
+        }
+
+        pthread_mutex_unlock(&rooms->idle_lock);
+    }
+
+    return NULL;
+}
+
+
+/* Receives datagrams until the socket is empty (or the batch is complete),
+ * decodes them and passes them to their rooms
+ */
+static
+void receive_datagrams(server_rooms_t *rooms) {
+    char buffer[MAX_CLIENT_DGRAM_LENGTH + CLIENT_DGRAM_ROOM_LEN + 1];
+
+    for(int i = 0; i < ROOMS_RECEIVE_BATCH; ++i) {
+        struct sockaddr_in6 address;
+        socklen_t address_length = sizeof(struct sockaddr_in6);
+
+        memset(&address, 0, sizeof(struct sockaddr_in6));
+
+        uint64_t receive_nanos;
+        ssize_t read_bytes = receive_datagram(rooms->server_socket,
+                                              buffer,
+                                              sizeof(buffer),
+                                              &address,
+                                              &address_length,
+                                              &receive_nanos);
+
+        if(read_bytes < 0) {
+            if(errno != EAGAIN && errno != EWOULDBLOCK) {
+                log_error(LOG_ERROR, "recvmsg");
+            }
+
+            return;
+        }
+
+        /* Drop the datagram before parsing it if its source exceeded its rate */
+        if(rooms->rate_limiter != NULL &&
+           !rate_limiter_allow(rooms->rate_limiter, &address, monotonic_nanos())) {
+
+            __atomic_fetch_add(&rooms->datagrams_rate_limited, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        client_dgram_t dgram;
+        ssize_t datagram_size = deserialize_client_dgram(&dgram, buffer, read_bytes);
+
+        if(datagram_size < 0) {
+            continue;
+        }
+
+        if(dgram.room >= rooms->rooms_count) {
+            continue;
+        }
+
+        room_t *room = &rooms->rooms[dgram.room];
+        room_update_t *update = spsc_ring_reserve(&room->inbox, sizeof(room_update_t));
+
+        if(update == NULL) {
+            __atomic_fetch_add(&room->updates_dropped, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        update->address = address;
+        update->address_length = address_length;
+        update->receive_nanos = receive_nanos;
+        update->datagram_size = datagram_size;
+        update->dgram = dgram;
+
+        spsc_ring_commit(&room->inbox);
+
+        schedule_room(rooms, room);
+    }
+}
+
+
+/* Schedules the rooms whose deadlines have passed and returns the earliest
+ * of the remaining deadlines
+ */
+static
+uint64_t schedule_expired_rooms(server_rooms_t *rooms) {
+    uint64_t now = monotonic_nanos();
+    uint64_t earliest = ROOMS_NO_DEADLINE;
+
+    for(uint16_t i = 0; i < rooms->rooms_count; ++i) {
+        room_t *room = &rooms->rooms[i];
+        uint64_t deadline = __atomic_load_n(&room->next_deadline, __ATOMIC_SEQ_CST);
+
+        if(deadline <= now) {
+            /* The room publishes a new deadline when it has run, unless
+             * it has done so in the meantime
+             */
+            if(__atomic_compare_exchange_n(&room->next_deadline, &deadline, ROOMS_NO_DEADLINE,
+                                           false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+                schedule_room(rooms, room);
+                continue;
+            }
+        }
+
+        if(deadline < earliest) {
+            earliest = deadline;
+        }
+    }
+
+    return earliest;
+}
+
+
+server_rooms_t *rooms_backend_init(server_game_state_t **states,
+                                   uint16_t rooms_count,
+                                   uint32_t workers_count,
+                                   rate_limiter_t *rate_limiter) {
+
+    server_rooms_t *rooms = malloc(sizeof(server_rooms_t));
+
+    if(rooms == NULL) {
+        perror("malloc");
+        return NULL;
+    }
+
+    memset(rooms, 0, sizeof(server_rooms_t));
+
+    rooms->rooms_count = rooms_count;
+    rooms->workers_count = workers_count;
+    rooms->server_socket = states[0]->server_socket;
+    rooms->rate_limiter = rate_limiter;
+    rooms->network_deadline = ROOMS_NO_DEADLINE;
+
+    rooms->rooms = aligned_alloc(SPSC_RING_CACHE_LINE, rooms_count * sizeof(room_t));
+    rooms->queues = malloc(workers_count * sizeof(room_queue_t));
+    rooms->workers = malloc(workers_count * sizeof(pthread_t));
+    rooms->wakeup_event = eventfd(0, EFD_NONBLOCK);
+
+    if(rooms->rooms == NULL || rooms->queues == NULL || rooms->workers == NULL ||
+       rooms->wakeup_event < 0) {
+
+        perror("rooms");
+        return NULL;
+    }
+
+    pthread_mutex_init(&rooms->idle_lock, NULL);
+    pthread_cond_init(&rooms->idle_condition, NULL);
+
+    for(uint32_t i = 0; i < workers_count; ++i) {
+        pthread_mutex_init(&rooms->queues[i].lock, NULL);
+
+        rooms->queues[i].rooms = malloc(rooms_count * sizeof(room_t *));
+        rooms->queues[i].head = 0;
+        rooms->queues[i].count = 0;
+
+        if(rooms->queues[i].rooms == NULL) {
+            perror("malloc");
+            return NULL;
+        }
+    }
+
+    for(uint16_t i = 0; i < rooms_count; ++i) {
+        room_t *room = &rooms->rooms[i];
+
+        memset(room, 0, sizeof(room_t));
+
+        if(!spsc_ring_init(&room->inbox, ROOMS_INBOX_CAPACITY)) {
+            return NULL;
+        }
+
+        room->state = states[i];
+        room->rooms = rooms;
+        room->round_period = timespec_nanos(&states[i]->round_params.it_interval);
+        room->client_period = timespec_nanos(&states[i]->timeout_params.it_interval);
+        room->next_deadline = ROOMS_NO_DEADLINE;
+        room->home_worker = i % workers_count;
+
+        states[i]->backend = &rooms_backend;
+        states[i]->backend_data = room;
+    }
+
+    return rooms;
+}
+
+
+void rooms_backend_run(server_rooms_t *rooms, const server_event_handlers_t *handlers) {
+    rooms->handlers = handlers;
+
+    /* Signals are handled by the network thread only
+     */
+    sigset_t blocked_signals;
+    sigset_t previous_signals;
+
+    sigfillset(&blocked_signals);
+    pthread_sigmask(SIG_BLOCK, &blocked_signals, &previous_signals);
+
+    room_worker_t *workers = malloc(rooms->workers_count * sizeof(room_worker_t));
+
+    if(workers == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+
+    for(uint32_t i = 0; i < rooms->workers_count; ++i) {
+        workers[i].rooms = rooms;
+        workers[i].index = i;
+
+        int err = pthread_create(&rooms->workers[i], NULL, run_worker, &workers[i]);
+
+        if(err != 0) {
+            errno = err;
+            perror("pthread_create");
+            exit(1);
+        }
+    }
+
+    pthread_sigmask(SIG_SETMASK, &previous_signals, NULL);
+
+    struct pollfd fds[2];
+    eventfd_t events;
+
+    fds[0].fd = rooms->server_socket;
+    fds[0].events = POLLIN;
+    fds[1].fd = rooms->wakeup_event;
+    fds[1].events = POLLIN;
+
+    /* Every room runs once at start, so that it publishes the deadlines
+     * of the timers started before
+     */
+    for(uint16_t i = 0; i < rooms->rooms_count; ++i) {
+        schedule_room(rooms, &rooms->rooms[i]);
+    }
+
+    while(1) {
+        /* Rooms which publish an earlier deadline while the deadlines are
+         * being checked do not wake the network thread up, so they are
+         * checked once again after the new deadline has been published
+         */
+        __atomic_store_n(&rooms->network_deadline, 0, __ATOMIC_SEQ_CST);
+
+        uint64_t earliest = schedule_expired_rooms(rooms);
+
+        __atomic_store_n(&rooms->network_deadline, earliest, __ATOMIC_SEQ_CST);
+
+        if(schedule_expired_rooms(rooms) < earliest) {
+            continue;
+        }
+
+        /* Timeout is rounded up to whole milliseconds, so that the rooms
+         * are not checked before their deadlines
+         */
+        int timeout = -1;
+
+        if(earliest != ROOMS_NO_DEADLINE) {
+            uint64_t now = monotonic_nanos();
+            uint64_t remaining = earliest > now ? earliest - now : 0;
+
+            timeout = (remaining + 999999ULL) / 1000000ULL;
+        }
+
+        int poll_ret_val = poll(fds, 2, timeout);
+
+        if(poll_ret_val < 0) {
+            if(errno != EINTR) {
+                log_error(LOG_ERROR, "poll");
+            }
+
+            /* Statistics request is handled by each of the rooms when
+             * it runs, the idle ones are run as well
+             */
+            for(uint16_t i = 0; i < rooms->rooms_count; ++i) {
+                schedule_room(rooms, &rooms->rooms[i]);
+            }
+
+            continue;
+        }
+
+        if(fds[1].revents & POLLIN) {
+            eventfd_read(rooms->wakeup_event, &events);
+        }
+
+        if(fds[0].revents & POLLIN) {
+            receive_datagrams(rooms);
+        }
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef SERVER_ROOMS_H
+#define SERVER_ROOMS_H
+
+#include <stdint.h>
+#include "game_server_protocol.h"
+#include "rate_limiter.h"
+#include "server_uring.h"
+
+
+/* Maximum number of rooms (independent games) hosted by a single
+ * server process and maximum number of threads ticking them
+ */
+#define MAX_ROOMS                                       256
+#define MAX_ROOM_WORKERS                                 64
+
+
+/* Capacity (in bytes) of the ring of decoded client datagrams passed from
+ * the network thread to each of the rooms
+ */
+#define ROOMS_INBOX_CAPACITY                        (1 << 14)
+
+
+/* Maximum number of datagrams received by the network thread before it
+ * checks the deadlines of the rooms again
+ */
+#define ROOMS_RECEIVE_BATCH                              64
+
+
+typedef struct server_rooms_t server_rooms_t;
+
+
+/* Installs rooms backend in each of the game states (first argument, one
+ * per room, states[i] hosts the room number i) and prepares the pool of
+ * worker threads (third argument) which tick the rooms. Datagrams are
+ * received from the socket of the first room (shared by all of them) and
+ * checked with the rate limiter passed as the fourth argument. Returns NULL
+ * on failure
+ */
+server_rooms_t *rooms_backend_init(server_game_state_t **, uint16_t, uint32_t, rate_limiter_t *);
+
+
+/* Starts the worker threads and runs the network loop in the calling
+ * thread: it decodes client datagrams, passes them to the rooms selected
+ * in the datagrams and schedules the rooms whose datagrams or timers are
+ * waiting. A scheduled room is queued on its home worker, idle workers
+ * steal rooms from the queues of the busy ones. Never returns
+ */
+void rooms_backend_run(server_rooms_t *, const server_event_handlers_t *);
+
+
+#endif /* SERVER_ROOMS_H */
@@ -0,0 +1,523 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include "server_threads.h"
+#include "game_server_protocol.h"
+#include "client_protocol.h"
+#include "spsc_ring.h"
+#include "log.h"
+
+
+/* Time (in milliseconds) after which the simulation thread retries to
+ * pass the datagrams waiting in outbound queues to the full outbound ring
+ */
+#define THREADS_BACKLOG_RETRY_MILLIS                      1
+
+
+typedef struct threads_update_t threads_update_t;
+typedef struct threads_send_t threads_send_t;
+typedef struct threads_backend_t threads_backend_t;
+
+
+/* Record of the inbound ring: decoded client datagram and its sender
+ */
+struct threads_update_t {
+    struct sockaddr_in6 address;
+    socklen_t address_length;
+    uint64_t receive_nanos;
+
+    ssize_t datagram_size;
+    client_dgram_t dgram;
+};
+
+
+/* Header of the record of the outbound ring, followed by total_size bytes
+ * of datagrams (a run of datagrams of segment_size bytes each, the last one
+ * may be shorter)
+ */
+struct threads_send_t {
+    struct sockaddr_in6 address;
+    socklen_t address_length;
+
+    uint32_t total_size;
+    uint16_t segment_size;
+};
+
+
+struct threads_backend_t {
+    /* Decoded client datagrams (produced by the I/O thread)
+     */
+    spsc_ring_t inbound;
+
+    /* Datagrams to be sent (produced by the simulation thread)
+     */
+    spsc_ring_t outbound;
+
+    /* Event descriptors through which each of the threads wakes the other
+     * one up after it has committed new records
+     */
+    int inbound_event;
+    int outbound_event;
+
+    /* Flag which indicates whether records have been committed to the
+     * outbound ring since the I/O thread has been woken up last time
+     * (simulation thread only)
+     */
+    bool outbound_pending;
+
+    /* Flag which indicates whether the socket send buffer is full, offset
+     * of the first datagram of the current outbound record which has not
+     * been sent yet (when it is sent one by one) and the flag which
+     * indicates whether segmentation offload can be used (I/O thread only)
+     */
+    bool send_blocked;
+    uint32_t split_offset;
+    bool gso_supported;
+
+    /* Counters updated by the I/O thread and copied to the server statistics
+     * by the simulation thread
+     */
+    uint64_t datagrams_rate_limited;
+    uint64_t updates_dropped;
+
+    pthread_t io_thread;
+};
+
+
+static
+void wake_up(int event_fd) {
+    if(eventfd_write(event_fd, 1) < 0) {
+        log_error(LOG_ERROR, "eventfd_write");
+    }
+}
+
+
+/* Passes the datagrams to the I/O thread. The ring being full is reported
+ * as a full socket send buffer, so the datagrams wait in outbound queues
+ */
+static
+int threaded_send_datagrams(server_game_state_t *state,
+                            uint8_t client_no,
+                            char *data,
+                            size_t total_size,
+                            uint16_t segment_size) {
+
+    threads_backend_t *backend = state->backend_data;
+    threads_send_t *send = spsc_ring_reserve(&backend->outbound, sizeof(threads_send_t) + total_size);
+
+    if(send == NULL) {
+        return SEND_STATUS_WOULD_BLOCK;
+    }
+
+    send->address = state->players[client_no].conn.address;
+    send->address_length = state->players[client_no].conn.address_length;
+    send->total_size = total_size;
+    send->segment_size = segment_size;
+
+    memcpy(send + 1, data, total_size);
+
+    spsc_ring_commit(&backend->outbound);
+    backend->outbound_pending = true;
+
+    return SEND_STATUS_OK;
+}
+
+
+/* Timers are owned by the simulation thread and work exactly as in the
+ * poll backend
+ */
+static
+void threaded_start_round_timer(server_game_state_t *state) {
+    poll_backend.start_round_timer(state);
+}
+
+
+static
+void threaded_stop_round_timer(server_game_state_t *state) {
+    poll_backend.stop_round_timer(state);
+}
+
+
+static
+void threaded_start_client_timer(server_game_state_t *state, uint8_t client_no) {
+    poll_backend.start_client_timer(state, client_no);
+}
+
+
+static
+void threaded_stop_client_timer(server_game_state_t *state, uint8_t client_no) {
+    poll_backend.stop_client_timer(state, client_no);
+}
+
+
+static const server_backend_t threaded_backend = {
+    .send_datagrams = threaded_send_datagrams,
+    .start_round_timer = threaded_start_round_timer,
+    .stop_round_timer = threaded_stop_round_timer,
+    .start_client_timer = threaded_start_client_timer,
+    .stop_client_timer = threaded_stop_client_timer
+};
+
+
+/* Receives datagrams until the socket is empty (or the batch is complete),
+ * decodes them and passes them to the simulation thread
+ */
+static
+void receive_datagrams(server_game_state_t *state, threads_backend_t *backend) {
+    char buffer[MAX_CLIENT_DGRAM_LENGTH + CLIENT_DGRAM_ROOM_LEN + 1];
+    bool received = false;
+
+    for(int i = 0; i < THREADS_RECEIVE_BATCH; ++i) {
+        struct sockaddr_in6 address;
+        socklen_t address_length = sizeof(struct sockaddr_in6);
+
+        memset(&address, 0, sizeof(struct sockaddr_in6));
+
+        uint64_t receive_nanos;
+        ssize_t read_bytes = receive_datagram(state->server_socket,
+                                              buffer,
+                                              sizeof(buffer),
+                                              &address,
+                                              &address_length,
+                                              &receive_nanos);
+
+        if(read_bytes < 0) {
+            if(errno != EAGAIN && errno != EWOULDBLOCK) {
+                log_error(LOG_ERROR, "recvmsg");
+            }
+
+            break;
+        }
+
+        /* Drop the datagram before parsing it if its source exceeded its rate */
+        if(state->rate_limiter != NULL &&
+           !rate_limiter_allow(state->rate_limiter, &address, monotonic_nanos())) {
+
+            __atomic_fetch_add(&backend->datagrams_rate_limited, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        client_dgram_t dgram;
+        ssize_t datagram_size = deserialize_client_dgram(&dgram, buffer, read_bytes);
+
+        if(datagram_size < 0 || dgram.room != state->room_id) {
+            continue;
+        }
+
+        threads_update_t *update = spsc_ring_reserve(&backend->inbound, sizeof(threads_update_t));
+
+        if(update == NULL) {
+            __atomic_fetch_add(&backend->updates_dropped, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        update->address = address;
+        update->address_length = address_length;
+        update->receive_nanos = receive_nanos;
+        update->datagram_size = datagram_size;
+        update->dgram = dgram;
+
+        spsc_ring_commit(&backend->inbound);
+        received = true;
+    }
+
+    if(received) {
+        wake_up(backend->inbound_event);
+    }
+}
+
+
+/* Sends the outbound record. Returns false if the socket send buffer
+ * is full (the rest of the record is sent on the next call)
+ */
+static
+bool send_record(server_game_state_t *state, threads_backend_t *backend, threads_send_t *send) {
+    char *data = (char *) (send + 1);
+    int status;
+
+    if(send->total_size != send->segment_size && backend->gso_supported &&
+       backend->split_offset == 0) {
+
+        status = send_datagrams_to(state->server_socket, &send->address, send->address_length,
+                                   data, send->total_size, send->segment_size);
+
+        if(status == SEND_STATUS_WOULD_BLOCK) {
+            return false;
+        }
+
+        if(status == SEND_STATUS_OK) {
+            return true;
+        }
+
+        /* Segmentation offload not available, further runs are split
+         * by this thread
+         */
+        backend->gso_supported = false;
+    }
+
+    while(backend->split_offset < send->total_size) {
+        uint32_t length = send->total_size - backend->split_offset;
+
+        if(length > send->segment_size) {
+            length = send->segment_size;
+        }
+
+        status = send_datagrams_to(state->server_socket, &send->address, send->address_length,
+                                   data + backend->split_offset, length, length);
+
+        if(status == SEND_STATUS_WOULD_BLOCK) {
+            return false;
+        }
+
+        backend->split_offset += length;
+    }
+
+    backend->split_offset = 0;
+
+    return true;
+}
+
+
+static
+void send_datagrams(server_game_state_t *state, threads_backend_t *backend) {
+    threads_send_t *send;
+    uint32_t length;
+
+    while((send = spsc_ring_peek(&backend->outbound, &length)) != NULL) {
+        if(!send_record(state, backend, send)) {
+            backend->send_blocked = true;
+            return;
+        }
+
+        spsc_ring_release(&backend->outbound);
+    }
+
+    backend->send_blocked = false;
+}
+
+
+static
+void *run_io_thread(void *argument) {
+    server_game_state_t *state = argument;
+    threads_backend_t *backend = state->backend_data;
+
+    struct pollfd fds[2];
+    eventfd_t events;
+
+    fds[0].fd = state->server_socket;
+    fds[1].fd = backend->outbound_event;
+    fds[1].events = POLLIN;
+
+    while(1) {
+        fds[0].events = POLLIN;
+
+        if(backend->send_blocked) {
+            fds[0].events |= POLLOUT;
+        }
+
+        if(poll(fds, 2, -1) < 0) {
+            if(errno != EINTR) {
+                log_error(LOG_ERROR, "poll");
+            }
+
+            continue;
+        }
+
+        if(fds[1].revents & POLLIN) {
+            eventfd_read(backend->outbound_event, &events);
+        }
+
+        if(fds[0].revents & POLLIN) {
+            receive_datagrams(state, backend);
+        }
+
+        if(!backend->send_blocked || (fds[0].revents & POLLOUT)) {
+            send_datagrams(state, backend);
+        }
+    }
+
+    return NULL;
+}
+
+
+/* Applies all decoded datagrams waiting in the inbound ring, in the order
+ * in which they have been received
+ */
+static
+void apply_updates(server_game_state_t *state,
+                   threads_backend_t *backend,
+                   const server_event_handlers_t *handlers) {
+
+    threads_update_t *update;
+    uint32_t length;
+
+    while((update = spsc_ring_peek(&backend->inbound, &length)) != NULL) {
+        memset(&state->receive_address, 0, sizeof(struct sockaddr_in6));
+        state->receive_address = update->address;
+        state->receive_address_length = update->address_length;
+        state->receive_nanos = update->receive_nanos;
+
+        handlers->client_update(state, update->datagram_size, &update->dgram);
+
+        spsc_ring_release(&backend->inbound);
+    }
+}
+
+
+bool threaded_backend_init(server_game_state_t *state) {
+    threads_backend_t *backend = aligned_alloc(SPSC_RING_CACHE_LINE, sizeof(threads_backend_t));
+
+    if(backend == NULL) {
+        perror("aligned_alloc");
+        return false;
+    }
+
+    memset(backend, 0, sizeof(threads_backend_t));
+
+    if(!spsc_ring_init(&backend->inbound, THREADS_INBOUND_RING_CAPACITY)) {
+        free(backend);
+        return false;
+    }
+
+    if(!spsc_ring_init(&backend->outbound, THREADS_OUTBOUND_RING_CAPACITY)) {
+        spsc_ring_free(&backend->inbound);
+        free(backend);
+        return false;
+    }
+
+    backend->inbound_event = eventfd(0, EFD_NONBLOCK);
+    backend->outbound_event = eventfd(0, EFD_NONBLOCK);
+
+    if(backend->inbound_event < 0 || backend->outbound_event < 0) {
+        perror("eventfd");
+
+        if(backend->inbound_event >= 0) {
+            close(backend->inbound_event);
+        }
+
+        if(backend->outbound_event >= 0) {
+            close(backend->outbound_event);
+        }
+
+        spsc_ring_free(&backend->outbound);
+        spsc_ring_free(&backend->inbound);
+        free(backend);
+        return false;
+    }
+
+    backend->gso_supported = state->gso_supported;
+
+    state->backend = &threaded_backend;
+    state->backend_data = backend;
+
+    return true;
+}
+
+
+void threaded_backend_run(server_game_state_t *state, const server_event_handlers_t *handlers) {
+    threads_backend_t *backend = state->backend_data;
+
+    /* Signals are handled by the simulation thread only
+     */
+    sigset_t blocked_signals;
+    sigset_t previous_signals;
+
+    sigfillset(&blocked_signals);
+    pthread_sigmask(SIG_BLOCK, &blocked_signals, &previous_signals);
+
+    int err = pthread_create(&backend->io_thread, NULL, run_io_thread, state);
+
+    if(err != 0) {
+        errno = err;
+        perror("pthread_create");
+        exit(1);
+    }
+
+    pthread_sigmask(SIG_SETMASK, &previous_signals, NULL);
+
+    /* Descriptor of the server socket is replaced with the event descriptor
+     * of the inbound ring, the timers stay where the poll backend puts them
+     */
+    state->fds[0].fd = backend->inbound_event;
+    state->fds[0].events = POLLIN;
+
+    int poll_ret_val;
+    ssize_t read_ret_val;
+    uint64_t timers_elapsed;
+    eventfd_t events;
+
+    while(1) {
+        int timeout = outbound_backlog(state) ? THREADS_BACKLOG_RETRY_MILLIS : -1;
+
+        poll_ret_val = poll(state->fds, SERVER_POLL_DESCRIPTORS_COUNT, timeout);
+
+        if(poll_ret_val < 0 && errno != EINTR) {
+            log_error(LOG_ERROR, "poll");
+        }
+
+        if(poll_ret_val > 0) {
+            if(state->fds[0].revents & POLLIN) {
+                eventfd_read(backend->inbound_event, &events);
+            }
+
+            /* Timeouts are handled before the datagrams are applied, as
+             * applying them may restart the timers which have just expired
+             */
+            for(int i = 2; i < SERVER_POLL_DESCRIPTORS_COUNT; ++i) {
+                if(state->fds[i].revents & POLLIN) {
+                    read_ret_val = read(state->fds[i].fd, &timers_elapsed, sizeof(timers_elapsed));
+
+                    if(read_ret_val < 0) {
+                        log_error(LOG_ERROR, "read");
+                    }
+
+                    handlers->client_timeout(state, i - 2);
+                }
+            }
+
+            /* During the game the datagrams are applied only at round
+             * boundaries, so the simulation depends only on the sequence
+             * of datagrams received before each round and not on the timing
+             * of their arrival between rounds
+             */
+            if(state->fds[1].revents & POLLIN) {
+                read_ret_val = read(state->fds[1].fd, &timers_elapsed, sizeof(timers_elapsed));
+
+                if(read_ret_val < 0) {
+                    log_error(LOG_ERROR, "read");
+                }
+
+                apply_updates(state, backend, handlers);
+                handlers->round_tick(state);
+            }
+        }
+
+        if(state->game_status != GAME_STATE_GAME_STARTED) {
+            apply_updates(state, backend, handlers);
+        }
+
+        if(outbound_backlog(state)) {
+            drain_outbound_queues(state);
+        }
+
+        if(backend->outbound_pending) {
+            backend->outbound_pending = false;
+            wake_up(backend->outbound_event);
+        }
+
+        state->stats.datagrams_rate_limited = __atomic_load_n(&backend->datagrams_rate_limited,
+                                                              __ATOMIC_RELAXED);
+        state->stats.updates_dropped = __atomic_load_n(&backend->updates_dropped,
+                                                       __ATOMIC_RELAXED);
+
+        handlers->iteration_done(state);
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef SERVER_THREADS_H
+#define SERVER_THREADS_H
+
+#include <stdbool.h>
+#include "game_server_protocol.h"
+#include "server_uring.h"
+
+
+/* Capacity (in bytes) of the ring of decoded client datagrams passed from
+ * the I/O thread to the simulation thread
+ */
+#define THREADS_INBOUND_RING_CAPACITY               (1 << 18)
+
+
+/* Capacity (in bytes) of the ring of datagrams passed from the simulation
+ * thread to the I/O thread to be sent (fits a few full bursts for every
+ * client)
+ */
+#define THREADS_OUTBOUND_RING_CAPACITY              (1 << 22)
+
+
+/* Maximum number of datagrams received by the I/O thread before it wakes
+ * the simulation thread up
+ */
+#define THREADS_RECEIVE_BATCH                            64
+
+
+/* Sets up the rings and the I/O thread state and installs threaded backend
+ * in server_game_state_t structure. Returns false (leaving the default
+ * backend untouched) on failure
+ */
+bool threaded_backend_init(server_game_state_t *);
+
+
+/* Starts the I/O thread, which owns the server socket: it receives and
+ * decodes client datagrams and sends the datagrams produced by the game.
+ * The calling thread runs the simulation: it applies decoded datagrams
+ * (during the game only at round boundaries), handles the timers and passes
+ * everything to the handlers. Never returns
+ */
+void threaded_backend_run(server_game_state_t *, const server_event_handlers_t *);
+
+
+#endif /* SERVER_THREADS_H */
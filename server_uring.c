@@ -0,0 +1,836 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <linux/io_uring.h>
+#include "server_uring.h"
+#include "game_server_protocol.h"
+#include "log.h"
+
+
+/* Tags stored in the most significant byte of user_data of every
+ * submitted operation, used to dispatch completions
+ */
+#define URING_TAG_RECEIVE                                 1
+#define URING_TAG_SEND                                    2
+#define URING_TAG_ROUND                                   3
+#define URING_TAG_CLIENT_TIMER                            4
+#define URING_TAG_IGNORE                                  5
+
+
+#define URING_BUFFER_GROUP                                0
+
+
+/* Size of the control messages of a receive (the receive timestamp)
+ */
+#define URING_RECEIVE_CONTROL_SIZE     CMSG_SPACE(sizeof(struct timespec))
+
+
+/* Size of single receive buffer: header filled by the kernel, sender
+ * address, control messages and payload (large enough to detect too long
+ * datagrams)
+ */
+#define URING_RECEIVE_BUFFER_SIZE      (sizeof(struct io_uring_recvmsg_out) + \
+                                        sizeof(struct sockaddr_in6) +         \
+                                        URING_RECEIVE_CONTROL_SIZE +          \
+                                        MAX_SERVER_UDP_DGRAM_LENGTH)
+
+
+typedef struct uring_send_slot_t uring_send_slot_t;
+typedef struct uring_burst_copy_t uring_burst_copy_t;
+typedef struct uring_backend_t uring_backend_t;
+
+
+struct uring_send_slot_t {
+    /* Message header, its single io vector and control buffer
+     * (UDP_SEGMENT) which have to live until the send completes
+     */
+    struct msghdr msg;
+    struct iovec iov;
+    char control[CMSG_SPACE(sizeof(uint16_t))];
+
+    /* Copy of the recipient address
+     */
+    struct sockaddr_in6 address;
+
+    /* Index of the burst copy referenced by the send
+     */
+    uint8_t copy_index;
+
+    /* Flag which indicates whether the send was segmented
+     */
+    bool segmented;
+
+    /* Recipient of the send (its slot and session) and the game of the
+     * datagrams, for the resynchronisation of the client if the send fails
+     */
+    uint8_t client_no;
+    uint64_t session_id;
+    uint32_t game_id;
+};
+
+
+struct uring_burst_copy_t {
+    char buffer[MAX_BURST_SEGMENTS * MAX_SERVER_UDP_DGRAM_LENGTH];
+
+    /* Generation of the burst this copy was made of
+     */
+    uint32_t generation;
+
+    /* Number of in-flight sends referencing this copy
+     */
+    uint32_t references;
+
+    bool valid;
+};
+
+
+struct uring_backend_t {
+    int ring_fd;
+
+    /* Mappings of the rings (NULL until mapped), the completion queue
+     * ring is the same mapping as the submission queue ring if the kernel
+     * maps them at once
+     */
+    char *sq_ring;
+    size_t sq_ring_size;
+    char *cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+
+    /* Submission queue (pointers into the mapped ring)
+     */
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned sq_entries;
+    unsigned sq_local_tail;
+    unsigned to_submit;
+    struct io_uring_sqe *sqes;
+
+    /* Completion queue (pointers into the mapped ring)
+     */
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    /* Provided buffers for multishot receives
+     */
+    struct io_uring_buf_ring *buffer_ring;
+    char *receive_buffers;
+    uint16_t buffer_ring_tail;
+    struct msghdr receive_msg;
+
+    /* Round timer, delivered as absolute timeouts
+     */
+    struct __kernel_timespec round_deadline;
+    struct __kernel_timespec round_period;
+    uint32_t round_generation;
+    bool round_running;
+
+    /* Client timeout timers, delivered as relative timeouts
+     */
+    struct __kernel_timespec client_timeout;
+    uint32_t client_generation[MAX_PLAYERS];
+
+    /* Sends which are in flight and bursts they refer to
+     */
+    uring_send_slot_t send_slots[URING_SEND_SLOTS];
+    uint16_t free_slots[URING_SEND_SLOTS];
+    uint16_t free_slots_count;
+
+    uring_burst_copy_t copies[URING_BURST_COPIES];
+    uint8_t current_copy;
+
+    /* Last prepared (not yet submitted) send, used for linking
+     * consecutive sends of a burst to the same client
+     */
+    struct io_uring_sqe *last_send;
+    uint8_t last_send_client;
+    uint32_t last_send_generation;
+};
+
+
+static
+uint64_t make_user_data(uint8_t tag, uint32_t generation, uint16_t index) {
+    return ((uint64_t) tag << 56) | ((uint64_t) generation << 16) | index;
+}
+
+
+static
+void flush_submissions(uring_backend_t *uring, unsigned wait_for) {
+    __atomic_store_n(uring->sq_tail, uring->sq_local_tail, __ATOMIC_RELEASE);
+
+    int ret_val;
+
+    do {
+        ret_val = syscall(__NR_io_uring_enter,
+                          uring->ring_fd,
+                          uring->to_submit,
+                          wait_for,
+                          wait_for > 0 ? IORING_ENTER_GETEVENTS : 0,
+                          NULL,
+                          0);
+    } while(ret_val < 0 && errno == EINTR && wait_for == 0);
+
+    if(ret_val < 0 && errno == EINTR) {
+        /* Interrupted while waiting (nothing has been submitted), let the
+         * loop handle the signal
+         */
+        return;
+    }
+
+    if(ret_val < 0) {
+        log_error(LOG_ERROR, "io_uring_enter");
+        exit(1);
+    }
+
+    uring->to_submit = 0;
+    uring->last_send = NULL;
+}
+
+
+static
+struct io_uring_sqe *get_sqe(uring_backend_t *uring) {
+    unsigned head = __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE);
+
+    if(uring->sq_local_tail - head >= uring->sq_entries) {
+        flush_submissions(uring, 0);
+    }
+
+    unsigned index = uring->sq_local_tail & *uring->sq_mask;
+    struct io_uring_sqe *sqe = &uring->sqes[index];
+
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    uring->sq_array[index] = index;
+
+    uring->sq_local_tail++;
+    uring->to_submit++;
+
+    return sqe;
+}
+
+
+static
+void provide_receive_buffer(uring_backend_t *uring, uint16_t buffer_id) {
+    struct io_uring_buf *buffer;
+
+    buffer = &uring->buffer_ring->bufs[uring->buffer_ring_tail & (URING_RECEIVE_BUFFERS - 1)];
+    buffer->addr = (uint64_t) (uintptr_t) (uring->receive_buffers +
+                                           (size_t) buffer_id * URING_RECEIVE_BUFFER_SIZE);
+    buffer->len = URING_RECEIVE_BUFFER_SIZE;
+    buffer->bid = buffer_id;
+
+    uring->buffer_ring_tail++;
+    __atomic_store_n(&uring->buffer_ring->tail, uring->buffer_ring_tail, __ATOMIC_RELEASE);
+}
+
+
+static
+void arm_receive(server_game_state_t *state, uring_backend_t *uring) {
+    struct io_uring_sqe *sqe = get_sqe(uring);
+
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = state->server_socket;
+    sqe->addr = (uint64_t) (uintptr_t) &uring->receive_msg;
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    sqe->user_data = make_user_data(URING_TAG_RECEIVE, 0, 0);
+}
+
+
+static
+void arm_timeout(uring_backend_t *uring,
+                 struct __kernel_timespec *spec,
+                 uint32_t flags,
+                 uint64_t user_data) {
+
+    struct io_uring_sqe *sqe = get_sqe(uring);
+
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = (uint64_t) (uintptr_t) spec;
+    sqe->len = 1;
+    sqe->off = 0;
+    sqe->timeout_flags = flags;
+    sqe->user_data = user_data;
+}
+
+
+static
+void remove_timeout(uring_backend_t *uring, uint64_t target) {
+    struct io_uring_sqe *sqe = get_sqe(uring);
+
+    sqe->opcode = IORING_OP_TIMEOUT_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = target;
+    sqe->user_data = make_user_data(URING_TAG_IGNORE, 0, 0);
+}
+
+
+static
+void timespec_add(struct __kernel_timespec *target, const struct __kernel_timespec *value) {
+    target->tv_sec += value->tv_sec;
+    target->tv_nsec += value->tv_nsec;
+
+    if(target->tv_nsec >= 1000000000) {
+        target->tv_sec++;
+        target->tv_nsec -= 1000000000;
+    }
+}
+
+
+static
+bool timespec_before(const struct __kernel_timespec *first, const struct timespec *second) {
+    return (first->tv_sec < second->tv_sec ||
+            (first->tv_sec == second->tv_sec && first->tv_nsec <= second->tv_nsec));
+}
+
+
+static
+void uring_start_round_timer(server_game_state_t *state) {
+    uring_backend_t *uring = state->backend_data;
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    uring->round_generation++;
+    uring->round_running = true;
+
+    uring->round_deadline.tv_sec = now.tv_sec;
+    uring->round_deadline.tv_nsec = now.tv_nsec;
+    timespec_add(&uring->round_deadline, &uring->round_period);
+
+    arm_timeout(uring, &uring->round_deadline, IORING_TIMEOUT_ABS,
+                make_user_data(URING_TAG_ROUND, uring->round_generation, 0));
+}
+
+
+static
+void uring_stop_round_timer(server_game_state_t *state) {
+    uring_backend_t *uring = state->backend_data;
+
+    remove_timeout(uring, make_user_data(URING_TAG_ROUND, uring->round_generation, 0));
+
+    uring->round_generation++;
+    uring->round_running = false;
+}
+
+
+static
+void uring_start_client_timer(server_game_state_t *state, uint8_t client_no) {
+    uring_backend_t *uring = state->backend_data;
+
+    uring->client_generation[client_no]++;
+
+    arm_timeout(uring, &uring->client_timeout, 0,
+                make_user_data(URING_TAG_CLIENT_TIMER,
+                               uring->client_generation[client_no],
+                               client_no));
+}
+
+
+static
+void uring_stop_client_timer(server_game_state_t *state, uint8_t client_no) {
+    uring_backend_t *uring = state->backend_data;
+
+    remove_timeout(uring, make_user_data(URING_TAG_CLIENT_TIMER,
+                                         uring->client_generation[client_no],
+                                         client_no));
+
+    uring->client_generation[client_no]++;
+}
+
+
+/* Returns index of the copy of the current burst, copying the burst
+ * if needed. Returns -1 if every copy is still referenced by in-flight
+ * sends
+ */
+static
+int copy_current_burst(server_game_state_t *state, uring_backend_t *uring) {
+    uring_burst_copy_t *copy = &uring->copies[uring->current_copy];
+
+    if(copy->valid && copy->generation == state->burst.generation) {
+        return uring->current_copy;
+    }
+
+    for(uint8_t i = 1; i <= URING_BURST_COPIES; ++i) {
+        uint8_t index = (uring->current_copy + i) % URING_BURST_COPIES;
+        copy = &uring->copies[index];
+
+        if(copy->references == 0) {
+            size_t burst_size = 0;
+
+            for(uint8_t j = 0; j < state->burst.segments_count; ++j) {
+                burst_size += state->burst.lengths[j];
+            }
+
+            memcpy(copy->buffer, state->burst.buffer, burst_size);
+            copy->generation = state->burst.generation;
+            copy->valid = true;
+
+            uring->current_copy = index;
+            return index;
+        }
+    }
+
+    return -1;
+}
+
+
+static
+int uring_send_datagrams(server_game_state_t *state,
+                         uint8_t client_no,
+                         char *data,
+                         size_t total_size,
+                         uint16_t segment_size) {
+
+    uring_backend_t *uring = state->backend_data;
+    int copy_index = copy_current_burst(state, uring);
+
+    if(copy_index < 0 || uring->free_slots_count == 0) {
+        /* Too many sends in flight - submit what has been queued so far
+         * (to keep the order of datagrams) and send synchronously
+         */
+        flush_submissions(uring, 0);
+        return poll_backend.send_datagrams(state, client_no, data, total_size, segment_size);
+    }
+
+    uint16_t slot_index = uring->free_slots[--uring->free_slots_count];
+    uring_send_slot_t *slot = &uring->send_slots[slot_index];
+
+    slot->address = state->players[client_no].conn.address;
+    slot->copy_index = copy_index;
+    slot->segmented = (total_size != segment_size);
+    slot->client_no = client_no;
+    slot->session_id = state->players[client_no].conn.session_id;
+    slot->game_id = state->game_id;
+
+    slot->iov.iov_base = uring->copies[copy_index].buffer + (data - state->burst.buffer);
+    slot->iov.iov_len = total_size;
+
+    memset(&slot->msg, 0, sizeof(slot->msg));
+    slot->msg.msg_name = &slot->address;
+    slot->msg.msg_namelen = state->players[client_no].conn.address_length;
+    slot->msg.msg_iov = &slot->iov;
+    slot->msg.msg_iovlen = 1;
+
+    if(slot->segmented) {
+        memset(slot->control, 0, sizeof(slot->control));
+        slot->msg.msg_control = slot->control;
+        slot->msg.msg_controllen = sizeof(slot->control);
+
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&slot->msg);
+        cmsg->cmsg_level = SOL_UDP;
+        cmsg->cmsg_type = UDP_SEGMENT;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        memcpy(CMSG_DATA(cmsg), &segment_size, sizeof(uint16_t));
+    }
+
+    uring->copies[copy_index].references++;
+
+    /* Keep datagrams of the burst sent to the same client in order
+     */
+    bool link = (uring->last_send != NULL &&
+                 uring->last_send_client == client_no &&
+                 uring->last_send_generation == state->burst.generation);
+
+    struct io_uring_sqe *previous = uring->last_send;
+    struct io_uring_sqe *sqe = get_sqe(uring);
+
+    if(link && uring->last_send != NULL) {
+        previous->flags |= IOSQE_IO_LINK;
+    }
+
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = state->server_socket;
+    sqe->addr = (uint64_t) (uintptr_t) &slot->msg;
+    sqe->len = 1;
+    sqe->user_data = make_user_data(URING_TAG_SEND, 0, slot_index);
+
+    uring->last_send = sqe;
+    uring->last_send_client = client_no;
+    uring->last_send_generation = state->burst.generation;
+
+    return SEND_STATUS_OK;
+}
+
+
+static const server_backend_t uring_backend = {
+    .send_datagrams = uring_send_datagrams,
+    .start_round_timer = uring_start_round_timer,
+    .stop_round_timer = uring_stop_round_timer,
+    .start_client_timer = uring_start_client_timer,
+    .stop_client_timer = uring_stop_client_timer
+};
+
+
+static
+bool map_rings(uring_backend_t *uring, struct io_uring_params *params) {
+    size_t sq_size = params->sq_off.array + params->sq_entries * sizeof(unsigned);
+    size_t cq_size = params->cq_off.cqes + params->cq_entries * sizeof(struct io_uring_cqe);
+
+    if(params->features & IORING_FEAT_SINGLE_MMAP) {
+        sq_size = (cq_size > sq_size) ? cq_size : sq_size;
+        cq_size = sq_size;
+    }
+
+    char *sq_ring = mmap(NULL, sq_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, uring->ring_fd, IORING_OFF_SQ_RING);
+
+    if(sq_ring == MAP_FAILED) {
+        return false;
+    }
+
+    uring->sq_ring = sq_ring;
+    uring->sq_ring_size = sq_size;
+
+    char *cq_ring = sq_ring;
+
+    if(!(params->features & IORING_FEAT_SINGLE_MMAP)) {
+        cq_ring = mmap(NULL, cq_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, uring->ring_fd, IORING_OFF_CQ_RING);
+
+        if(cq_ring == MAP_FAILED) {
+            return false;
+        }
+
+        uring->cq_ring = cq_ring;
+        uring->cq_ring_size = cq_size;
+    }
+
+    size_t sqes_size = params->sq_entries * sizeof(struct io_uring_sqe);
+    struct io_uring_sqe *sqes = mmap(NULL, sqes_size, PROT_READ | PROT_WRITE,
+                                     MAP_SHARED | MAP_POPULATE,
+                                     uring->ring_fd, IORING_OFF_SQES);
+
+    if(sqes == MAP_FAILED) {
+        return false;
+    }
+
+    uring->sqes = sqes;
+    uring->sqes_size = sqes_size;
+
+    uring->sq_head = (unsigned *) (sq_ring + params->sq_off.head);
+    uring->sq_tail = (unsigned *) (sq_ring + params->sq_off.tail);
+    uring->sq_mask = (unsigned *) (sq_ring + params->sq_off.ring_mask);
+    uring->sq_array = (unsigned *) (sq_ring + params->sq_off.array);
+    uring->sq_entries = params->sq_entries;
+    uring->sq_local_tail = *uring->sq_tail;
+
+    uring->cq_head = (unsigned *) (cq_ring + params->cq_off.head);
+    uring->cq_tail = (unsigned *) (cq_ring + params->cq_off.tail);
+    uring->cq_mask = (unsigned *) (cq_ring + params->cq_off.ring_mask);
+    uring->cqes = (struct io_uring_cqe *) (cq_ring + params->cq_off.cqes);
+
+    return true;
+}
+
+
+static
+bool register_receive_buffers(uring_backend_t *uring) {
+    size_t ring_size = URING_RECEIVE_BUFFERS * sizeof(struct io_uring_buf);
+
+    if(posix_memalign((void **) &uring->buffer_ring, sysconf(_SC_PAGESIZE), ring_size) != 0) {
+        return false;
+    }
+
+    memset(uring->buffer_ring, 0, ring_size);
+
+    uring->receive_buffers = malloc(URING_RECEIVE_BUFFERS * URING_RECEIVE_BUFFER_SIZE);
+
+    if(uring->receive_buffers == NULL) {
+        return false;
+    }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+
+    reg.ring_addr = (uint64_t) (uintptr_t) uring->buffer_ring;
+    reg.ring_entries = URING_RECEIVE_BUFFERS;
+    reg.bgid = URING_BUFFER_GROUP;
+
+    if(syscall(__NR_io_uring_register, uring->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        return false;
+    }
+
+    uring->buffer_ring_tail = 0;
+
+    for(uint16_t i = 0; i < URING_RECEIVE_BUFFERS; ++i) {
+        provide_receive_buffer(uring, i);
+    }
+
+    /* Template for multishot receives: the sender address and the control
+     * message with the receive timestamp are requested
+     */
+    memset(&uring->receive_msg, 0, sizeof(uring->receive_msg));
+    uring->receive_msg.msg_namelen = sizeof(struct sockaddr_in6);
+    uring->receive_msg.msg_controllen = URING_RECEIVE_CONTROL_SIZE;
+
+    return true;
+}
+
+
+/* Releases whatever map_rings and register_receive_buffers have set up
+ * before one of them failed, and closes the ring
+ */
+static
+void release_rings(uring_backend_t *uring) {
+    if(uring->sqes != NULL) {
+        munmap(uring->sqes, uring->sqes_size);
+    }
+
+    if(uring->cq_ring != NULL) {
+        munmap(uring->cq_ring, uring->cq_ring_size);
+    }
+
+    if(uring->sq_ring != NULL) {
+        munmap(uring->sq_ring, uring->sq_ring_size);
+    }
+
+    /* Closing the ring unregisters the buffer ring as well */
+    close(uring->ring_fd);
+
+    free(uring->buffer_ring);
+    free(uring->receive_buffers);
+}
+
+
+bool uring_backend_init(server_game_state_t *state) {
+    uring_backend_t *uring = malloc(sizeof(uring_backend_t));
+
+    if(uring == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+
+    memset(uring, 0, sizeof(uring_backend_t));
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    uring->ring_fd = syscall(__NR_io_uring_setup, URING_QUEUE_ENTRIES, &params);
+
+    if(uring->ring_fd < 0) {
+        perror("io_uring_setup");
+        free(uring);
+        return false;
+    }
+
+    if(!map_rings(uring, &params) || !register_receive_buffers(uring)) {
+        perror("io_uring");
+        release_rings(uring);
+        free(uring);
+        return false;
+    }
+
+    for(uint16_t i = 0; i < URING_SEND_SLOTS; ++i) {
+        uring->free_slots[i] = URING_SEND_SLOTS - 1 - i;
+    }
+
+    uring->free_slots_count = URING_SEND_SLOTS;
+
+    uring->round_period.tv_sec = state->round_params.it_interval.tv_sec;
+    uring->round_period.tv_nsec = state->round_params.it_interval.tv_nsec;
+
+    uring->client_timeout.tv_sec = state->timeout_params.it_interval.tv_sec;
+    uring->client_timeout.tv_nsec = state->timeout_params.it_interval.tv_nsec;
+
+    state->backend = &uring_backend;
+    state->backend_data = uring;
+
+    return true;
+}
+
+
+static
+void handle_receive_completion(server_game_state_t *state,
+                               uring_backend_t *uring,
+                               const server_event_handlers_t *handlers,
+                               struct io_uring_cqe *cqe) {
+
+    if(!(cqe->flags & IORING_CQE_F_MORE)) {
+        /* Multishot receive has been terminated, post it again */
+        arm_receive(state, uring);
+    }
+
+    if(cqe->res < 0) {
+        if(cqe->res != -ENOBUFS) {
+            errno = -cqe->res;
+            log_error(LOG_ERROR, "recvmsg");
+        }
+
+        return;
+    }
+
+    uint16_t buffer_id = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    char *buffer = uring->receive_buffers + (size_t) buffer_id * URING_RECEIVE_BUFFER_SIZE;
+
+    struct io_uring_recvmsg_out *out = (struct io_uring_recvmsg_out *) buffer;
+    char *name = buffer + sizeof(struct io_uring_recvmsg_out);
+    char *control = name + uring->receive_msg.msg_namelen;
+    char *payload = control + uring->receive_msg.msg_controllen;
+
+    ssize_t read_bytes = out->payloadlen;
+    size_t copied = (out->payloadlen < sizeof(state->server_buffer)) ?
+                    out->payloadlen : sizeof(state->server_buffer);
+
+    memset(&state->receive_address, 0, sizeof(struct sockaddr_in6));
+    memcpy(&state->receive_address, name,
+           (out->namelen < sizeof(struct sockaddr_in6)) ? out->namelen : sizeof(struct sockaddr_in6));
+    state->receive_address_length = out->namelen;
+
+    struct msghdr control_msg;
+    memset(&control_msg, 0, sizeof(control_msg));
+    control_msg.msg_control = control;
+    control_msg.msg_controllen = out->controllen;
+
+    state->receive_nanos = receive_timestamp(&control_msg);
+
+    memcpy(state->server_buffer, payload, copied);
+
+    /* The data has been copied, the buffer can be reused by the kernel */
+    provide_receive_buffer(uring, buffer_id);
+
+    handlers->client_datagram(state, read_bytes);
+}
+
+
+static
+void handle_send_completion(server_game_state_t *state,
+                            uring_backend_t *uring,
+                            struct io_uring_cqe *cqe) {
+
+    uint16_t slot_index = cqe->user_data & 0xFFFF;
+    uring_send_slot_t *slot = &uring->send_slots[slot_index];
+
+    uring->copies[slot->copy_index].references--;
+    uring->free_slots[uring->free_slots_count++] = slot_index;
+
+    if(cqe->res >= 0) {
+        return;
+    }
+
+    /* Datagrams of the failed send and of the sends linked after it
+     * (cancelled) are lost, the client gets them again when it asks
+     * for the events it is missing
+     */
+    client_t *client = &state->players[slot->client_no];
+
+    if(client->conn.is_connection_active && client->conn.session_id == slot->session_id) {
+        mark_client_for_resync(state, slot->client_no, slot->game_id);
+    }
+
+    if(cqe->res == -ECANCELED) {
+        return;
+    }
+
+    if(slot->segmented && (cqe->res == -EIO || cqe->res == -EINVAL ||
+                           cqe->res == -EOPNOTSUPP)) {
+        /* Segmentation offload not available, further bursts are
+         * sent one datagram per operation
+         */
+        state->gso_supported = false;
+    }
+
+    errno = -cqe->res;
+    log_error(LOG_ERROR, "sendmsg");
+}
+
+
+static
+void handle_completion(server_game_state_t *state,
+                       uring_backend_t *uring,
+                       const server_event_handlers_t *handlers,
+                       struct io_uring_cqe *cqe) {
+
+    uint8_t tag = cqe->user_data >> 56;
+    uint32_t generation = (cqe->user_data >> 16) & 0xFFFFFFFF;
+    uint16_t index = cqe->user_data & 0xFFFF;
+
+    if(tag == URING_TAG_RECEIVE) {
+        handle_receive_completion(state, uring, handlers, cqe);
+    }
+    else if(tag == URING_TAG_SEND) {
+        handle_send_completion(state, uring, cqe);
+    }
+    else if(tag == URING_TAG_ROUND) {
+        if(!uring->round_running || generation != uring->round_generation ||
+           cqe->res != -ETIME) {
+            return;
+        }
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        /* Skip the deadlines which have already passed (as timerfd would
+         * report them as a single expiration)
+         */
+        do {
+            timespec_add(&uring->round_deadline, &uring->round_period);
+        } while(timespec_before(&uring->round_deadline, &now));
+
+        arm_timeout(uring, &uring->round_deadline, IORING_TIMEOUT_ABS, cqe->user_data);
+
+        handlers->round_tick(state);
+    }
+    else if(tag == URING_TAG_CLIENT_TIMER) {
+        if(index >= MAX_PLAYERS || generation != uring->client_generation[index] ||
+           cqe->res != -ETIME) {
+            return;
+        }
+
+        arm_timeout(uring, &uring->client_timeout, 0, cqe->user_data);
+
+        handlers->client_timeout(state, index);
+    }
+}
+
+
+void uring_backend_run(server_game_state_t *state, const server_event_handlers_t *handlers) {
+    uring_backend_t *uring = state->backend_data;
+
+    arm_receive(state, uring);
+
+    while(1) {
+        /* Submit everything queued while handling previous completions
+         * and wait for at least one new completion - a single system call
+         * per iteration of the loop
+         */
+        flush_submissions(uring, 1);
+
+        unsigned head = *uring->cq_head;
+        unsigned tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+
+        while(head != tail) {
+            struct io_uring_cqe cqe = uring->cqes[head & *uring->cq_mask];
+
+            head++;
+            __atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+
+            handle_completion(state, uring, handlers, &cqe);
+
+            tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+        }
+
+        /* Sends of this backend do not block, so only the events queued
+         * for the resynchronisation of the clients wait here
+         */
+        if(outbound_backlog(state)) {
+            drain_outbound_queues(state);
+        }
+
+        handlers->iteration_done(state);
+    }
+}
@@ -0,0 +1,83 @@
+#ifndef SERVER_URING_H
+#define SERVER_URING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "game_server_protocol.h"
+#include "client_protocol.h"
+
+
+/* Number of submission queue entries of the ring (completion
+ * queue is twice as big)
+ */
+#define URING_QUEUE_ENTRIES                             256
+
+
+/* Number of buffers provided to the kernel for multishot receives
+ * on the server socket (has to be a power of two)
+ */
+#define URING_RECEIVE_BUFFERS                            64
+
+
+/* Number of sendmsg operations which can be in flight at once
+ */
+#define URING_SEND_SLOTS                                512
+
+
+/* Number of bursts which can be referenced by in-flight sends
+ * at once (each burst is copied once, regardless of the number
+ * of its recipients)
+ */
+#define URING_BURST_COPIES                                8
+
+
+typedef struct server_event_handlers_t server_event_handlers_t;
+
+
+/* Callbacks through which the event loops of the io_uring and threaded
+ * backends pass completed events to the game logic
+ */
+struct server_event_handlers_t {
+    /* Called after a datagram has been copied to the server buffer and
+     * its sender to receive_address field. Second argument is the length
+     * of the datagram
+     */
+    void (*client_datagram)(server_game_state_t *, ssize_t);
+
+    /* Called with the datagram already decoded (third argument) by the I/O
+     * thread, its sender is stored in receive_address field. Second argument
+     * is the length of the datagram
+     */
+    void (*client_update)(server_game_state_t *, ssize_t, client_dgram_t *);
+
+    /* Called on each expiration of the round timer
+     */
+    void (*round_tick)(server_game_state_t *);
+
+    /* Called on each expiration of the timeout timer of the client with
+     * id passed as the second argument
+     */
+    void (*client_timeout)(server_game_state_t *, uint8_t);
+
+    /* Called after each batch of completions has been handled (or when
+     * waiting for completions has been interrupted by a signal)
+     */
+    void (*iteration_done)(server_game_state_t *);
+};
+
+
+/* Sets up io_uring instance for the server socket and installs io_uring
+ * backend in server_game_state_t structure. Returns false (leaving the
+ * default backend untouched) when io_uring is not available
+ */
+bool uring_backend_init(server_game_state_t *);
+
+
+/* Runs the server event loop: keeps multishot receive posted on the server
+ * socket and passes completions to the handlers. Never returns
+ */
+void uring_backend_run(server_game_state_t *, const server_event_handlers_t *);
+
+
+#endif /* SERVER_URING_H */
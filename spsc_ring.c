@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "spsc_ring.h"
+
+
+/* Every record starts with 8 bytes header (its length and padding), so that
+ * the data which follows is aligned to 8 bytes
+ */
+#define RECORD_HEADER_SIZE                                8
+
+
+static
+uint32_t padded_record_size(uint32_t length) {
+    return (RECORD_HEADER_SIZE + length + 7) & ~7U;
+}
+
+
+bool spsc_ring_init(spsc_ring_t *ring, uint32_t capacity) {
+    if(capacity < RECORD_HEADER_SIZE || (capacity & (capacity - 1)) != 0) {
+        fprintf(stderr, "Ring capacity has to be a power of two\n");
+        return false;
+    }
+
+    memset(ring, 0, sizeof(spsc_ring_t));
+
+    ring->data = malloc(capacity);
+
+    if(ring->data == NULL) {
+        perror("malloc");
+        return false;
+    }
+
+    ring->capacity = capacity;
+
+    return true;
+}
+
+
+void spsc_ring_free(spsc_ring_t *ring) {
+    free(ring->data);
+    ring->data = NULL;
+}
+
+
+void *spsc_ring_reserve(spsc_ring_t *ring, uint32_t length) {
+    uint32_t size = padded_record_size(length);
+
+    if(size > ring->capacity / 2) {
+        return NULL;
+    }
+
+    uint64_t position = ring->tail;
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint32_t offset = position & (ring->capacity - 1);
+
+    /* Records never wrap around the end of the data area, the rest of it
+     * is filled with padding record if the new one does not fit
+     */
+    uint32_t padding = 0;
+
+    if(offset + size > ring->capacity) {
+        padding = ring->capacity - offset;
+    }
+
+    if(position + padding + size - head > ring->capacity) {
+        return NULL;
+    }
+
+    if(padding > 0) {
+        uint32_t marker = SPSC_RING_PADDING;
+        memcpy(ring->data + offset, &marker, sizeof(marker));
+
+        position += padding;
+        offset = 0;
+    }
+
+    memcpy(ring->data + offset, &length, sizeof(length));
+
+    ring->reserved_position = position;
+    ring->reserved_size = size;
+
+    return ring->data + offset + RECORD_HEADER_SIZE;
+}
+
+
+void spsc_ring_commit(spsc_ring_t *ring) {
+    __atomic_store_n(&ring->tail, ring->reserved_position + ring->reserved_size, __ATOMIC_RELEASE);
+}
+
+
+void *spsc_ring_peek(spsc_ring_t *ring, uint32_t *length) {
+    uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+    while(ring->head != tail) {
+        uint32_t offset = ring->head & (ring->capacity - 1);
+
+        memcpy(length, ring->data + offset, sizeof(uint32_t));
+
+        if(*length == SPSC_RING_PADDING) {
+            /* Padding up to the end of the data area */
+            __atomic_store_n(&ring->head, ring->head + (ring->capacity - offset), __ATOMIC_RELEASE);
+            continue;
+        }
+
+        ring->peeked_size = padded_record_size(*length);
+
+        return ring->data + offset + RECORD_HEADER_SIZE;
+    }
+
+    return NULL;
+}
+
+
+void spsc_ring_release(spsc_ring_t *ring) {
+    __atomic_store_n(&ring->head, ring->head + ring->peeked_size, __ATOMIC_RELEASE);
+}
+
+
+bool spsc_ring_empty(spsc_ring_t *ring) {
+    return __atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST) ==
+           __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST);
+}
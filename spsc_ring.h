@@ -0,0 +1,94 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/* Length value of a record which only pads the data area up to its end
+ * (the next record starts at the beginning of the data area)
+ */
+#define SPSC_RING_PADDING                        0xFFFFFFFF
+
+
+/* Size of the cache line, the positions of the producer and the consumer
+ * are kept on separate lines
+ */
+#define SPSC_RING_CACHE_LINE                             64
+
+
+typedef struct spsc_ring_t spsc_ring_t;
+
+
+/* Lock-free ring of variable length records between exactly one producer
+ * thread and exactly one consumer thread. Records are written in place
+ * (reserve, fill, commit) and read in place (peek, use, release)
+ */
+struct spsc_ring_t {
+    /* Position (total number of bytes ever released) of the consumer
+     */
+    uint64_t head __attribute__((aligned(SPSC_RING_CACHE_LINE)));
+
+    /* Size of the record returned by the last peek (consumer only)
+     */
+    uint32_t peeked_size;
+
+    /* Position up to which records have been committed by the producer
+     */
+    uint64_t tail __attribute__((aligned(SPSC_RING_CACHE_LINE)));
+
+    /* Position and size of the record returned by the last reserve
+     * (producer only)
+     */
+    uint64_t reserved_position;
+    uint32_t reserved_size;
+
+    /* Size of the data area (power of two) and the data area itself
+     */
+    uint32_t capacity __attribute__((aligned(SPSC_RING_CACHE_LINE)));
+    char *data;
+};
+
+
+/* Allocates data area of given capacity (has to be a power of two).
+ * Returns false on failure
+ */
+bool spsc_ring_init(spsc_ring_t *, uint32_t);
+
+
+/* Deallocates the data area
+ */
+void spsc_ring_free(spsc_ring_t *);
+
+
+/* Reserves space for the record of given length. Returns pointer to the
+ * space (aligned to 8 bytes) or NULL if the ring is full. Producer only
+ */
+void *spsc_ring_reserve(spsc_ring_t *, uint32_t);
+
+
+/* Makes the record returned by the last reserve visible to the consumer.
+ * Producer only
+ */
+void spsc_ring_commit(spsc_ring_t *);
+
+
+/* Returns pointer to the oldest record and stores its length under the
+ * second argument, or returns NULL if the ring is empty. Consumer only
+ */
+void *spsc_ring_peek(spsc_ring_t *, uint32_t *);
+
+
+/* Gives the space of the record returned by the last peek back to the
+ * producer. Consumer only
+ */
+void spsc_ring_release(spsc_ring_t *);
+
+
+/* Returns true if there is no committed record (or padding) which has not
+ * been released yet. Does not modify the ring, can be called by any thread
+ */
+bool spsc_ring_empty(spsc_ring_t *);
+
+
+#endif /* SPSC_RING_H */
@@ -0,0 +1,263 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+#include "trace.h"
+#include "utils.h"
+
+
+typedef struct trace_ring_t trace_ring_t;
+
+
+struct trace_ring_t {
+    /* Number of records made by the thread so far, the next one goes to
+     * the slot position % TRACE_RING_CAPACITY
+     */
+    uint64_t position;
+    uint32_t thread_no;
+
+    trace_record_t records[TRACE_RING_CAPACITY];
+};
+
+
+bool trace_enabled = false;
+
+
+static char trace_path[PATH_MAX];
+
+static trace_ring_t *rings[TRACE_MAX_THREADS];
+static uint32_t rings_count = 0;
+
+/* Set while the trace is being written (a crash during the dump must not
+ * start it again)
+ */
+static bool dumping = false;
+
+
+/* Ring of the calling thread, allocated with its first record. Threads
+ * over the limit are not traced
+ */
+static __thread trace_ring_t *thread_ring = NULL;
+static __thread bool thread_untraced = false;
+
+
+static
+void handle_trace_signal(int signal_number) {
+    int saved_errno = errno;
+
+    trace_dump();
+
+    /* Fatal signals are delivered again with the default action restored */
+    if(signal_number != SIGUSR2) {
+        raise(signal_number);
+    }
+
+    errno = saved_errno;
+}
+
+
+bool trace_start(const char *path) {
+    if(strlen(path) >= sizeof(trace_path)) {
+        fprintf(stderr, "Trace file name too long\n");
+        return false;
+    }
+
+    strcpy(trace_path, path);
+
+    struct sigaction dump_action;
+    memset(&dump_action, 0, sizeof(dump_action));
+    dump_action.sa_handler = handle_trace_signal;
+    dump_action.sa_flags = SA_RESTART;
+
+    if(sigaction(SIGUSR2, &dump_action, NULL) < 0) {
+        perror("sigaction");
+        return false;
+    }
+
+    int fatal_signals[] = {SIGINT, SIGTERM, SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT};
+
+    dump_action.sa_flags = SA_RESETHAND;
+
+    for(size_t i = 0; i < sizeof(fatal_signals) / sizeof(fatal_signals[0]); ++i) {
+        if(sigaction(fatal_signals[i], &dump_action, NULL) < 0) {
+            perror("sigaction");
+            return false;
+        }
+    }
+
+    if(atexit(trace_dump) != 0) {
+        fprintf(stderr, "Trace not written at exit\n");
+    }
+
+    __atomic_store_n(&trace_enabled, true, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+
+static
+trace_ring_t *allocate_thread_ring(void) {
+    uint32_t thread_no = __atomic_load_n(&rings_count, __ATOMIC_RELAXED);
+
+    if(thread_no >= TRACE_MAX_THREADS) {
+        thread_untraced = true;
+        return NULL;
+    }
+
+    trace_ring_t *ring = calloc(1, sizeof(trace_ring_t));
+
+    if(ring == NULL) {
+        thread_untraced = true;
+        return NULL;
+    }
+
+    /* Claim the slot of the registry, the ring becomes visible to the
+     * dump when the count is increased past it
+     */
+    while(!__atomic_compare_exchange_n(&rings_count, &thread_no, thread_no + 1, false,
+                                       __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+
+        if(thread_no >= TRACE_MAX_THREADS) {
+            free(ring);
+            thread_untraced = true;
+            return NULL;
+        }
+    }
+
+    ring->thread_no = thread_no;
+    __atomic_store_n(&rings[thread_no], ring, __ATOMIC_RELEASE);
+
+    return ring;
+}
+
+
+void trace_record(uint8_t type,
+                  uint16_t room,
+                  uint8_t client,
+                  uint32_t round,
+                  uint64_t start,
+                  uint32_t first,
+                  uint32_t second,
+                  uint32_t third) {
+
+    trace_ring_t *ring = thread_ring;
+
+    if(ring == NULL) {
+        if(thread_untraced || (ring = allocate_thread_ring()) == NULL) {
+            return;
+        }
+
+        thread_ring = ring;
+    }
+
+    uint64_t now = monotonic_nanos();
+    trace_record_t *record = &ring->records[ring->position & (TRACE_RING_CAPACITY - 1)];
+
+    record->timestamp = start;
+    record->duration = now - start > UINT32_MAX ? UINT32_MAX : (uint32_t) (now - start);
+    record->round = round;
+    record->type = type;
+    record->client = client;
+    record->room = room;
+    record->arguments[0] = first;
+    record->arguments[1] = second;
+    record->arguments[2] = third;
+
+    __atomic_store_n(&ring->position, ring->position + 1, __ATOMIC_RELEASE);
+}
+
+
+static
+bool write_all(int fd, const void *data, size_t length) {
+    const char *buffer = data;
+
+    while(length > 0) {
+        ssize_t written = write(fd, buffer, length);
+
+        if(written < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if(written <= 0) {
+            return false;
+        }
+
+        buffer += written;
+        length -= written;
+    }
+
+    return true;
+}
+
+
+void trace_dump(void) {
+    if(!__atomic_load_n(&trace_enabled, __ATOMIC_ACQUIRE) ||
+       __atomic_exchange_n(&dumping, true, __ATOMIC_ACQUIRE)) {
+
+        return;
+    }
+
+    int fd = open(trace_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if(fd < 0) {
+        __atomic_store_n(&dumping, false, __ATOMIC_RELEASE);
+        return;
+    }
+
+    uint32_t threads_count = __atomic_load_n(&rings_count, __ATOMIC_ACQUIRE);
+
+    /* Rings whose slot has been claimed but not filled yet are skipped */
+    trace_ring_t *dumped_rings[TRACE_MAX_THREADS];
+    uint32_t dumped_count = 0;
+
+    for(uint32_t i = 0; i < threads_count; ++i) {
+        trace_ring_t *ring = __atomic_load_n(&rings[i], __ATOMIC_ACQUIRE);
+
+        if(ring != NULL) {
+            dumped_rings[dumped_count++] = ring;
+        }
+    }
+
+    trace_file_header_t file_header;
+    memset(&file_header, 0, sizeof(file_header));
+
+    file_header.magic = TRACE_FILE_MAGIC;
+    file_header.version = TRACE_FILE_VERSION;
+    file_header.record_size = sizeof(trace_record_t);
+    file_header.threads_count = dumped_count;
+    file_header.ring_capacity = TRACE_RING_CAPACITY;
+
+    bool written = write_all(fd, &file_header, sizeof(file_header));
+
+    for(uint32_t i = 0; i < dumped_count && written; ++i) {
+        trace_ring_t *ring = dumped_rings[i];
+        uint64_t position = __atomic_load_n(&ring->position, __ATOMIC_ACQUIRE);
+        uint64_t count = position < TRACE_RING_CAPACITY ? position : TRACE_RING_CAPACITY;
+        uint64_t first = (position - count) & (TRACE_RING_CAPACITY - 1);
+
+        trace_thread_header_t thread_header;
+        memset(&thread_header, 0, sizeof(thread_header));
+
+        thread_header.thread_no = ring->thread_no;
+        thread_header.records_count = count;
+        thread_header.overwritten = position - count;
+
+        written = write_all(fd, &thread_header, sizeof(thread_header));
+
+        /* The records wrap around the end of the ring */
+        uint64_t until_end = TRACE_RING_CAPACITY - first < count ? TRACE_RING_CAPACITY - first : count;
+
+        written = written &&
+                  write_all(fd, &ring->records[first], until_end * sizeof(trace_record_t)) &&
+                  write_all(fd, &ring->records[0], (count - until_end) * sizeof(trace_record_t));
+    }
+
+    close(fd);
+
+    __atomic_store_n(&dumping, false, __ATOMIC_RELEASE);
+}
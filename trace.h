@@ -0,0 +1,124 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/* Number of records kept by each thread (has to be a power of two), the
+ * oldest records are overwritten
+ */
+#define TRACE_RING_CAPACITY                       (1 << 16)
+
+
+/* Maximal number of threads which record the trace
+ */
+#define TRACE_MAX_THREADS                               128
+
+
+/* Layout of the trace file: the file header, then for each thread the
+ * thread header followed by its records (the oldest first). All the
+ * integers are stored in the byte order of the host which wrote the file
+ */
+#define TRACE_FILE_MAGIC                         0x52545753
+#define TRACE_FILE_VERSION                                1
+
+
+/* Types of the records and the meaning of their arguments
+ *
+ * TRACE_ROUND_TICK       - game status, number of events, number of players
+ * TRACE_CLIENT_DATAGRAM  - length, turn direction, next expected event
+ * TRACE_BOARD_UPDATE     - first new event, number of new events, number
+ *                          of alive players
+ * TRACE_PACK_EVENTS      - first event, number of packed events, length
+ *                          of the datagrams
+ * TRACE_SEND             - length of the datagrams, number of datagrams,
+ *                          send status
+ *
+ * The client field is the index of the client the record refers to (or
+ * TRACE_NO_CLIENT)
+ */
+#define TRACE_ROUND_TICK                                  1
+#define TRACE_CLIENT_DATAGRAM                             2
+#define TRACE_BOARD_UPDATE                                3
+#define TRACE_PACK_EVENTS                                 4
+#define TRACE_SEND                                        5
+#define TRACE_RECORD_TYPES                                6
+
+#define TRACE_NO_CLIENT                                0xff
+
+
+typedef struct trace_record_t trace_record_t;
+typedef struct trace_file_header_t trace_file_header_t;
+typedef struct trace_thread_header_t trace_thread_header_t;
+
+
+struct trace_record_t {
+    /* Start of the traced phase (in nanoseconds of the monotonic clock)
+     * and its duration (in nanoseconds)
+     */
+    uint64_t timestamp;
+    uint32_t duration;
+
+    /* Number of the round of the game in which the record was made
+     */
+    uint32_t round;
+
+    uint8_t type;
+    uint8_t client;
+    uint16_t room;
+
+    uint32_t arguments[3];
+};
+
+
+struct trace_file_header_t {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;
+    uint32_t threads_count;
+    uint32_t ring_capacity;
+};
+
+
+struct trace_thread_header_t {
+    /* Number of the thread (in order of their first records), number of
+     * records which follow and number of older records overwritten
+     */
+    uint32_t thread_no;
+    uint32_t records_count;
+    uint64_t overwritten;
+};
+
+
+/* Set when tracing has been started, the traced places check it before
+ * taking any time
+ */
+extern bool trace_enabled;
+
+
+/* Starts tracing. The trace is written to the file with given name on
+ * SIGUSR2, when the program exits and when it is terminated by a signal
+ * (SIGINT, SIGTERM, SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT). Returns false
+ * on failure
+ */
+bool trace_start(const char *);
+
+
+/* Records the phase of given type (first argument) of the room (second
+ * argument) which concerns the client (third argument), made in given
+ * round (fourth argument) and started at the time given as the fifth
+ * argument (see monotonic_nanos), with three arguments of the record. The record
+ * goes to the ring of the calling thread
+ */
+void trace_record(uint8_t, uint16_t, uint8_t, uint32_t, uint64_t, uint32_t, uint32_t, uint32_t);
+
+
+/* Writes the rings of all the threads to the trace file. Uses only
+ * async-signal-safe calls (a record being written concurrently may be
+ * dumped half written)
+ */
+void trace_dump(void);
+
+
+#endif /* TRACE_H */
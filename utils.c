@@ -3,6 +3,7 @@
 #include <string.h>
 #include <stdbool.h>
 #include <ctype.h>
+#include <sys/socket.h>
 #include "utils.h"
 
 
@@ -161,3 +162,69 @@ size_t digits_count(uint32_t val) {
 
     return res;
 }
+
+
+uint64_t monotonic_nanos(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return timespec_nanos(&now);
+}
+
+
+uint64_t timespec_nanos(const struct timespec *time) {
+    return (uint64_t) time->tv_sec * 1000000000ULL + time->tv_nsec;
+}
+
+
+uint64_t realtime_nanos(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    return timespec_nanos(&now);
+}
+
+
+uint64_t receive_timestamp(struct msghdr *msg) {
+    for(struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+            struct timespec stamp;
+            memcpy(&stamp, CMSG_DATA(cmsg), sizeof(stamp));
+
+            return timespec_nanos(&stamp);
+        }
+    }
+
+    return realtime_nanos();
+}
+
+
+ssize_t receive_datagram(int sock,
+                         char *buffer,
+                         size_t length,
+                         struct sockaddr_in6 *address,
+                         socklen_t *address_length,
+                         uint64_t *receive_nanos) {
+
+    char control[CMSG_SPACE(sizeof(struct timespec))];
+    struct iovec iov = { buffer, length };
+    struct msghdr msg;
+
+    memset(&msg, 0, sizeof(msg));
+
+    msg.msg_name = address;
+    msg.msg_namelen = *address_length;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t read_bytes = recvmsg(sock, &msg, 0);
+
+    if(read_bytes >= 0) {
+        *address_length = msg.msg_namelen;
+        *receive_nanos = receive_timestamp(&msg);
+    }
+
+    return read_bytes;
+}
@@ -4,7 +4,9 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <time.h>
 #include <arpa/inet.h>
+#include <sys/socket.h>
 
 
 #define MAX_PLAYERS                                      25
@@ -58,4 +60,35 @@ uint32_t crc_32(char *, size_t);
 size_t digits_count(uint32_t);
 
 
+/* Returns current time of the monotonic clock (in nanoseconds)
+ */
+uint64_t monotonic_nanos(void);
+
+
+/* Converts the time (e.g. interval of a timer) to nanoseconds
+ */
+uint64_t timespec_nanos(const struct timespec *);
+
+
+/* Returns current time of the realtime clock (in nanoseconds), the clock
+ * of the kernel receive timestamps
+ */
+uint64_t realtime_nanos(void);
+
+
+/* Returns the kernel receive timestamp (SCM_TIMESTAMPNS) of the datagram
+ * received with the message header passed as the argument, or the current
+ * time if there is none (see realtime_nanos)
+ */
+uint64_t receive_timestamp(struct msghdr *);
+
+
+/* Receives a single datagram from the socket (first argument) into the
+ * buffer of given length, storing the address of its sender (with its
+ * length) and the time of its receipt (see receive_timestamp). Returns
+ * the result of recvmsg
+ */
+ssize_t receive_datagram(int, char *, size_t, struct sockaddr_in6 *, socklen_t *, uint64_t *);
+
+
 #endif /* UTILS_H */